@@ -19,113 +19,614 @@
 #include <ucommon/export.h>
 #include <ucommon/atomic.h>
 #include <ucommon/thread.h>
+#include <string.h>
+
+#if defined(HAVE_SCHED_GETCPU) && !defined(_MSWINDOWS_)
+#include <sched.h>
+#endif
+
+#ifdef  _MSWINDOWS_
+#define cpu_relax() YieldProcessor()
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax()
+#endif
+
+// after 2^10 pauses a waiter is better off giving up its time slice...
+#define BACKOFF_LIMIT   10
 
 using namespace UCOMMON_NAMESPACE;
 
-atomic::counter::counter(long init)
+#if defined(HAVE_GCC_ATOMICS) && defined(__ATOMIC_SEQ_CST)
+
+// memory model builtins need constant orders to generate relaxed code...
+
+#define ATOMIC_ORDERED(call, order) \
+    switch(order) { \
+    case atomic::RELAXED: \
+        return call(__ATOMIC_RELAXED); \
+    case atomic::ACQUIRE: \
+        return call(__ATOMIC_ACQUIRE); \
+    case atomic::RELEASE: \
+        return call(__ATOMIC_RELEASE); \
+    case atomic::ACQREL: \
+        return call(__ATOMIC_ACQ_REL); \
+    default: \
+        return call(__ATOMIC_SEQ_CST); \
+    }
+
+template<typename T>
+static inline T atomic_load(volatile T *ptr, atomic::order_t order)
 {
-    value = init;
+    switch(order) {
+    case atomic::RELAXED:
+        return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+    case atomic::ACQUIRE:
+    case atomic::ACQREL:
+        return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    default:
+        return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+    }
 }
 
-atomic::spinlock::spinlock()
+template<typename T>
+static inline void atomic_store(volatile T *ptr, T value, atomic::order_t order)
 {
-    value = 0;
+    switch(order) {
+    case atomic::RELAXED:
+        __atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+        break;
+    case atomic::RELEASE:
+    case atomic::ACQREL:
+        __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+        break;
+    default:
+        __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+    }
+}
+
+template<typename T>
+static inline T atomic_exchange(volatile T *ptr, T value, atomic::order_t order)
+{
+#define CALL(mo) __atomic_exchange_n(ptr, value, mo)
+    ATOMIC_ORDERED(CALL, order)
+#undef  CALL
 }
 
-#ifdef HAVE_GCC_ATOMICS
+template<typename T>
+static inline bool atomic_cas(volatile T *ptr, T& expected, T value, atomic::order_t order)
+{
+    switch(order) {
+    case atomic::RELAXED:
+        return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    case atomic::ACQUIRE:
+        return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+    case atomic::RELEASE:
+        return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    case atomic::ACQREL:
+        return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    default:
+        return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+}
 
-long atomic::counter::operator++()
+template<typename T>
+static inline T atomic_add(volatile T *ptr, T value, atomic::order_t order)
 {
-    return __sync_add_and_fetch(&value, 1);
+#define CALL(mo) __atomic_fetch_add(ptr, value, mo)
+    ATOMIC_ORDERED(CALL, order)
+#undef  CALL
 }
 
-long atomic::counter::operator--()
+template<typename T>
+static inline T atomic_or(volatile T *ptr, T value, atomic::order_t order)
 {
-    return __sync_sub_and_fetch(&value, 1);
+#define CALL(mo) __atomic_fetch_or(ptr, value, mo)
+    ATOMIC_ORDERED(CALL, order)
+#undef  CALL
 }
 
-long atomic::counter::operator+=(long change)
+template<typename T>
+static inline T atomic_and(volatile T *ptr, T value, atomic::order_t order)
 {
-    return __sync_add_and_fetch(&value, change);
+#define CALL(mo) __atomic_fetch_and(ptr, value, mo)
+    ATOMIC_ORDERED(CALL, order)
+#undef  CALL
 }
 
-long atomic::counter::operator-=(long change)
+void atomic::fence(order_t order)
 {
-    return __sync_sub_and_fetch(&value, change);
+#define CALL(mo) __atomic_thread_fence(mo)
+    ATOMIC_ORDERED(CALL, order)
+#undef  CALL
 }
 
-bool atomic::spinlock::acquire(void)
+#elif defined(HAVE_GCC_ATOMICS)
+
+// legacy sync builtins are full barriers, so every order is sequential...
+
+template<typename T>
+static inline T atomic_load(volatile T *ptr, atomic::order_t)
 {
-    // if not locked by another already, then we acquired it...
-    return (__sync_lock_test_and_set(&value, 1) == 0);
+    __sync_synchronize();
+    T value = *ptr;
+    __sync_synchronize();
+    return value;
 }
 
-void atomic::spinlock::release(void)
+template<typename T>
+static inline void atomic_store(volatile T *ptr, T value, atomic::order_t)
+{
+    __sync_synchronize();
+    *ptr = value;
+    __sync_synchronize();
+}
+
+template<typename T>
+static inline bool atomic_cas(volatile T *ptr, T& expected, T value, atomic::order_t)
 {
-    __sync_lock_release(&value);
+    T prior = __sync_val_compare_and_swap(ptr, expected, value);
+    if(prior == expected)
+        return true;
+    expected = prior;
+    return false;
+}
+
+template<typename T>
+static inline T atomic_exchange(volatile T *ptr, T value, atomic::order_t order)
+{
+    T prior = *ptr;
+    while(!atomic_cas(ptr, prior, value, order))
+        ;
+    return prior;
+}
+
+template<typename T>
+static inline T atomic_add(volatile T *ptr, T value, atomic::order_t)
+{
+    return __sync_fetch_and_add(ptr, value);
+}
+
+template<typename T>
+static inline T atomic_or(volatile T *ptr, T value, atomic::order_t)
+{
+    return __sync_fetch_and_or(ptr, value);
+}
+
+template<typename T>
+static inline T atomic_and(volatile T *ptr, T value, atomic::order_t)
+{
+    return __sync_fetch_and_and(ptr, value);
+}
+
+void atomic::fence(order_t)
+{
+    __sync_synchronize();
 }
 
 #else
 
 #define SIMULATED true
 
+template<typename T>
+static inline T atomic_load(volatile T *ptr, atomic::order_t)
+{
+    Mutex::protect((void *)ptr);
+    T value = *ptr;
+    Mutex::release((void *)ptr);
+    return value;
+}
+
+template<typename T>
+static inline void atomic_store(volatile T *ptr, T value, atomic::order_t)
+{
+    Mutex::protect((void *)ptr);
+    *ptr = value;
+    Mutex::release((void *)ptr);
+}
+
+template<typename T>
+static inline bool atomic_cas(volatile T *ptr, T& expected, T value, atomic::order_t)
+{
+    bool rtn = true;
+
+    Mutex::protect((void *)ptr);
+    if(*ptr == expected)
+        *ptr = value;
+    else {
+        expected = *ptr;
+        rtn = false;
+    }
+    Mutex::release((void *)ptr);
+    return rtn;
+}
+
+template<typename T>
+static inline T atomic_exchange(volatile T *ptr, T value, atomic::order_t)
+{
+    Mutex::protect((void *)ptr);
+    T prior = *ptr;
+    *ptr = value;
+    Mutex::release((void *)ptr);
+    return prior;
+}
+
+template<typename T>
+static inline T atomic_add(volatile T *ptr, T value, atomic::order_t)
+{
+    Mutex::protect((void *)ptr);
+    T prior = *ptr;
+    *ptr = prior + value;
+    Mutex::release((void *)ptr);
+    return prior;
+}
+
+template<typename T>
+static inline T atomic_or(volatile T *ptr, T value, atomic::order_t)
+{
+    Mutex::protect((void *)ptr);
+    T prior = *ptr;
+    *ptr = prior | value;
+    Mutex::release((void *)ptr);
+    return prior;
+}
+
+template<typename T>
+static inline T atomic_and(volatile T *ptr, T value, atomic::order_t)
+{
+    Mutex::protect((void *)ptr);
+    T prior = *ptr;
+    *ptr = prior & value;
+    Mutex::release((void *)ptr);
+    return prior;
+}
+
+void atomic::fence(order_t)
+{
+    static int barrier;
+
+    // a mutex round-trip is a full memory barrier...
+    Mutex::protect(&barrier);
+    Mutex::release(&barrier);
+}
+
+#endif
+
+atomic::counter::counter(long init)
+{
+    value = init;
+}
+
 long atomic::counter::operator++()
 {
-    long rval;
-    Mutex::protect((void *)&value);
-    rval = (long)(++value);
-    Mutex::release((void *)&value);
-    return rval;
+    return atomic_add<long>(&value, 1, SEQUENTIAL) + 1;
 }
 
 long atomic::counter::operator--()
 {
-    long rval;
-    Mutex::protect((void *)&value);
-    rval = (long)(--value);
-    Mutex::release((void *)&value);
-    return rval;
+    return atomic_add<long>(&value, -1, SEQUENTIAL) - 1;
 }
 
 long atomic::counter::operator+=(long change)
 {
-    long rval;
-    Mutex::protect((void *)&value);
-    rval = (long)(value += change);
-    Mutex::release((void *)&value);
-    return rval;
+    return atomic_add<long>(&value, change, SEQUENTIAL) + change;
 }
 
 long atomic::counter::operator-=(long change)
 {
-    long rval;
-    Mutex::protect((void *)&value);
-    rval = (long)(value -= change);
-    Mutex::release((void *)&value);
-    return rval;
+    return atomic_add<long>(&value, -change, SEQUENTIAL) - change;
 }
 
-bool atomic::spinlock::acquire(void)
+long atomic::counter::load(order_t order)
 {
-    bool rtn = true;
+    return atomic_load<long>(&value, order);
+}
 
-    Mutex::protect((void *)&value);
-    if(value == 1)
-        rtn = false;
+void atomic::counter::store(long change, order_t order)
+{
+    atomic_store<long>(&value, change, order);
+}
+
+long atomic::counter::exchange(long change, order_t order)
+{
+    return atomic_exchange<long>(&value, change, order);
+}
+
+bool atomic::counter::compare_exchange(long& expected, long change, order_t order)
+{
+    return atomic_cas<long>(&value, expected, change, order);
+}
+
+long atomic::counter::fetch_add(long change, order_t order)
+{
+    return atomic_add<long>(&value, change, order);
+}
+
+long atomic::counter::fetch_sub(long change, order_t order)
+{
+    return atomic_add<long>(&value, -change, order);
+}
+
+long atomic::counter::fetch_or(long bits, order_t order)
+{
+    return atomic_or<long>(&value, bits, order);
+}
+
+long atomic::counter::fetch_and(long bits, order_t order)
+{
+    return atomic_and<long>(&value, bits, order);
+}
+
+// sharded counter slots each own a cache line...
+#define SHARD_LINE  64
+
+typedef union {
+    volatile long value;
+    char pad[SHARD_LINE];
+} shard_t;
+
+static unsigned shard_index(void)
+{
+#if defined(_MSWINDOWS_) && defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+    return (unsigned)GetCurrentProcessorNumber();
+#else
+#if defined(HAVE_SCHED_GETCPU) && !defined(_MSWINDOWS_) && !defined(__PTH__)
+    int cpu = sched_getcpu();
+    if(cpu >= 0)
+        return (unsigned)cpu;
+#endif
+
+    // without a cpu number we spread threads by their identity...
+#ifdef  _MSWINDOWS_
+    uintptr_t id = (uintptr_t)GetCurrentThreadId();
+#else
+    pthread_t self = pthread_self();
+    uintptr_t id = 0;
+    memcpy(&id, &self, sizeof(self) < sizeof(id) ? sizeof(self) : sizeof(id));
+#endif
+    return (unsigned)((id * 2654435761u) >> 16);
+#endif
+}
+
+atomic::sharded::sharded(long size, unsigned count) :
+total(0)
+{
+    if(!count)
+        count = Thread::cpus();
+
+    unsigned slot = 1;
+    while(slot < count)
+        slot <<= 1;
+
+    if(size < 1)
+        size = 1;
+
+    batch = size;
+    mask = slot - 1;
+    memory = (caddr_t)malloc(sizeof(shard_t) * slot + SHARD_LINE);
+    crit(memory != NULL, "sharded alloc failed");
+    memset(memory, 0, sizeof(shard_t) * slot + SHARD_LINE);
+
+    size_t offset = (size_t)memory % SHARD_LINE;
+    if(offset)
+        slots = memory + SHARD_LINE - offset;
     else
-        value = 1;
-    Mutex::release((void *)&value);
-    return rtn;
+        slots = memory;
 }
 
-void atomic::spinlock::release(void)
+atomic::sharded::~sharded()
+{
+    free(memory);
+}
+
+long atomic::sharded::add(long offset)
+{
+    return add(shard_index(), offset);
+}
+
+long atomic::sharded::add(unsigned index, long offset)
+{
+    shard_t *slot = &((shard_t *)slots)[index & mask];
+    long value = atomic_add(&slot->value, offset, RELAXED) + offset;
+
+    if(value >= batch || value <= -batch) {
+        value = atomic_exchange(&slot->value, 0l, RELAXED);
+        return total.fetch_add(value, RELAXED) + value;
+    }
+
+    return total.load(RELAXED) + value;
+}
+
+unsigned atomic::sharded::index(void) const
+{
+    return shard_index() & mask;
+}
+
+long atomic::sharded::load(unsigned index)
+{
+    return atomic_load(&((shard_t *)slots)[index & mask].value, RELAXED);
+}
+
+long atomic::sharded::load(void)
+{
+    shard_t *slot = (shard_t *)slots;
+    long sum = total.load(RELAXED);
+
+    for(unsigned pos = 0; pos <= mask; ++pos)
+        sum += atomic_load(&slot[pos].value, RELAXED);
+
+    return sum;
+}
+
+void atomic::sharded::clear(void)
+{
+    shard_t *slot = (shard_t *)slots;
+
+    for(unsigned pos = 0; pos <= mask; ++pos)
+        atomic_exchange(&slot[pos].value, 0l, RELAXED);
+
+    total.store(0, RELAXED);
+}
+
+atomic::counter64::counter64(int64_t init)
+{
+    value = init;
+}
+
+int64_t atomic::counter64::operator++()
+{
+    return atomic_add<int64_t>(&value, 1, SEQUENTIAL) + 1;
+}
+
+int64_t atomic::counter64::operator--()
+{
+    return atomic_add<int64_t>(&value, -1, SEQUENTIAL) - 1;
+}
+
+int64_t atomic::counter64::operator+=(int64_t change)
+{
+    return atomic_add<int64_t>(&value, change, SEQUENTIAL) + change;
+}
+
+int64_t atomic::counter64::operator-=(int64_t change)
+{
+    return atomic_add<int64_t>(&value, -change, SEQUENTIAL) - change;
+}
+
+int64_t atomic::counter64::load(order_t order)
+{
+    return atomic_load<int64_t>(&value, order);
+}
+
+void atomic::counter64::store(int64_t change, order_t order)
+{
+    atomic_store<int64_t>(&value, change, order);
+}
+
+int64_t atomic::counter64::exchange(int64_t change, order_t order)
+{
+    return atomic_exchange<int64_t>(&value, change, order);
+}
+
+bool atomic::counter64::compare_exchange(int64_t& expected, int64_t change, order_t order)
+{
+    return atomic_cas<int64_t>(&value, expected, change, order);
+}
+
+int64_t atomic::counter64::fetch_add(int64_t change, order_t order)
+{
+    return atomic_add<int64_t>(&value, change, order);
+}
+
+int64_t atomic::counter64::fetch_sub(int64_t change, order_t order)
+{
+    return atomic_add<int64_t>(&value, -change, order);
+}
+
+int64_t atomic::counter64::fetch_or(int64_t bits, order_t order)
+{
+    return atomic_or<int64_t>(&value, bits, order);
+}
+
+int64_t atomic::counter64::fetch_and(int64_t bits, order_t order)
+{
+    return atomic_and<int64_t>(&value, bits, order);
+}
+
+atomic::pointer::pointer(void *init)
+{
+    value = init;
+}
+
+void *atomic::pointer::load(order_t order)
+{
+    return atomic_load<void *>(&value, order);
+}
+
+void atomic::pointer::store(void *change, order_t order)
+{
+    atomic_store<void *>(&value, change, order);
+}
+
+void *atomic::pointer::exchange(void *change, order_t order)
+{
+    return atomic_exchange<void *>(&value, change, order);
+}
+
+bool atomic::pointer::compare_exchange(void *& expected, void *change, order_t order)
+{
+    return atomic_cas<void *>(&value, expected, change, order);
+}
+
+void atomic::backoff(unsigned& spins)
+{
+    if(spins >= BACKOFF_LIMIT) {
+        Thread::yield();
+        return;
+    }
+
+    unsigned count = 1 << spins++;
+    while(count--)
+        cpu_relax();
+}
+
+atomic::spinlock::spinlock()
 {
-    Mutex::protect((void *)&value);
     value = 0;
-    Mutex::release((void *)&value);
 }
 
-#endif
+bool atomic::spinlock::acquire(void)
+{
+    // if not locked by another already, then we acquired it...
+    return (atomic_exchange<long>(&value, 1, ACQUIRE) == 0);
+}
+
+void atomic::spinlock::lock(void)
+{
+    unsigned spins = 0;
+
+    // test before test and set so waiters spin in their own cache...
+    for(;;) {
+        if(!atomic_load<long>(&value, RELAXED) && acquire())
+            return;
+        backoff(spins);
+    }
+}
+
+void atomic::spinlock::release(void)
+{
+    atomic_store<long>(&value, 0, RELEASE);
+}
+
+atomic::ticketlock::ticketlock()
+{
+    next = serving = 0;
+}
+
+bool atomic::ticketlock::acquire(void)
+{
+    long ticket = atomic_load<long>(&serving, ACQUIRE);
+
+    // only take a ticket if it would be served right away...
+    return atomic_cas<long>(&next, ticket, ticket + 1, ACQUIRE);
+}
+
+void atomic::ticketlock::lock(void)
+{
+    long ticket = atomic_add<long>(&next, 1, RELAXED);
+    unsigned spins = 0;
+
+    while(atomic_load<long>(&serving, ACQUIRE) != ticket)
+        backoff(spins);
+}
+
+void atomic::ticketlock::release(void)
+{
+    atomic_add<long>(&serving, 1, RELEASE);
+}
 
 #ifdef SIMULATED
 const bool atomic::simulated = true;
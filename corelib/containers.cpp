@@ -21,9 +21,16 @@
 #include <ucommon/object.h>
 #include <ucommon/memory.h>
 #include <ucommon/thread.h>
+#include <ucommon/atomic.h>
 #include <ucommon/containers.h>
 #include <string.h>
 
+// ring slot sequence header, padded so slot data stays aligned...
+#define RING_HEADER ((sizeof(atomic::counter) + 7) & ~((size_t)7))
+
+// backoff rounds to spin on a full or empty ring before sleeping...
+#define RING_SPINS  8
+
 using namespace UCOMMON_NAMESPACE;
 
 LinkedAllocator::LinkedAllocator() : Conditional()
@@ -305,6 +312,423 @@ bool Buffer::operator!()
     return rtn;
 }
 
+RingBuffer::RingBuffer(size_t osize, size_t c) :
+Conditional(), sleepers(0), tail(0), head(0)
+{
+    assert(osize > 0 && c > 0);
+
+    unsigned long limit = 2;
+    while(limit < c)
+        limit <<= 1;
+
+    mask = limit - 1;
+    objsize = osize;
+    slotsize = (RING_HEADER + osize + 7) & ~((size_t)7);
+    slots = (caddr_t)malloc(slotsize * limit);
+    crit(slots != NULL, "ring alloc failed");
+
+    // each slot starts out free for the producer of the same position...
+    for(unsigned long pos = 0; pos < limit; ++pos)
+        new((caddr_t)(slots + pos * slotsize)) atomic::counter((long)pos);
+}
+
+RingBuffer::~RingBuffer()
+{
+    if(slots)
+        free(slots);
+    slots = NULL;
+}
+
+unsigned RingBuffer::size(void)
+{
+    return (unsigned)(mask + 1);
+}
+
+unsigned RingBuffer::count(void)
+{
+    long last = head.load(atomic::ACQUIRE);
+    long first = tail.load(atomic::ACQUIRE);
+    long diff = (long)((unsigned long)first - (unsigned long)last);
+
+    if(diff < 0)
+        return 0;
+    if((unsigned long)diff > mask + 1)
+        return (unsigned)(mask + 1);
+    return (unsigned)diff;
+}
+
+bool RingBuffer::push(const void *data)
+{
+    long pos = tail.load(atomic::RELAXED);
+
+    for(;;) {
+        atomic::counter *seq = (atomic::counter *)(slots + (pos & mask) * slotsize);
+        long diff = (long)((unsigned long)seq->load(atomic::ACQUIRE) - (unsigned long)pos);
+
+        if(!diff) {
+            if(tail.compare_exchange(pos, (long)((unsigned long)pos + 1), atomic::RELAXED)) {
+                memcpy((caddr_t)seq + RING_HEADER, data, objsize);
+                seq->store((long)((unsigned long)pos + 1));
+                return true;
+            }
+        }
+        else if(diff < 0)
+            return false;
+        else
+            pos = tail.load(atomic::RELAXED);
+    }
+}
+
+bool RingBuffer::pop(void *data)
+{
+    long pos = head.load(atomic::RELAXED);
+
+    for(;;) {
+        atomic::counter *seq = (atomic::counter *)(slots + (pos & mask) * slotsize);
+        long diff = (long)((unsigned long)seq->load(atomic::ACQUIRE) - ((unsigned long)pos + 1));
+
+        if(!diff) {
+            if(head.compare_exchange(pos, (long)((unsigned long)pos + 1), atomic::RELAXED)) {
+                memcpy(data, (caddr_t)seq + RING_HEADER, objsize);
+                seq->store((long)((unsigned long)pos + mask + 1));
+                return true;
+            }
+        }
+        else if(diff < 0)
+            return false;
+        else
+            pos = head.load(atomic::RELAXED);
+    }
+}
+
+void RingBuffer::wake(void)
+{
+    // pairs with sleepers counting themselves before a final retry...
+    atomic::fence();
+    if(sleepers.load(atomic::RELAXED)) {
+        lock();
+        broadcast();
+        unlock();
+    }
+}
+
+void RingBuffer::put(const void *data)
+{
+    put(data, Timer::inf);
+}
+
+bool RingBuffer::put(const void *data, timeout_t timeout)
+{
+    assert(data != NULL);
+
+    struct timespec ts;
+    unsigned spins = 0;
+    bool rtn = true;
+
+    if(push(data)) {
+        wake();
+        return true;
+    }
+
+    if(!timeout)
+        return false;
+
+    while(spins < RING_SPINS) {
+        atomic::backoff(spins);
+        if(push(data)) {
+            wake();
+            return true;
+        }
+    }
+
+    if(timeout != Timer::inf)
+        set(&ts, timeout);
+
+    lock();
+    ++sleepers;
+    while(!push(data)) {
+        if(timeout == Timer::inf)
+            wait();
+        else if(!wait(&ts)) {
+            rtn = push(data);
+            break;
+        }
+    }
+    --sleepers;
+    unlock();
+    if(rtn)
+        wake();
+    return rtn;
+}
+
+void RingBuffer::copy(void *data)
+{
+    copy(data, Timer::inf);
+}
+
+bool RingBuffer::copy(void *data, timeout_t timeout)
+{
+    assert(data != NULL);
+
+    struct timespec ts;
+    unsigned spins = 0;
+    bool rtn = true;
+
+    if(pop(data)) {
+        wake();
+        return true;
+    }
+
+    if(!timeout)
+        return false;
+
+    while(spins < RING_SPINS) {
+        atomic::backoff(spins);
+        if(pop(data)) {
+            wake();
+            return true;
+        }
+    }
+
+    if(timeout != Timer::inf)
+        set(&ts, timeout);
+
+    lock();
+    ++sleepers;
+    while(!pop(data)) {
+        if(timeout == Timer::inf)
+            wait();
+        else if(!wait(&ts)) {
+            rtn = pop(data);
+            break;
+        }
+    }
+    --sleepers;
+    unlock();
+    if(rtn)
+        wake();
+    return rtn;
+}
+
+PipeBuffer::PipeBuffer(size_t osize, size_t c) :
+Conditional(), sleepers(0), tail(0), head(0)
+{
+    assert(osize > 0 && c > 0);
+
+    unsigned long limit = 2;
+    while(limit < c)
+        limit <<= 1;
+
+    mask = limit - 1;
+    objsize = osize;
+    ahead = behind = 0;
+    buf = (caddr_t)malloc(objsize * limit);
+    crit(buf != NULL, "pipe alloc failed");
+}
+
+PipeBuffer::~PipeBuffer()
+{
+    if(buf)
+        free(buf);
+    buf = NULL;
+}
+
+unsigned PipeBuffer::size(void)
+{
+    return (unsigned)(mask + 1);
+}
+
+unsigned PipeBuffer::count(void)
+{
+    unsigned long last = (unsigned long)head.load(atomic::ACQUIRE);
+    unsigned long first = (unsigned long)tail.load(atomic::ACQUIRE);
+
+    return (unsigned)(first - last);
+}
+
+unsigned PipeBuffer::store(const void *data, unsigned count)
+{
+    unsigned long pos = (unsigned long)tail.load(atomic::RELAXED);
+    unsigned long room = mask + 1 - (pos - ahead);
+
+    // only look at the consumer index when our cached copy says full...
+    if(room < count) {
+        ahead = (unsigned long)head.load(atomic::ACQUIRE);
+        room = mask + 1 - (pos - ahead);
+    }
+
+    if(count > room)
+        count = (unsigned)room;
+    if(!count)
+        return 0;
+
+    unsigned long offset = pos & mask;
+    unsigned long first = mask + 1 - offset;
+    if(first > count)
+        first = count;
+
+    memcpy(buf + offset * objsize, data, first * objsize);
+    if(count > first)
+        memcpy(buf, (const char *)data + first * objsize, (count - first) * objsize);
+
+    tail.store((long)(pos + count));
+    return count;
+}
+
+unsigned PipeBuffer::fetch(void *data, unsigned count)
+{
+    unsigned long pos = (unsigned long)head.load(atomic::RELAXED);
+    unsigned long avail = behind - pos;
+
+    // only look at the producer index when our cached copy says empty...
+    if(avail < count) {
+        behind = (unsigned long)tail.load(atomic::ACQUIRE);
+        avail = behind - pos;
+    }
+
+    if(count > avail)
+        count = (unsigned)avail;
+    if(!count)
+        return 0;
+
+    unsigned long offset = pos & mask;
+    unsigned long first = mask + 1 - offset;
+    if(first > count)
+        first = count;
+
+    memcpy(data, buf + offset * objsize, first * objsize);
+    if(count > first)
+        memcpy((char *)data + first * objsize, buf, (count - first) * objsize);
+
+    head.store((long)(pos + count));
+    return count;
+}
+
+void PipeBuffer::wake(void)
+{
+    // pairs with sleepers counting themselves before a final retry...
+    atomic::fence();
+    if(sleepers.load(atomic::RELAXED)) {
+        lock();
+        broadcast();
+        unlock();
+    }
+}
+
+unsigned PipeBuffer::push(const void *data, unsigned count)
+{
+    assert(data != NULL);
+
+    count = store(data, count);
+    if(count)
+        wake();
+    return count;
+}
+
+unsigned PipeBuffer::pull(void *data, unsigned count)
+{
+    assert(data != NULL);
+
+    count = fetch(data, count);
+    if(count)
+        wake();
+    return count;
+}
+
+void PipeBuffer::put(const void *data)
+{
+    put(data, Timer::inf);
+}
+
+bool PipeBuffer::put(const void *data, timeout_t timeout)
+{
+    assert(data != NULL);
+
+    struct timespec ts;
+    unsigned spins = 0;
+    bool rtn = true;
+
+    if(push(data, 1))
+        return true;
+
+    if(!timeout)
+        return false;
+
+    while(spins < RING_SPINS) {
+        atomic::backoff(spins);
+        if(push(data, 1))
+            return true;
+    }
+
+    if(timeout != Timer::inf)
+        set(&ts, timeout);
+
+    lock();
+    ++sleepers;
+    while(!store(data, 1)) {
+        if(timeout == Timer::inf)
+            wait();
+        else if(!wait(&ts)) {
+            rtn = (store(data, 1) > 0);
+            break;
+        }
+    }
+    --sleepers;
+    unlock();
+    if(rtn)
+        wake();
+    return rtn;
+}
+
+void PipeBuffer::copy(void *data)
+{
+    copy(data, 1, Timer::inf);
+}
+
+bool PipeBuffer::copy(void *data, timeout_t timeout)
+{
+    return copy(data, 1, timeout) > 0;
+}
+
+unsigned PipeBuffer::copy(void *data, unsigned count, timeout_t timeout)
+{
+    assert(data != NULL && count > 0);
+
+    struct timespec ts;
+    unsigned spins = 0;
+    unsigned result;
+
+    result = pull(data, count);
+    if(result || !timeout)
+        return result;
+
+    while(spins < RING_SPINS) {
+        atomic::backoff(spins);
+        result = pull(data, count);
+        if(result)
+            return result;
+    }
+
+    if(timeout != Timer::inf)
+        set(&ts, timeout);
+
+    lock();
+    ++sleepers;
+    while(!(result = fetch(data, count))) {
+        if(timeout == Timer::inf)
+            wait();
+        else if(!wait(&ts)) {
+            result = fetch(data, count);
+            break;
+        }
+    }
+    --sleepers;
+    unlock();
+    if(result)
+        wake();
+    return result;
+}
+
 Queue::member::member(Queue *q, ObjectProtocol *o) :
 OrderedObject(q)
 {
@@ -83,6 +83,26 @@
 #include <sys/event.h>
 #endif
 
+#if defined(HAVE_POLL_H) && !defined(__PTH__)
+#include <poll.h>
+#endif
+
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE) && !defined(__PTH__)
+#include <sys/sendfile.h>
+#define USE_SENDFILE
+#endif
+
+#if defined(HAVE_SPLICE) && defined(SPLICE_F_MOVE) && !defined(__PTH__)
+#define USE_SPLICE
+#endif
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
 using namespace UCOMMON_NAMESPACE;
 
 const fsys::offset_t fsys::end = (offset_t)(-1);
@@ -406,6 +426,41 @@ ssize_t fsys::write(const void *buf, size_t len)
     return rtn;
 }
 
+ssize_t fsys::transfer(fd_t to, fd_t from, offset_t *offset, size_t count)
+{
+    char buffer[8192];
+    size_t moved = 0;
+    DWORD result, written;
+
+    if(offset && SetFilePointer(from, *offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+        return -1;
+
+    while(moved < count) {
+        result = sizeof(buffer);
+        if(count - moved < result)
+            result = (DWORD)(count - moved);
+        if(!ReadFile(from, buffer, result, &result, NULL)) {
+            if(!moved)
+                return -1;
+            break;
+        }
+        if(!result)
+            break;
+        if(!WriteFile(to, buffer, result, &written, NULL) || written < result) {
+            if(offset)
+                SetFilePointer(from, *offset + (offset_t)moved, NULL, FILE_BEGIN);
+            if(!moved)
+                return -1;
+            break;
+        }
+        moved += result;
+    }
+
+    if(offset)
+        *offset += (offset_t)moved;
+    return (ssize_t)moved;
+}
+
 int fsys::sync(void)
 {
     return 0;
@@ -779,6 +834,284 @@ ssize_t fsys::write(const void *buf, size_t len)
     return rtn;
 }
 
+// wait for a target to take more, or check a non-blocking one is ready...
+static bool transfer_wait(fd_t fd, bool block)
+{
+    if(!block) {
+        int flags = fcntl(fd, F_GETFL);
+        if(flags == -1 || !(flags & O_NONBLOCK))
+            return true;
+    }
+
+#if defined(HAVE_POLL_H) && !defined(__PTH__)
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    return ::poll(&pfd, 1, block ? -1 : 0) > 0;
+#else
+    if(block)
+        Thread::yield();
+    return true;
+#endif
+}
+
+// write out what was read into a pipe or buffer, stopping if it would block...
+static size_t transfer_drain(fd_t to, fd_t pfd, const char *buffer, size_t count, int& err)
+{
+    size_t held = count;
+    ssize_t result;
+
+    while(held) {
+#ifdef  USE_SPLICE
+        if(pfd != INVALID_HANDLE_VALUE)
+            result = ::splice(pfd, NULL, to, NULL, held, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else
+#endif
+#ifdef  __PTH__
+        result = pth_write(to, buffer + count - held, held);
+#else
+        result = ::write(to, buffer + count - held, held);
+#endif
+        if(result > 0) {
+            held -= (size_t)result;
+            continue;
+        }
+        if(result < 0 && errno == EINTR)
+            continue;
+        err = errno;
+        if(!err)
+            err = EIO;
+        break;
+    }
+    return count - held;
+}
+
+// write all of a buffer, waiting for the target whenever it is full...
+static size_t transfer_flush(fd_t to, const char *buffer, size_t count, int& err)
+{
+    size_t moved = transfer_drain(to, INVALID_HANDLE_VALUE, buffer, count, err);
+
+    while(moved < count && (err == EAGAIN || err == EWOULDBLOCK) && transfer_wait(to, true)) {
+        err = 0;
+        moved += transfer_drain(to, INVALID_HANDLE_VALUE, buffer + moved, count - moved, err);
+    }
+    return moved;
+}
+
+// put back what was taken from the source but never written, or where the
+// source cannot seek, wait for the target to take the rest of it...
+static size_t transfer_return(fd_t to, fd_t from, off_t *pos, fd_t pfd, const char *buffer, size_t held, int& err)
+{
+    size_t moved = 0;
+
+    if(pos) {
+        *pos -= (off_t)held;
+        return 0;
+    }
+
+    if(lseek(from, -(off_t)held, SEEK_CUR) >= 0)
+        return 0;
+
+#ifdef  USE_SPLICE
+    if(pfd != INVALID_HANDLE_VALUE) {
+        char spill[8192];
+        while(held && (err == EAGAIN || err == EWOULDBLOCK || err == EINVAL)) {
+            // a target that cannot be spliced to is written from a buffer...
+            if(err == EINVAL) {
+                ssize_t result = ::read(pfd, spill, held < sizeof(spill) ? held : sizeof(spill));
+                if(result < 1)
+                    break;
+                err = 0;
+                moved += transfer_flush(to, spill, (size_t)result, err);
+                held -= (size_t)result;
+                continue;
+            }
+            if(!transfer_wait(to, true))
+                break;
+            err = 0;
+            size_t result = transfer_drain(to, pfd, NULL, held, err);
+            moved += result;
+            held -= result;
+        }
+        return moved;
+    }
+#endif
+
+    if(err == EAGAIN || err == EWOULDBLOCK) {
+        err = 0;
+        moved = transfer_flush(to, buffer, held, err);
+    }
+    return moved;
+}
+
+#ifdef  USE_SPLICE
+static bool transfer_pipe(fd_t fd)
+{
+    struct stat ino;
+
+    if(fstat(fd, &ino))
+        return false;
+    return S_ISFIFO(ino.st_mode);
+}
+#endif
+
+ssize_t fsys::transfer(fd_t to, fd_t from, offset_t *offset, size_t count)
+{
+    size_t moved = 0, held;
+    off_t pos = 0;
+    ssize_t result;
+    bool fallback = true, seekable;
+    int err = 0;
+
+    if(offset)
+        pos = (off_t)*offset;
+
+#ifdef  USE_SENDFILE
+    fallback = false;
+    while(moved < count) {
+        result = ::sendfile(to, from, offset ? &pos : NULL, count - moved);
+        if(result > 0) {
+            moved += (size_t)result;
+            continue;
+        }
+        if(!result)
+            break;
+        err = errno;
+        if(err == EINTR) {
+            err = 0;
+            continue;
+        }
+        // sources such as pipes and sockets cannot be sent from...
+        if(!moved && (err == EINVAL || err == ENOSYS)) {
+            err = 0;
+            fallback = true;
+        }
+        break;
+    }
+#endif
+
+    // a source that cannot seek cannot take back what the target did not...
+    seekable = offset || lseek(from, 0, SEEK_CUR) >= 0;
+
+#ifdef  USE_SPLICE
+    int pfd[2];
+    if(fallback && (transfer_pipe(from) || transfer_pipe(to))) {
+        // either end is a pipe, so splice straight between them...
+        fallback = false;
+        while(moved < count) {
+            result = ::splice(from, offset ? &pos : NULL, to, NULL, count - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(result > 0) {
+                moved += (size_t)result;
+                continue;
+            }
+            if(!result)
+                break;
+            err = errno;
+            if(err == EINTR) {
+                err = 0;
+                continue;
+            }
+            if(!moved && err == EINVAL) {
+                err = 0;
+                fallback = true;
+            }
+            break;
+        }
+    }
+    else if(fallback && !::pipe(pfd)) {
+        fallback = false;
+        while(moved < count && !err) {
+            if(!seekable && !transfer_wait(to, false)) {
+                err = EAGAIN;
+                break;
+            }
+            size_t chunk = count - moved;
+            if(chunk > 65536)
+                chunk = 65536;
+            result = ::splice(from, offset ? &pos : NULL, pfd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(!result)
+                break;
+            if(result < 0) {
+                err = errno;
+                if(err == EINTR)
+                    err = 0;
+                else if(!moved && err == EINVAL) {
+                    err = 0;
+                    fallback = true;
+                    break;
+                }
+                continue;
+            }
+            held = (size_t)result;
+            result = (ssize_t)transfer_drain(to, pfd[0], NULL, held, err);
+            moved += (size_t)result;
+            held -= (size_t)result;
+            if(held) {
+                moved += transfer_return(to, from, offset ? &pos : NULL, pfd[0], NULL, held, err);
+                if(!moved && err == EINVAL) {
+                    err = 0;
+                    fallback = true;
+                    break;
+                }
+            }
+        }
+        ::close(pfd[0]);
+        ::close(pfd[1]);
+    }
+#endif
+
+    if(fallback) {
+        char buffer[8192];
+        while(moved < count && !err) {
+            if(!seekable && !transfer_wait(to, false)) {
+                err = EAGAIN;
+                break;
+            }
+            size_t chunk = count - moved;
+            if(chunk > sizeof(buffer))
+                chunk = sizeof(buffer);
+#ifdef  __PTH__
+            if(offset)
+                result = pth_pread(from, buffer, chunk, pos);
+            else
+                result = pth_read(from, buffer, chunk);
+#else
+            if(offset)
+                result = ::pread(from, buffer, chunk, pos);
+            else
+                result = ::read(from, buffer, chunk);
+#endif
+            if(!result)
+                break;
+            if(result < 0) {
+                err = errno;
+                if(err == EINTR)
+                    err = 0;
+                continue;
+            }
+            held = (size_t)result;
+            result = (ssize_t)transfer_drain(to, INVALID_HANDLE_VALUE, buffer, held, err);
+            moved += (size_t)result;
+            if(offset)
+                pos += (off_t)result;
+            else if(held > (size_t)result)
+                moved += transfer_return(to, from, NULL, INVALID_HANDLE_VALUE, buffer + result, held - (size_t)result, err);
+        }
+    }
+
+    if(offset)
+        *offset = (offset_t)pos;
+
+    // the error is kept even when part was moved...
+    if(err)
+        errno = err;
+    if(!moved && err)
+        return -1;
+    return (ssize_t)moved;
+}
+
 fd_t fsys::null(void)
 {
     return ::open("/dev/null", O_RDWR);
@@ -1367,51 +1700,243 @@ int dir::remove(const char *path)
     return 0;
 }
 
-int fsys::copy(const char *oldpath, const char *newpath, size_t size)
+ssize_t fsys::transfer(fd_t to, offset_t *offset, size_t count)
+{
+    ssize_t result = transfer(to, fd, offset, count);
+    if(result < 0)
+        error = remapError();
+    return result;
+}
+
+// streams have no size or extents, so are just moved until end...
+static int copy_stream(fd_t to, fd_t from, fsys::progress_t progress, void *user)
+{
+    fsys::offset_t copied = 0;
+    ssize_t result;
+
+    for(;;) {
+        result = fsys::transfer(to, from, NULL, 1048576);
+        if(result < 0)
+            return fsys::remapError();
+        if(!result)
+            return 0;
+        copied += (fsys::offset_t)result;
+        if(progress && !progress(user, copied, 0))
+            return ECANCELED;
+    }
+}
+
+#ifndef _MSWINDOWS_
+
+enum {
+    COPY_RANGE,
+    COPY_SENDFILE,
+    COPY_BUFFER
+};
+
+typedef struct {
+    fd_t to, from;
+    unsigned method;
+    caddr_t buffer;
+    size_t size;
+    off_t total, reported;
+    fsys::progress_t progress;
+    void *user;
+} copy_t;
+
+static int copy_extent(copy_t *cp, off_t pos, off_t end)
+{
+    ssize_t result = 0;
+    size_t chunk;
+    off_t in, out;
+
+    while(pos < end) {
+        chunk = 16777216;
+        if((off_t)chunk > end - pos)
+            chunk = (size_t)(end - pos);
+        in = out = pos;
+
+#ifndef HAVE_COPY_FILE_RANGE
+        if(cp->method == COPY_RANGE)
+            cp->method = COPY_SENDFILE;
+#endif
+#ifndef USE_SENDFILE
+        if(cp->method == COPY_SENDFILE)
+            cp->method = COPY_BUFFER;
+#endif
+
+        switch(cp->method) {
+#ifdef  HAVE_COPY_FILE_RANGE
+        case COPY_RANGE:
+            result = ::copy_file_range(cp->from, &in, cp->to, &out, chunk, 0);
+            break;
+#endif
+#ifdef  USE_SENDFILE
+        case COPY_SENDFILE:
+            if(lseek(cp->to, pos, SEEK_SET) < 0)
+                return fsys::remapError();
+            result = ::sendfile(cp->to, cp->from, &in, chunk);
+            break;
+#endif
+        default:
+            if(!cp->buffer) {
+#ifdef  HAVE_POSIX_MEMALIGN
+                if(posix_memalign((void **)&cp->buffer, 4096, cp->size))
+                    cp->buffer = NULL;
+#else
+                cp->buffer = (caddr_t)malloc(cp->size);
+#endif
+                if(!cp->buffer)
+                    return ENOMEM;
+            }
+            if(chunk > cp->size)
+                chunk = cp->size;
+            result = ::pread(cp->from, cp->buffer, chunk, pos);
+            for(ssize_t put = 0; result > 0 && put < result;) {
+                ssize_t count = ::pwrite(cp->to, cp->buffer + put, result - put, pos + put);
+                if(count < 0 && errno == EINTR)
+                    continue;
+                if(count < 1)
+                    return count < 0 ? fsys::remapError() : EIO;
+                put += count;
+            }
+        }
+
+        if(result < 0) {
+            int err = fsys::remapError();
+            if(err == EINTR)
+                continue;
+            // the kernel or filesystem cannot do this, fall to next method...
+            if(cp->method != COPY_BUFFER && (err == EXDEV || err == ENOSYS || err == EINVAL || err == EOPNOTSUPP || err == EBADF)) {
+                ++cp->method;
+                continue;
+            }
+            return err;
+        }
+
+        // some filesystems claim empty for what they cannot copy...
+        if(!result) {
+            if(cp->method != COPY_BUFFER) {
+                ++cp->method;
+                continue;
+            }
+            break;
+        }
+
+        pos += result;
+        cp->reported = pos;
+        if(cp->progress && !cp->progress(cp->user, (fsys::offset_t)pos, (fsys::offset_t)cp->total))
+            return ECANCELED;
+    }
+    return 0;
+}
+
+static int copy_file(fd_t to, fd_t from, size_t size, fsys::progress_t progress, void *user)
 {
+    struct stat ino;
+    copy_t cp;
+    off_t pos = 0, data, hole;
     int result = 0;
-    char *buffer = new char[size];
-    fsys src, dest;
-    ssize_t count = size;
 
-    if(!buffer) {
-        result = ENOMEM;
-        goto end;
+    if(fstat(to, &ino))
+        return fsys::remapError();
+    if(!S_ISREG(ino.st_mode))
+        return copy_stream(to, from, progress, user);
+
+    if(fstat(from, &ino))
+        return fsys::remapError();
+    if(!S_ISREG(ino.st_mode))
+        return copy_stream(to, from, progress, user);
+
+    // a clone does not shorten a longer target, so truncate it first...
+    if(::ftruncate(to, 0))
+        return fsys::remapError();
+
+#ifdef  FICLONE
+    if(ino.st_size && !ioctl(to, FICLONE, from)) {
+        if(progress)
+            progress(user, (fsys::offset_t)ino.st_size, (fsys::offset_t)ino.st_size);
+        return 0;
     }
+#endif
+
+    cp.to = to;
+    cp.from = from;
+    cp.method = COPY_RANGE;
+    cp.buffer = NULL;
+    cp.size = (size + 4095) & ~((size_t)4095);
+    if(!cp.size)
+        cp.size = 1048576;
+    cp.total = ino.st_size;
+    cp.reported = 0;
+    cp.progress = progress;
+    cp.user = user;
+
+    // only data extents are copied, holes stay holes in the target...
+    while(!result && pos < cp.total) {
+        data = pos;
+        hole = cp.total;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        data = lseek(from, pos, SEEK_DATA);
+        if(data < 0 && errno == ENXIO)
+            break;
+        if(data < 0)
+            data = pos;
+        else {
+            hole = lseek(from, data, SEEK_HOLE);
+            if(hole < 0 || hole > cp.total)
+                hole = cp.total;
+        }
+#endif
+        result = copy_extent(&cp, data, hole);
+        pos = hole;
+    }
+
+    if(cp.buffer)
+        free(cp.buffer);
+
+    if(result)
+        return result;
+
+    if(::ftruncate(to, cp.total))
+        return fsys::remapError();
+
+    if(progress && cp.reported < cp.total)
+        progress(user, (fsys::offset_t)cp.total, (fsys::offset_t)cp.total);
+
+    return 0;
+}
+
+#endif
+
+int fsys::copy(fd_t to, fd_t from, progress_t progress, void *user, size_t size)
+{
+#ifdef  _MSWINDOWS_
+    return copy_stream(to, from, progress, user);
+#else
+    return copy_file(to, from, size, progress, user);
+#endif
+}
+
+int fsys::copy(const char *oldpath, const char *newpath, size_t size)
+{
+    int result = 0;
+    fsys src, dest;
 
     remove(newpath);
 
     src.open(oldpath, fsys::STREAM);
     if(!is(src))
-        goto end;
+        return src.err();
 
     dest.open(newpath, GROUP_PUBLIC, fsys::STREAM);
     if(!is(dest))
-        goto end;
-
-    while(count > 0) {
-        count = src.read(buffer, size);
-        if(count < 0) {
-            result = src.err();
-            goto end;
-        }
-        if(count > 0)
-            count = dest.write(buffer, size);
-        if(count < 0) {
-            result = dest.err();
-            goto end;
-        }
-    }
-
-end:
-    if(is(src))
-        src.close();
+        return dest.err();
 
-    if(is(dest))
-        dest.close();
+    result = copy(*dest, *src, NULL, NULL, size);
 
-    if(buffer)
-        delete[] buffer;
+    src.close();
+    dest.close();
 
     if(result != 0)
         remove(newpath);
@@ -80,6 +80,7 @@ memalloc::memalloc(size_t ps)
     count = 0;
     limit = 0;
     page = NULL;
+    memset(spare, 0, sizeof(spare));
 }
 
 memalloc::~memalloc()
@@ -114,9 +115,34 @@ void memalloc::purge(void)
         free(page);
         page = next;
     }
+    memset(spare, 0, sizeof(spare));
     count = 0;
 }
 
+void memalloc::retire(page_t *old)
+{
+    unsigned pos, use = SPARES;
+    size_t avail = pagesize - old->used;
+
+    // too small to be worth tracking...
+    if(avail < 4 * sizeof(void *))
+        return;
+
+    // replace empty slot, or spare page with least space left...
+    for(pos = 0; pos < SPARES; ++pos) {
+        if(!spare[pos]) {
+            use = pos;
+            break;
+        }
+        if(spare[pos]->used > old->used) {
+            if(use == SPARES || spare[pos]->used > spare[use]->used)
+                use = pos;
+        }
+    }
+    if(use < SPARES)
+        spare[use] = old;
+}
+
 void memalloc::fault(void) const
 {
     cpr_runtime_error("mempager exhausted");
@@ -147,6 +173,8 @@ use:
         fault();
 
     ++count;
+    if(page)
+        retire(page);
     npage->used = sizeof(page_t);
     npage->next = page;
     page = npage;
@@ -162,6 +190,7 @@ void *memalloc::_alloc(size_t size)
 
     caddr_t mem;
     page_t *p = page;
+    unsigned pos;
 
     if(size > (pagesize - sizeof(page_t))) {
         fault();
@@ -171,13 +200,17 @@ void *memalloc::_alloc(size_t size)
     while(size % sizeof(void *))
         ++size;
 
-    while(p) {
-        if(size <= pagesize - p->used)
-            break;
-        p = p->next;
+    if(!p || size > pagesize - p->used) {
+        p = NULL;
+        for(pos = 0; pos < SPARES; ++pos) {
+            if(spare[pos] && size <= pagesize - spare[pos]->used) {
+                p = spare[pos];
+                break;
+            }
+        }
+        if(!p)
+            p = pager();
     }
-    if(!p)
-        p = pager();
 
     mem = ((caddr_t)(p)) + p->used;
     p->used += size;
@@ -238,6 +271,310 @@ void *mempager::_alloc(size_t size)
     return mem;
 }
 
+// active flag must be first, as the key destructor only sees a void *...
+class __LOCAL arenapager::arena
+{
+public:
+    volatile bool active;
+    arena *next;
+    page_t *current;
+    unsigned generation;
+};
+
+extern "C" {
+
+    static void arena_release(void *obj)
+    {
+        // arena remains listed in the pager, mark for re-use...
+        if(obj)
+            ((volatile bool *)obj)[0] = false;
+    }
+}
+
+arenapager::arenapager(size_t ps) :
+mempager(ps)
+{
+    arenas = NULL;
+    generation = 0;
+
+#if defined(__PTH__)
+    Thread::init();
+    pth_key_create(&key, &arena_release);
+#elif defined(_MSWINDOWS_)
+    // no thread exit hook, so arenas are kept until the pager is deleted...
+    key = TlsAlloc();
+#else
+    crit(pthread_key_create(&key, &arena_release) == 0, "arena key failed");
+#endif
+}
+
+arenapager::~arenapager()
+{
+    arena *next;
+
+#if defined(__PTH__)
+    pth_key_delete(key);
+#elif defined(_MSWINDOWS_)
+    TlsFree(key);
+#else
+    pthread_key_delete(key);
+#endif
+
+    while(arenas) {
+        next = arenas->next;
+        ::free(arenas);
+        arenas = next;
+    }
+}
+
+arenapager::arena *arenapager::attach(void)
+{
+    arena *ap;
+
+    _lock();
+    ap = arenas;
+    while(ap) {
+        if(!ap->active)
+            break;
+        ap = ap->next;
+    }
+    if(!ap) {
+        ap = (arena *)::malloc(sizeof(arena));
+        if(!ap) {
+            _unlock();
+            fault();
+            return NULL;
+        }
+        ap->next = arenas;
+        ap->current = NULL;
+        arenas = ap;
+    }
+    ap->active = true;
+    _unlock();
+
+#if defined(__PTH__)
+    pth_key_setdata(key, ap);
+#elif defined(_MSWINDOWS_)
+    TlsSetValue(key, ap);
+#else
+    pthread_setspecific(key, ap);
+#endif
+    return ap;
+}
+
+unsigned arenapager::threads(void)
+{
+    unsigned total = 0;
+    arena *ap;
+
+    _lock();
+    ap = arenas;
+    while(ap) {
+        ++total;
+        ap = ap->next;
+    }
+    _unlock();
+    return total;
+}
+
+void arenapager::purge(void)
+{
+    _lock();
+    ++generation;
+    memalloc::purge();
+    _unlock();
+}
+
+void *arenapager::_alloc(size_t size)
+{
+    assert(size > 0);
+
+    caddr_t mem;
+    page_t *p;
+    arena *ap;
+
+#if defined(__PTH__)
+    ap = (arena *)pth_key_getdata(key);
+#elif defined(_MSWINDOWS_)
+    ap = (arena *)TlsGetValue(key);
+#else
+    ap = (arena *)pthread_getspecific(key);
+#endif
+
+    if(!ap)
+        ap = attach();
+
+    if(!ap)
+        return NULL;
+
+    if(size > (memalloc::size() - sizeof(page_t))) {
+        fault();
+        return NULL;
+    }
+
+    while(size % sizeof(void *))
+        ++size;
+
+    p = ap->current;
+    if(!p || ap->generation != generation || size > memalloc::size() - p->used) {
+        _lock();
+        p = pager();
+        ap->generation = generation;
+        _unlock();
+        ap->current = p;
+    }
+
+    mem = ((caddr_t)(p)) + p->used;
+    p->used += size;
+    return mem;
+}
+
+// size of block header, keeps returned memory pointer aligned...
+#define POOL_HEADER (((sizeof(size_t) + sizeof(void *) - 1) / sizeof(void *)) * sizeof(void *))
+
+mempool::mempool(size_t ps) :
+mempager(ps)
+{
+    // allow for page header and alignment of the first block in a page
+    size_t usable = memalloc::size() - sizeof(page_t) - sizeof(void *);
+    size_t limit = 4 * sizeof(void *);
+
+    usable -= usable % sizeof(void *);
+    classes = 0;
+    while(limit < usable && classes < CLASSES - 1) {
+        limits[classes++] = limit;
+        limit *= 2;
+    }
+    limits[classes++] = usable;
+
+    memset(freelist, 0, sizeof(freelist));
+    carved = requested = highmark = 0;
+    idle = 0;
+}
+
+mempool::~mempool()
+{
+    memalloc::purge();
+}
+
+unsigned mempool::sizeclass(size_t size) const
+{
+    unsigned pos = 0;
+
+    while(pos < classes && size > limits[pos])
+        ++pos;
+
+    return pos;
+}
+
+void mempool::purge(void)
+{
+    _lock();
+    memset(freelist, 0, sizeof(freelist));
+    carved = requested = highmark = 0;
+    idle = 0;
+    memalloc::purge();
+    _unlock();
+}
+
+void *mempool::_alloc(size_t size)
+{
+    assert(size > 0);
+
+    unsigned pos = sizeclass(size + POOL_HEADER);
+    caddr_t mem;
+
+    if(pos >= classes) {
+        fault();
+        return NULL;
+    }
+
+    _lock();
+    mem = (caddr_t)freelist[pos];
+    if(mem) {
+        freelist[pos] = *((void **)mem);
+        --idle;
+    }
+    else {
+        mem = (caddr_t)memalloc::_alloc(limits[pos]);
+        if(!mem) {
+            _unlock();
+            return NULL;
+        }
+        carved += limits[pos];
+    }
+    *((size_t *)mem) = size;
+    requested += size;
+    if(requested > highmark)
+        highmark = requested;
+    _unlock();
+    return mem + POOL_HEADER;
+}
+
+void mempool::dealloc(void *memory)
+{
+    caddr_t mem = (caddr_t)memory;
+    unsigned pos;
+    size_t size;
+
+    if(!mem)
+        return;
+
+    mem -= POOL_HEADER;
+    size = *((size_t *)mem);
+    pos = sizeclass(size + POOL_HEADER);
+
+    assert(pos < classes);
+
+    _lock();
+    *((void **)mem) = freelist[pos];
+    freelist[pos] = mem;
+    requested -= size;
+    ++idle;
+    _unlock();
+}
+
+size_t mempool::used(void)
+{
+    size_t result;
+
+    _lock();
+    result = requested;
+    _unlock();
+    return result;
+}
+
+size_t mempool::highwater(void)
+{
+    size_t result;
+
+    _lock();
+    result = highmark;
+    _unlock();
+    return result;
+}
+
+unsigned mempool::reusable(void)
+{
+    unsigned result;
+
+    _lock();
+    result = idle;
+    _unlock();
+    return result;
+}
+
+unsigned mempool::fragmentation(void)
+{
+    unsigned long result = 0;
+
+    _lock();
+    if(carved)
+        result = (unsigned long)(((carved - requested) * 100) / carved);
+    _unlock();
+    return (unsigned)result;
+}
+
 ObjectPager::member::member(LinkedObject **root) :
 LinkedObject(root)
 {
@@ -1124,21 +1461,16 @@ void bufpager::put(const char *text, size_t iosize)
                     return;
                 }
 
+                // use rest of current page, or start a new one...
                 page_t *p = page;
-                unsigned size = 0;
-
-                while(p) {
-                    size = pagesize - p->used;
-                    if(size)
-                        break;
-                    p = p->next;
-                }
-                if(!p)
+                if(!p || p->used >= pagesize)
                     p = pager();
 
                 if(!p)
                     return;
 
+                unsigned size = pagesize - p->used;
+
                 next->text = ((char *)(p)) + p->used;
                 next->used = 0;
                 next->size = size;
@@ -1195,16 +1527,9 @@ char *bufpager::request(size_t *iosize)
                 return NULL;
             }
 
+            // use rest of current page, or start a new one...
             page_t *p = page;
-            unsigned size = 0;
-
-            while(p) {
-                size = pagesize - p->used;
-                if(size)
-                    break;
-                p = p->next;
-            }
-            if(!p)
+            if(!p || p->used >= pagesize)
                 p = pager();
 
             if(!p) {
@@ -1212,6 +1537,8 @@ char *bufpager::request(size_t *iosize)
                 return NULL;
             }
 
+            unsigned size = pagesize - p->used;
+
             next->text = ((char *)(p)) + p->used;
             next->used = 0;
             next->size = size;
@@ -1275,16 +1602,9 @@ void bufpager::add(const char *text)
                     return;
                 }
 
+                // use rest of current page, or start a new one...
                 page_t *p = page;
-                unsigned size = 0;
-
-                while(p) {
-                    size = pagesize - p->used;
-                    if(size)
-                        break;
-                    p = p->next;
-                }
-                if(!p)
+                if(!p || p->used >= pagesize)
                     p = pager();
 
                 if(!p) {
@@ -1292,6 +1612,8 @@ void bufpager::add(const char *text)
                     return;
                 }
 
+                unsigned size = pagesize - p->used;
+
                 next->text = ((char *)(p)) + p->used;
                 next->used = 0;
                 next->size = size;
@@ -1379,16 +1701,9 @@ int bufpager::_putch(int code)
                 return EOF;
             }
 
+            // use rest of current page, or start a new one...
             page_t *p = page;
-            unsigned size = 0;
-
-            while(p) {
-                size = pagesize - p->used;
-                if(size)
-                    break;
-                p = p->next;
-            }
-            if(!p)
+            if(!p || p->used >= pagesize)
                 p = pager();
 
             if(!p) {
@@ -1396,6 +1711,8 @@ int bufpager::_putch(int code)
                 return EOF;
             }
 
+            unsigned size = pagesize - p->used;
+
             next->text = ((char *)(p)) + p->used;
             next->used = 0;
             next->size = size;
@@ -53,6 +53,37 @@ void CountedObject::release(void)
     dealloc();
 }
 
+AtomicObject::AtomicObject() :
+count(0)
+{
+}
+
+AtomicObject::AtomicObject(const ObjectProtocol &source) :
+count(0)
+{
+}
+
+void AtomicObject::dealloc(void)
+{
+    delete this;
+}
+
+void AtomicObject::retain(void)
+{
+    count.fetch_add(1, atomic::RELAXED);
+}
+
+void AtomicObject::release(void)
+{
+    // our own writes are released with the decrement, and the last owner
+    // acquires everyone else's before dealloc...
+    if(count.fetch_sub(1, atomic::RELEASE) > 1)
+        return;
+
+    atomic::fence(atomic::ACQUIRE);
+    dealloc();
+}
+
 auto_object::auto_object(ObjectProtocol *o)
 {
     if(o)
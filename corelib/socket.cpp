@@ -50,6 +50,11 @@
 #include <sys/filio.h>
 #endif
 
+#if defined(HAVE_SYS_EPOLL_H) && !defined(HAVE_SOCKS) && !defined(__PTH__)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
+
 #if defined(HAVE_POLL) && defined(POLLRDNORM)
 #define USE_POLL
 #endif
@@ -58,6 +63,36 @@
 #define IP_MTU 14
 #endif
 
+#if defined(__linux__) && !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103
+#endif
+
+#if defined(__linux__) && !defined(UDP_GRO)
+#define UDP_GRO 104
+#endif
+
+#if defined(UDP_SEGMENT) && !defined(HAVE_SOCKS) && !defined(__PTH__) && !defined(_MSWINDOWS_)
+#define USE_UDP_OFFLOAD
+#endif
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(HAVE_POLL_H) && !defined(HAVE_SOCKS) && !defined(__PTH__)
+#include <time.h>
+#include <linux/errqueue.h>
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#define USE_ZEROCOPY
+#endif
+
 #ifndef MSG_DONTWAIT
 #define MSG_DONTWAIT 0
 #endif
@@ -159,6 +194,9 @@ typedef unsigned char   bit_t;
 
 static int query_family = 0;
 static int v6only = 0;
+#ifdef  USE_UDP_OFFLOAD
+static volatile bool udp_offload = true;
+#endif
 
 static void socket_mapping(int family, socket_t so)
 {
@@ -761,6 +799,256 @@ bool cidr::is_member(const struct sockaddr *s) const
     }
 }
 
+// a compiled cidr table is one block of trie nodes, with node 0 and 1
+// as the ipv4 and ipv6 roots...
+typedef struct {
+    bit_t key[16];
+    unsigned bits;
+    int child[2];
+    const cidr *entry;
+} cidr_node_t;
+
+typedef struct {
+    unsigned entries, used;
+    cidr_node_t nodes[2];
+} cidr_image_t;
+
+static unsigned cidr_bit(const bit_t *key, unsigned pos)
+{
+    return (key[pos >> 3] >> (7 - (pos & 7))) & 1;
+}
+
+static unsigned cidr_common(const bit_t *key1, const bit_t *key2, unsigned from, unsigned to)
+{
+    while(from < to) {
+        unsigned index = from >> 3;
+        bit_t diff = (bit_t)((key1[index] ^ key2[index]) & (0xff >> (from & 7)));
+        if(diff) {
+            unsigned pos = index << 3;
+            while(!(diff & 0x80)) {
+                diff <<= 1;
+                ++pos;
+            }
+            return (pos < to) ? pos : to;
+        }
+        from = (index + 1) << 3;
+    }
+    return to;
+}
+
+static int cidr_node(cidr_image_t *image, const bit_t *key, unsigned bits, const cidr *entry)
+{
+    int pos = (int)image->used++;
+    cidr_node_t *node = &image->nodes[pos];
+
+    memset(node->key, 0, sizeof(node->key));
+    memcpy(node->key, key, (bits + 7) / 8);
+    if(bits & 7)
+        node->key[bits >> 3] &= (bit_t)(0xff << (8 - (bits & 7)));
+    node->bits = bits;
+    node->child[0] = node->child[1] = -1;
+    node->entry = entry;
+    return pos;
+}
+
+static void cidr_insert(cidr_image_t *image, int pos, const bit_t *key, unsigned bits, const cidr *entry)
+{
+    for(;;) {
+        cidr_node_t *node = &image->nodes[pos];
+
+        // the first entry of a given prefix wins, as it does for find...
+        if(bits == node->bits) {
+            if(!node->entry)
+                node->entry = entry;
+            return;
+        }
+
+        unsigned branch = cidr_bit(key, node->bits);
+        int next = node->child[branch];
+        if(next < 0) {
+            next = cidr_node(image, key, bits, entry);
+            image->nodes[pos].child[branch] = next;
+            return;
+        }
+
+        cidr_node_t *child = &image->nodes[next];
+        unsigned limit = (bits < child->bits) ? bits : child->bits;
+        unsigned common = cidr_common(key, child->key, node->bits, limit);
+        if(common == child->bits) {
+            pos = next;
+            continue;
+        }
+
+        // split the compressed path where the new prefix leaves it...
+        int split = cidr_node(image, key, common, NULL);
+        image->nodes[split].child[cidr_bit(image->nodes[next].key, common)] = next;
+        image->nodes[pos].child[branch] = split;
+        if(common == bits)
+            image->nodes[split].entry = entry;
+        else
+            image->nodes[split].child[cidr_bit(key, common)] = cidr_node(image, key, bits, entry);
+        return;
+    }
+}
+
+static const cidr *cidr_lookup(const cidr_image_t *image, int pos, const bit_t *key, unsigned size)
+{
+    const cidr *member = NULL;
+    unsigned from = 0;
+
+    while(pos >= 0) {
+        const cidr_node_t *node = &image->nodes[pos];
+        if(cidr_common(key, node->key, from, node->bits) < node->bits)
+            break;
+        if(node->entry)
+            member = node->entry;
+        if(node->bits >= size)
+            break;
+        from = node->bits;
+        pos = node->child[cidr_bit(key, from)];
+    }
+    return member;
+}
+
+static cidr_image_t *cidr_compile(const cidr::policy *policy)
+{
+    unsigned count = 0;
+    cidr_image_t *image;
+    inethostaddr_t network;
+    unsigned bits;
+
+    linked_pointer<const cidr> cp = policy;
+    while(cp) {
+        if(cp->getMask())
+            ++count;
+        cp.next();
+    }
+
+    // each insert adds at most a leaf and a split node...
+    image = (cidr_image_t *)malloc(sizeof(cidr_image_t) + sizeof(cidr_node_t) * count * 2);
+    if(!image)
+        return NULL;
+
+    image->used = 0;
+    image->entries = count;
+    memset(&network, 0, sizeof(network));
+    cidr_node(image, (const bit_t *)&network, 0, NULL);
+    cidr_node(image, (const bit_t *)&network, 0, NULL);
+
+    cp = static_cast<const cidr *>(policy);
+    while(cp) {
+        bits = cp->getMask();
+        network = cp->getNetwork();
+        switch(cp->getFamily()) {
+        case AF_INET:
+            if(bits && bits <= 32)
+                cidr_insert(image, 0, (const bit_t *)&network.ipv4, bits, *cp);
+            break;
+#ifdef  AF_INET6
+        case AF_INET6:
+            if(bits && bits <= 128)
+                cidr_insert(image, 1, (const bit_t *)&network.ipv6, bits, *cp);
+            break;
+#endif
+        default:
+            break;
+        }
+        cp.next();
+    }
+    return image;
+}
+
+cidr::table::table(const policy *policy) :
+root(NULL)
+{
+    if(policy)
+        rebuild(policy);
+}
+
+cidr::table::~table()
+{
+    void *image = root.exchange(NULL);
+    if(image)
+        free(image);
+}
+
+void *cidr::table::enter(unsigned& reader) const
+{
+    // the reader counts the phase it entered in, so a rebuild can tell
+    // when lookups that may have seen the prior index are done...
+    reader = (unsigned)phase.load(atomic::ACQUIRE) & 1;
+    readers[reader].fetch_add(1);
+    return root.load();
+}
+
+void cidr::table::leave(unsigned reader) const
+{
+    readers[reader].fetch_sub(1, atomic::RELEASE);
+}
+
+bool cidr::table::rebuild(const policy *policy)
+{
+    cidr_image_t *image = cidr_compile(policy);
+    unsigned spins;
+
+    if(!image)
+        return false;
+
+    writer.lock();
+    void *prior = root.exchange(image);
+
+    // flip twice, so readers that entered in either phase have left...
+    for(unsigned pass = 0; pass < 2; ++pass) {
+        unsigned current = (unsigned)phase.fetch_add(1) & 1;
+        spins = 0;
+        while(readers[current].load(atomic::ACQUIRE))
+            atomic::backoff(spins);
+    }
+    writer.unlock();
+
+    if(prior)
+        free(prior);
+    return true;
+}
+
+const cidr *cidr::table::find(const struct sockaddr *s) const
+{
+    assert(s != NULL);
+
+    const struct sockaddr_internet *addr = (const struct sockaddr_internet *)s;
+    const cidr *member = NULL;
+    unsigned reader;
+    const cidr_image_t *image = (const cidr_image_t *)enter(reader);
+
+    if(image) {
+        switch(addr->address.sa_family) {
+        case AF_INET:
+            member = cidr_lookup(image, 0, (const bit_t *)&addr->ipv4.sin_addr, 32);
+            break;
+#ifdef  AF_INET6
+        case AF_INET6:
+            member = cidr_lookup(image, 1, (const bit_t *)&addr->ipv6.sin6_addr, 128);
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+    leave(reader);
+    return member;
+}
+
+unsigned cidr::table::count(void) const
+{
+    unsigned reader, entries = 0;
+    const cidr_image_t *image = (const cidr_image_t *)enter(reader);
+
+    if(image)
+        entries = image->entries;
+    leave(reader);
+    return entries;
+}
+
 inethostaddr_t cidr::broadcast(void) const
 {
     inethostaddr_t bcast;
@@ -906,7 +1194,7 @@ void cidr::set(const char *cp)
         memset(&Netmask.ipv6, 0, sizeof(Netmask));
         bitset((bit_t *)&Netmask.ipv6, mask(cp));
         String::set(cbuf, sizeof(cbuf), cp);
-        ep = (char *)strchr(cp, '/');
+        ep = (char *)strchr(cbuf, '/');
         if(ep)
             *ep = 0;
 #ifdef  _MSWINDOWS_
@@ -1703,6 +1991,55 @@ ssize_t Socket::recvfrom(socket_t so, void *data, size_t len, int flags, struct
     return _recvfrom_(so, (caddr_t)data, len, flags, (struct sockaddr *)addr, &slen);
 }
 
+ssize_t Socket::recvsegments(socket_t so, void *data, size_t len, unsigned *segment, struct sockaddr_storage *addr)
+{
+    assert(data != NULL);
+    assert(len > 0);
+    assert(segment != NULL);
+
+#ifdef  USE_UDP_OFFLOAD
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if(addr) {
+        msg.msg_name = addr;
+        msg.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    ssize_t result = ::recvmsg(so, &msg, 0);
+    if(result < 0)
+        return result;
+
+    *segment = (unsigned)result;
+    for(struct cmsghdr *cp = CMSG_FIRSTHDR(&msg); cp != NULL; cp = CMSG_NXTHDR(&msg, cp)) {
+        if(cp->cmsg_level == IPPROTO_UDP && cp->cmsg_type == UDP_GRO) {
+            int gso;
+            memcpy(&gso, CMSG_DATA(cp), sizeof(gso));
+            if(gso > 0 && gso < result)
+                *segment = (unsigned)gso;
+        }
+    }
+    return result;
+#else
+    socklen_t slen = sizeof(struct sockaddr_storage);
+    ssize_t result = _recvfrom_(so, (caddr_t)data, len, 0, (struct sockaddr *)addr, &slen);
+    if(result >= 0)
+        *segment = (unsigned)result;
+    return result;
+#endif
+}
+
 size_t Socket::readfrom(void *data, size_t len, struct sockaddr_storage *from)
 {
     assert(data != NULL);
@@ -1751,6 +2088,93 @@ ssize_t Socket::sendto(socket_t so, const void *data, size_t dlen, int flags, co
     return _sendto_(so, (caddr_t)data, dlen, MSG_NOSIGNAL | flags, dest, slen);
 }
 
+ssize_t Socket::sendsegments(socket_t so, const void *data, size_t dlen, unsigned segment, const struct sockaddr *dest)
+{
+    assert(data != NULL);
+
+    socklen_t slen = 0;
+    if(dest)
+        slen = len(dest);
+
+    if(!segment || dlen <= segment)
+        return _sendto_(so, (caddr_t)data, dlen, MSG_NOSIGNAL, dest, slen);
+
+    size_t sent = 0;
+
+#ifdef  USE_UDP_OFFLOAD
+    // the kernel limits a segmented send to 64 datagrams, and to what
+    // fits in the payload of a single udp datagram...
+    size_t limit = (65507 / segment) * segment;
+    if(limit > 64 * (size_t)segment)
+        limit = 64 * (size_t)segment;
+
+    while(udp_offload && sent < dlen) {
+        size_t count = dlen - sent;
+        if(count > limit)
+            count = limit;
+        if(count <= segment)
+            break;
+
+        struct msghdr msg;
+        struct iovec iov;
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(uint16_t))];
+        } control;
+
+        memset(&msg, 0, sizeof(msg));
+        memset(&control, 0, sizeof(control));
+        iov.iov_base = (caddr_t)data + sent;
+        iov.iov_len = count;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_name = (void *)dest;
+        msg.msg_namelen = slen;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        struct cmsghdr *cp = CMSG_FIRSTHDR(&msg);
+        uint16_t gso = (uint16_t)segment;
+        cp->cmsg_level = IPPROTO_UDP;
+        cp->cmsg_type = UDP_SEGMENT;
+        cp->cmsg_len = CMSG_LEN(sizeof(gso));
+        memcpy(CMSG_DATA(cp), &gso, sizeof(gso));
+
+        ssize_t result = ::sendmsg(so, &msg, MSG_NOSIGNAL);
+        if(result >= 0) {
+            sent += count;
+            continue;
+        }
+
+        // older kernels never will, devices without checksum offload may not,
+        // and smaller limits may apply to the route, so send the rest singly...
+        int err = Socket::error();
+        if(err == ENOPROTOOPT || err == EOPNOTSUPP)
+            udp_offload = false;
+        else if(err != EIO && err != EINVAL && err != EMSGSIZE) {
+            if(!sent)
+                return result;
+            return (ssize_t)sent;
+        }
+        break;
+    }
+#endif
+
+    while(sent < dlen) {
+        size_t count = dlen - sent;
+        if(count > segment)
+            count = segment;
+        ssize_t result = _sendto_(so, (caddr_t)data + sent, count, MSG_NOSIGNAL, dest, slen);
+        if(result < 0) {
+            if(!sent)
+                return result;
+            break;
+        }
+        sent += count;
+    }
+    return (ssize_t)sent;
+}
+
 size_t Socket::writes(const char *str)
 {
     if(!str)
@@ -1848,100 +2272,744 @@ ssize_t Socket::readline(socket_t so, char *data, size_t max, timeout_t timeout)
     return ssize_t(max - nleft - 1);
 }
 
-int Socket::loopback(socket_t so, bool enable)
+LineReader::LineReader(socket_t socket, size_t size)
 {
-    union {
-        struct sockaddr_storage saddr;
-        struct sockaddr_in inaddr;
-    } us;
-
-    struct sockaddr *addr = (struct sockaddr *)&us.saddr;
-    int family;
-    socklen_t len = sizeof(us.saddr);
-    int opt = 0;
+    if(size < 2)
+        size = 2;
 
-    if(enable)
-        opt = 1;
+    so = socket;
+    bufsize = size;
+    head = tail = scan = 0;
+    ioerr = 0;
+    eof = false;
 
-    if(so == INVALID_SOCKET)
-        return EBADF;
+    // one extra byte so a full buffer can still be null terminated...
+    buffer = new char[size + 1];
+}
 
-    _getsockname_(so, addr, &len);
-    family = us.inaddr.sin_family;
-    switch(family) {
-    case AF_INET:
-        if(!setsockopt(so, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&opt, sizeof(opt)))
-            return 0;
-        break;
-#if defined(AF_INET6) && defined(IPROTO_IPV6)
-    case AF_INET6:
-        if(!setsockopt(so, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, (char *)&opt, sizeof(opt)))
-            return 0;
-#endif
-    }
-    int err = Socket::error();
-    if(!err)
-        err = EIO;
-    return err;
+LineReader::~LineReader()
+{
+    delete[] buffer;
 }
 
-int Socket::ttl(socket_t so, unsigned char t)
+bool LineReader::fill(timeout_t timeout)
 {
-    union {
-        struct sockaddr_storage saddr;
-        struct sockaddr_in inaddr;
-    } us;
+    ssize_t result;
 
-    struct sockaddr *addr = (struct sockaddr *)&us.saddr;
-    int family;
-    socklen_t len = sizeof(us.saddr);
+    if(eof)
+        return false;
 
-    if(so == INVALID_SOCKET)
-        return EBADF;
+    if(head) {
+        memmove(buffer, buffer + head, tail - head);
+        tail -= head;
+        scan -= head;
+        head = 0;
+    }
 
-    _getsockname_(so, addr, &len);
-    family = us.inaddr.sin_family;
-    switch(family) {
-    case AF_INET:
-        if(!setsockopt(so, IPPROTO_IP, IP_TTL, (char *)&t, sizeof(t)))
-            return 0;
-        break;
-#if defined(AF_INET6) && defined(IPPROTO_IPV6)
-    case AF_INET6:
-        if(!setsockopt(so, IPPROTO_IPV6, IPV6_UNICAST_HOPS, (char *)&t, sizeof(t)))
-            return 0;
-#endif
+    if(timeout && !Socket::wait(so, timeout))
+        return false;
+
+    result = _recv_(so, buffer + tail, bufsize - tail, 0);
+    if(result == 0) {
+        eof = true;
+        return false;
     }
-    int err = Socket::error();
-    if(!err)
-        err = EIO;
-    return err;
+    if(result < 0) {
+        ioerr = Socket::error();
+        if(ioerr == EAGAIN || ioerr == EWOULDBLOCK || ioerr == EINTR)
+            ioerr = 0;
+        return false;
+    }
+    tail += result;
+    return true;
 }
 
-int Socket::priority(socket_t so, int pri)
+char *LineReader::fetch(size_t limit, size_t& count, timeout_t timeout)
 {
-    if(so == INVALID_SOCKET)
-        return EBADF;
-#ifdef  SO_PRIORITY
-    if(!setsockopt(so, SOL_SOCKET, SO_PRIORITY, (char *)&pri, (socklen_t)sizeof(pri)))
-        return 0;
-    int err = Socket::error();
-    if(!err)
-        err = EIO;
-    return err;
-#else
-    return ENOSYS;
-#endif
-}
+    char *line;
 
-int Socket::tos(socket_t so, int ts)
-{
-    if(so == INVALID_SOCKET)
-        return EBADF;
+    ioerr = 0;
+    if(limit > bufsize)
+        limit = bufsize;
+
+    // scan remembers how far we searched, so partial lines are not
+    // searched again when more data arrives...
+    for(;;) {
+        size_t avail = tail - head;
+        size_t span = (avail < limit) ? avail : limit;
+
+        if(scan < head)
+            scan = head;
+
+        if(scan < head + span) {
+            line = (char *)memchr(buffer + scan, '\n', head + span - scan);
+            if(line) {
+                count = (size_t)(line - buffer) - head + 1;
+                break;
+            }
+            scan = head + span;
+        }
 
-#ifdef  SOL_IP
-    if(!setsockopt(so, SOL_IP, IP_TOS,(char *)&ts, (socklen_t)sizeof(ts)))
-        return 0;
+        if(span == limit) {
+            count = limit;
+            break;
+        }
+
+        if(!fill(timeout)) {
+            avail = tail - head;
+            if(!eof || !avail)
+                return NULL;
+            count = avail;
+            break;
+        }
+    }
+
+    line = buffer + head;
+    head += count;
+    return line;
+}
+
+char *LineReader::getline(size_t *length, timeout_t timeout)
+{
+    size_t count;
+    char *line = fetch(bufsize, count, timeout);
+
+    if(!line) {
+        if(length)
+            *length = 0;
+        return NULL;
+    }
+
+    if(line[count - 1] == '\n') {
+        --count;
+        if(count && line[count - 1] == '\r')
+            --count;
+    }
+
+    line[count] = 0;
+    if(length)
+        *length = count;
+    return line;
+}
+
+ssize_t LineReader::readline(char *data, size_t max, timeout_t timeout)
+{
+    assert(data != NULL);
+    assert(max > 0);
+
+    size_t count, result;
+    char *line;
+
+    if(max < 2) {
+        if(max)
+            data[0] = 0;
+        return -1;
+    }
+
+    data[0] = 0;
+    line = fetch(max - 1, count, timeout);
+    if(!line)
+        return ioerr ? -1 : 0;
+
+    result = count;
+    if(line[count - 1] == '\n') {
+        --count;
+        if(count && line[count - 1] == '\r') {
+            --count;
+            --result;
+        }
+    }
+
+    memcpy(data, line, count);
+    data[count] = 0;
+    return (ssize_t)result;
+}
+
+ssize_t LineReader::read(void *data, size_t size, timeout_t timeout)
+{
+    size_t avail = tail - head;
+    ssize_t result;
+
+    ioerr = 0;
+    if(avail) {
+        if(size > avail)
+            size = avail;
+        memcpy(data, buffer + head, size);
+        head += size;
+        return (ssize_t)size;
+    }
+
+    if(eof)
+        return 0;
+
+    if(timeout && !Socket::wait(so, timeout))
+        return 0;
+
+    result = _recv_(so, (caddr_t)data, size, 0);
+    if(result == 0)
+        eof = true;
+    else if(result < 0) {
+        ioerr = Socket::error();
+        if(ioerr == EAGAIN || ioerr == EWOULDBLOCK || ioerr == EINTR) {
+            ioerr = 0;
+            return 0;
+        }
+    }
+    return result;
+}
+
+#if defined(HAVE_RECVMMSG) && !defined(HAVE_SOCKS) && !defined(__PTH__) && !defined(_MSWINDOWS_)
+#define USE_RECVMMSG
+#endif
+
+#if defined(HAVE_SENDMMSG) && !defined(HAVE_SOCKS) && !defined(__PTH__) && !defined(_MSWINDOWS_)
+#define USE_SENDMMSG
+#endif
+
+PacketBatch::PacketBatch(socket_t socket, unsigned count, size_t size)
+{
+    if(!count)
+        count = 1;
+
+    so = socket;
+    limit = count;
+    mtu = size;
+    used = 0;
+    ioerr = 0;
+    headers = NULL;
+
+    buffers = (caddr_t)malloc(count * size);
+    list = (packet_t *)malloc(sizeof(packet_t) * count);
+    crit(buffers != NULL && list != NULL, "packet batch alloc failed");
+
+    memset(list, 0, sizeof(packet_t) * count);
+    for(unsigned pos = 0; pos < count; ++pos)
+        list[pos].data = buffers + pos * size;
+
+#if defined(USE_RECVMMSG) || defined(USE_SENDMMSG)
+    // message headers point at the packets once, and only lengths change...
+    size_t hsize = (sizeof(struct mmsghdr) + sizeof(struct iovec)) * count;
+    struct mmsghdr *hp = (struct mmsghdr *)malloc(hsize);
+    crit(hp != NULL, "packet batch alloc failed");
+    memset(hp, 0, hsize);
+    struct iovec *iov = (struct iovec *)(&hp[count]);
+    for(unsigned pos = 0; pos < count; ++pos) {
+        iov[pos].iov_base = list[pos].data;
+        hp[pos].msg_hdr.msg_iov = &iov[pos];
+        hp[pos].msg_hdr.msg_iovlen = 1;
+    }
+    headers = hp;
+#endif
+}
+
+PacketBatch::~PacketBatch()
+{
+    if(headers)
+        free(headers);
+    free(list);
+    free(buffers);
+}
+
+bool PacketBatch::put(const void *data, size_t size, const struct sockaddr *address)
+{
+    if(used >= limit || size > mtu)
+        return false;
+
+    packet_t *pp = &list[used++];
+    memcpy(pp->data, data, size);
+    pp->length = size;
+    if(address)
+        Socket::store(&pp->address, address);
+    else
+        memset(&pp->address, 0, sizeof(pp->address));
+    return true;
+}
+
+unsigned PacketBatch::recv(timeout_t timeout)
+{
+    int flags = 0;
+
+    used = 0;
+    ioerr = 0;
+
+    if(!timeout)
+        flags = MSG_DONTWAIT;
+    else if(timeout != Timer::inf && !Socket::wait(so, timeout))
+        return 0;
+
+#ifdef  USE_RECVMMSG
+    struct mmsghdr *hp = (struct mmsghdr *)headers;
+    for(unsigned pos = 0; pos < limit; ++pos) {
+        hp[pos].msg_hdr.msg_iov->iov_len = mtu;
+        hp[pos].msg_hdr.msg_name = &list[pos].address;
+        hp[pos].msg_hdr.msg_namelen = sizeof(struct sockaddr_internet);
+    }
+
+    int result = ::recvmmsg(so, hp, limit, flags | MSG_WAITFORONE, NULL);
+    if(result < 0) {
+        ioerr = Socket::error();
+        if(ioerr == EAGAIN || ioerr == EWOULDBLOCK || ioerr == EINTR)
+            ioerr = 0;
+        return 0;
+    }
+
+    used = (unsigned)result;
+    for(unsigned pos = 0; pos < used; ++pos)
+        list[pos].length = hp[pos].msg_len;
+#else
+    // without recvmmsg, only the first receive may block...
+    if(flags && !Socket::wait(so, 0))
+        return 0;
+
+    while(used < limit) {
+        socklen_t slen = sizeof(struct sockaddr_internet);
+        ssize_t result = _recvfrom_(so, list[used].data, mtu, 0, (struct sockaddr *)&list[used].address, &slen);
+        if(result < 0) {
+            int error = Socket::error();
+            if(!used && error != EAGAIN && error != EWOULDBLOCK && error != EINTR)
+                ioerr = error;
+            break;
+        }
+        list[used++].length = (size_t)result;
+        if(!Socket::wait(so, 0))
+            break;
+    }
+#endif
+    return used;
+}
+
+unsigned PacketBatch::send(void)
+{
+    unsigned sent = 0;
+
+    ioerr = 0;
+
+#ifdef  USE_SENDMMSG
+    struct mmsghdr *hp = (struct mmsghdr *)headers;
+    for(unsigned pos = 0; pos < used; ++pos) {
+        hp[pos].msg_hdr.msg_iov->iov_len = list[pos].length;
+        if(list[pos].address.address.sa_family) {
+            hp[pos].msg_hdr.msg_name = &list[pos].address;
+            hp[pos].msg_hdr.msg_namelen = Socket::len(&list[pos].address.address);
+        }
+        else {
+            hp[pos].msg_hdr.msg_name = NULL;
+            hp[pos].msg_hdr.msg_namelen = 0;
+        }
+    }
+
+    while(sent < used) {
+        int result = ::sendmmsg(so, &hp[sent], used - sent, MSG_NOSIGNAL);
+        if(result <= 0) {
+            ioerr = Socket::error();
+            break;
+        }
+        sent += (unsigned)result;
+    }
+#else
+    while(sent < used) {
+        const struct sockaddr *dest = NULL;
+        socklen_t slen = 0;
+        if(list[sent].address.address.sa_family) {
+            dest = &list[sent].address.address;
+            slen = Socket::len(dest);
+        }
+        if(_sendto_(so, list[sent].data, list[sent].length, MSG_NOSIGNAL, dest, slen) < 0) {
+            ioerr = Socket::error();
+            break;
+        }
+        ++sent;
+    }
+#endif
+    return sent;
+}
+
+// wait for output space, or otherwise for the error queue...
+static bool zerocopy_wait(socket_t so, bool output, timeout_t timeout)
+{
+#ifdef  USE_ZEROCOPY
+    struct pollfd pfd;
+    int status;
+
+    pfd.fd = so;
+    pfd.events = output ? POLLOUT : 0;
+    pfd.revents = 0;
+
+    do {
+        status = _poll_(&pfd, 1, timeout == Timer::inf ? -1 : (int)timeout);
+    } while(status < 0 && errno == EINTR);
+
+    return status > 0;
+#else
+    struct timeval tv;
+    struct timeval *tvp = &tv;
+    fd_set grp, err;
+
+    if(timeout == Timer::inf)
+        tvp = NULL;
+    else {
+        tv.tv_usec = (timeout % 1000) * 1000;
+        tv.tv_sec = timeout / 1000;
+    }
+
+    FD_ZERO(&grp);
+    FD_ZERO(&err);
+    FD_SET(so, &grp);
+    FD_SET(so, &err);
+    return _select_((int)(so + 1), NULL, output ? &grp : NULL, &err, tvp) > 0;
+#endif
+}
+
+ZeroCopy::ZeroCopy(socket_t socket, release_t release, void *data, size_t threshold, unsigned count)
+{
+    if(!count)
+        count = 1;
+
+    so = socket;
+    callback = release;
+    user = data;
+    minsize = threshold;
+    limit = count;
+    head = used = active = 0;
+    copies = 0;
+    sequence = 0;
+    filling = NULL;
+    ioerr = 0;
+
+    list = (pending_t *)malloc(sizeof(pending_t) * count);
+    crit(list != NULL, "zero copy alloc failed");
+    memset(list, 0, sizeof(pending_t) * count);
+
+    enabled = (Socket::zerocopy(so, true) == 0);
+}
+
+ZeroCopy::~ZeroCopy()
+{
+    // the kernel may still be sending from what did not complete...
+    reap(0);
+    abandon();
+    free(list);
+}
+
+void ZeroCopy::complete(uint32_t low, uint32_t high)
+{
+    for(unsigned pos = 0; pos < used; ++pos) {
+        pending_t *pp = &list[(head + pos) % limit];
+        if(!pp->buffer)
+            continue;
+
+        if(pp->count) {
+            uint32_t first = pp->first, last = pp->first + pp->count - 1;
+            if(low > first)
+                first = low;
+            if(high < last)
+                last = high;
+            if(first <= last)
+                pp->done += last - first + 1;
+        }
+
+        if(pp != filling && pp->done >= pp->count) {
+            callback(user, pp->buffer, pp->size);
+            pp->buffer = NULL;
+            --active;
+        }
+    }
+
+    while(used && !list[head].buffer) {
+        head = (head + 1) % limit;
+        --used;
+    }
+}
+
+size_t ZeroCopy::write(const void *buffer, size_t size, int flags, timeout_t timeout)
+{
+    size_t sent = 0;
+    ssize_t result;
+
+    while(sent < size) {
+        result = _send_(so, (const char *)buffer + sent, size - sent, flags | MSG_NOSIGNAL);
+        if(result > 0) {
+            sent += (size_t)result;
+            if(flags && filling) {
+                ++filling->count;
+                ++sequence;
+            }
+            continue;
+        }
+        int err = Socket::error();
+        if(err == EINTR)
+            continue;
+#ifdef  USE_ZEROCOPY
+        // out of memory for pinned pages, reap or send this part copied...
+        if(flags && err == ENOBUFS) {
+            if(!reap(0))
+                flags = 0;
+            continue;
+        }
+#endif
+        if((err == EAGAIN || err == EWOULDBLOCK) && timeout && zerocopy_wait(so, true, timeout))
+            continue;
+        if(err != EAGAIN && err != EWOULDBLOCK)
+            ioerr = err;
+        break;
+    }
+    return sent;
+}
+
+size_t ZeroCopy::send(const void *buffer, size_t size, timeout_t timeout)
+{
+    size_t sent;
+
+    ioerr = 0;
+
+#ifdef  USE_ZEROCOPY
+    if(enabled && size >= minsize) {
+        // limit the buffers in flight...
+        while(used >= limit && reap(timeout)) {
+        }
+
+        if(used < limit) {
+            filling = &list[(head + used) % limit];
+            filling->buffer = buffer;
+            filling->size = size;
+            filling->first = sequence;
+            filling->count = filling->done = 0;
+            ++used;
+            ++active;
+
+            sent = write(buffer, size, MSG_ZEROCOPY, timeout);
+
+            // release now if every part already completed or was copied...
+            filling = NULL;
+            complete(1, 0);
+            return sent;
+        }
+    }
+#endif
+
+    sent = write(buffer, size, 0, timeout);
+    callback(user, buffer, size);
+    return sent;
+}
+
+unsigned ZeroCopy::reap(timeout_t timeout)
+{
+    unsigned prior = active;
+
+#ifdef  USE_ZEROCOPY
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[128];
+    } control;
+    bool waited = false;
+
+    while(active) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        if(::recvmsg(so, &msg, MSG_ERRQUEUE) < 0) {
+            int err = Socket::error();
+            if(err == EINTR)
+                continue;
+            if(err != EAGAIN && err != EWOULDBLOCK) {
+                ioerr = err;
+                break;
+            }
+            if(waited || !timeout || active < prior || !zerocopy_wait(so, false, timeout))
+                break;
+            waited = true;
+            continue;
+        }
+
+        for(struct cmsghdr *cp = CMSG_FIRSTHDR(&msg); cp != NULL; cp = CMSG_NXTHDR(&msg, cp)) {
+            if(!(cp->cmsg_level == SOL_IP && cp->cmsg_type == IP_RECVERR) &&
+              !(cp->cmsg_level == SOL_IPV6 && cp->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            struct sock_extended_err ee;
+            memcpy(&ee, CMSG_DATA(cp), sizeof(ee));
+            if(ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee.ee_errno)
+                continue;
+            if(ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                ++copies;
+            complete(ee.ee_info, ee.ee_data);
+        }
+    }
+#endif
+
+    return prior - active;
+}
+
+bool ZeroCopy::drain(timeout_t timeout)
+{
+    while(active) {
+        if(!reap(timeout))
+            break;
+    }
+    return active == 0;
+}
+
+void ZeroCopy::abandon(void)
+{
+    while(used) {
+        list[head].buffer = NULL;
+        head = (head + 1) % limit;
+        --used;
+    }
+    active = 0;
+}
+
+int Socket::loopback(socket_t so, bool enable)
+{
+    union {
+        struct sockaddr_storage saddr;
+        struct sockaddr_in inaddr;
+    } us;
+
+    struct sockaddr *addr = (struct sockaddr *)&us.saddr;
+    int family;
+    socklen_t len = sizeof(us.saddr);
+    int opt = 0;
+
+    if(enable)
+        opt = 1;
+
+    if(so == INVALID_SOCKET)
+        return EBADF;
+
+    _getsockname_(so, addr, &len);
+    family = us.inaddr.sin_family;
+    switch(family) {
+    case AF_INET:
+        if(!setsockopt(so, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&opt, sizeof(opt)))
+            return 0;
+        break;
+#if defined(AF_INET6) && defined(IPROTO_IPV6)
+    case AF_INET6:
+        if(!setsockopt(so, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, (char *)&opt, sizeof(opt)))
+            return 0;
+#endif
+    }
+    int err = Socket::error();
+    if(!err)
+        err = EIO;
+    return err;
+}
+
+int Socket::ttl(socket_t so, unsigned char t)
+{
+    union {
+        struct sockaddr_storage saddr;
+        struct sockaddr_in inaddr;
+    } us;
+
+    struct sockaddr *addr = (struct sockaddr *)&us.saddr;
+    int family;
+    socklen_t len = sizeof(us.saddr);
+
+    if(so == INVALID_SOCKET)
+        return EBADF;
+
+    _getsockname_(so, addr, &len);
+    family = us.inaddr.sin_family;
+    switch(family) {
+    case AF_INET:
+        if(!setsockopt(so, IPPROTO_IP, IP_TTL, (char *)&t, sizeof(t)))
+            return 0;
+        break;
+#if defined(AF_INET6) && defined(IPPROTO_IPV6)
+    case AF_INET6:
+        if(!setsockopt(so, IPPROTO_IPV6, IPV6_UNICAST_HOPS, (char *)&t, sizeof(t)))
+            return 0;
+#endif
+    }
+    int err = Socket::error();
+    if(!err)
+        err = EIO;
+    return err;
+}
+
+int Socket::offload(socket_t so, unsigned size)
+{
+    if(so == INVALID_SOCKET)
+        return EBADF;
+#ifdef  USE_UDP_OFFLOAD
+    int opt = (int)size;
+    if(!setsockopt(so, IPPROTO_UDP, UDP_SEGMENT, (char *)&opt, (socklen_t)sizeof(opt)))
+        return 0;
+    int err = Socket::error();
+    if(!err)
+        err = EIO;
+    return err;
+#else
+    return ENOSYS;
+#endif
+}
+
+int Socket::coalesce(socket_t so, bool enable)
+{
+    if(so == INVALID_SOCKET)
+        return EBADF;
+#if defined(USE_UDP_OFFLOAD) && defined(UDP_GRO)
+    int opt = 0;
+    if(enable)
+        opt = 1;
+    if(!setsockopt(so, IPPROTO_UDP, UDP_GRO, (char *)&opt, (socklen_t)sizeof(opt)))
+        return 0;
+    int err = Socket::error();
+    if(!err)
+        err = EIO;
+    return err;
+#else
+    return ENOSYS;
+#endif
+}
+
+int Socket::zerocopy(socket_t so, bool enable)
+{
+    if(so == INVALID_SOCKET)
+        return EBADF;
+#ifdef  USE_ZEROCOPY
+    int opt = 0;
+    if(enable)
+        opt = 1;
+    if(!setsockopt(so, SOL_SOCKET, SO_ZEROCOPY, (char *)&opt, (socklen_t)sizeof(opt)))
+        return 0;
+    int err = Socket::error();
+    if(!err)
+        err = EIO;
+    return err;
+#else
+    return ENOSYS;
+#endif
+}
+
+int Socket::priority(socket_t so, int pri)
+{
+    if(so == INVALID_SOCKET)
+        return EBADF;
+#ifdef  SO_PRIORITY
+    if(!setsockopt(so, SOL_SOCKET, SO_PRIORITY, (char *)&pri, (socklen_t)sizeof(pri)))
+        return 0;
+    int err = Socket::error();
+    if(!err)
+        err = EIO;
+    return err;
+#else
+    return ENOSYS;
+#endif
+}
+
+int Socket::tos(socket_t so, int ts)
+{
+    if(so == INVALID_SOCKET)
+        return EBADF;
+
+#ifdef  SOL_IP
+    if(!setsockopt(so, SOL_IP, IP_TOS,(char *)&ts, (socklen_t)sizeof(ts)))
+        return 0;
 
     int err = Socket::error();
     if(!err)
@@ -2609,6 +3677,446 @@ ListenSocket(address, service, backlog)
 {
 }
 
+static void reactor_drain(socket_t so)
+{
+    char buf[16];
+
+#ifdef  _MSWINDOWS_
+    while(::recv(so, buf, sizeof(buf), 0) > 0)
+        ;
+#else
+    while(::read(so, buf, sizeof(buf)) > 0)
+        ;
+#endif
+}
+
+SocketReactor::handler::handler(socket_t socket, timeout_t timeout) :
+TimerQueue::event(timeout)
+{
+    loop = NULL;
+    interest = 0;
+    so = socket;
+    if(!timeout)
+        clear();
+}
+
+SocketReactor::handler::~handler()
+{
+    if(loop)
+        loop->detach(this);
+}
+
+void SocketReactor::handler::readable(void)
+{
+}
+
+void SocketReactor::handler::writable(void)
+{
+}
+
+void SocketReactor::handler::expired(void)
+{
+}
+
+void SocketReactor::handler::hangup(void)
+{
+    if(loop)
+        loop->detach(this);
+}
+
+SocketReactor::acceptor::acceptor(const ListenSocket& listener) :
+handler(listener.handle())
+{
+}
+
+void SocketReactor::acceptor::readable(void)
+{
+    struct sockaddr_storage address;
+    socket_t client;
+
+    // edge triggered, so we must accept until the backlog is empty...
+    for(;;) {
+        client = Socket::acceptfrom(so, &address);
+        if(client != INVALID_SOCKET) {
+            accepted(client, &address);
+            continue;
+        }
+        switch(Socket::error()) {
+        case EINTR:
+        case ECONNABORTED:
+#ifdef  EPROTO
+        case EPROTO:
+#endif
+            continue;
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+            // no edge will come for what is still queued, so retry later...
+            arm(250);
+            return;
+        default:
+            return;
+        }
+    }
+}
+
+void SocketReactor::acceptor::expired(void)
+{
+    readable();
+}
+
+SocketReactor::SocketReactor(timeout_t resolution) :
+TimerQueue(resolution)
+{
+    fd = -1;
+    count = 0;
+    current = pending = 0;
+    stopped = false;
+    wake[0] = wake[1] = INVALID_SOCKET;
+
+#ifdef  _MSWINDOWS_
+    // windows cannot select on a pipe, so we wake through loopback...
+    struct sockaddr_in self;
+    socklen_t slen = sizeof(self);
+
+    memset(&self, 0, sizeof(self));
+    self.sin_family = AF_INET;
+    self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    wake[0] = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if(wake[0] == INVALID_SOCKET)
+        return;
+    if(::bind(wake[0], (struct sockaddr *)&self, sizeof(self)) ||
+        ::getsockname(wake[0], (struct sockaddr *)&self, &slen) ||
+        ::connect(wake[0], (struct sockaddr *)&self, slen)) {
+        Socket::release(wake[0]);
+        wake[0] = INVALID_SOCKET;
+        return;
+    }
+    wake[1] = wake[0];
+#else
+    int pair[2];
+    if(::pipe(pair))
+        return;
+    wake[0] = pair[0];
+    wake[1] = pair[1];
+#endif
+    Socket::blocking(wake[0], false);
+    Socket::blocking(wake[1], false);
+
+#ifdef  USE_EPOLL
+    struct epoll_event ev;
+
+    fd = epoll_create(BATCH);
+    if(fd == -1)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if(epoll_ctl(fd, EPOLL_CTL_ADD, wake[0], &ev)) {
+        ::close(fd);
+        fd = -1;
+    }
+#else
+    fd = 0;
+#endif
+}
+
+SocketReactor::~SocketReactor()
+{
+    linked_pointer<handler> hp = begin();
+
+    while(hp) {
+        handler *h = *hp;
+        hp.next();
+        detach(h);
+    }
+
+#ifdef  USE_EPOLL
+    if(fd != -1)
+        ::close(fd);
+#endif
+
+#ifdef  _MSWINDOWS_
+    if(wake[0] != INVALID_SOCKET)
+        Socket::release(wake[0]);
+#else
+    if(wake[0] != INVALID_SOCKET) {
+        ::close(wake[0]);
+        ::close(wake[1]);
+    }
+#endif
+}
+
+void SocketReactor::modify(void)
+{
+}
+
+void SocketReactor::update(void)
+{
+}
+
+bool SocketReactor::attach(handler *h, unsigned interest)
+{
+    if(!h || h->so == INVALID_SOCKET || fd == -1)
+        return false;
+
+    if(h->loop == this)
+        return change(h, interest);
+
+    if(h->loop)
+        return false;
+
+#ifdef  USE_EPOLL
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLET;
+    if(interest & READ)
+        ev.events |= EPOLLIN;
+    if(interest & WRITE)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = h;
+    if(epoll_ctl(fd, EPOLL_CTL_ADD, h->so, &ev))
+        return false;
+#else
+#ifndef _MSWINDOWS_
+    if(h->so >= FD_SETSIZE)
+        return false;
+#endif
+    if(count >= FD_SETSIZE - 1)
+        return false;
+#endif
+
+    Socket::blocking(h->so, false);
+    h->loop = this;
+    h->interest = interest;
+    ++count;
+    h->attach(this);
+    return true;
+}
+
+bool SocketReactor::change(handler *h, unsigned interest)
+{
+    if(!h || h->loop != this)
+        return false;
+
+#ifdef  USE_EPOLL
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLET;
+    if(interest & READ)
+        ev.events |= EPOLLIN;
+    if(interest & WRITE)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = h;
+    if(epoll_ctl(fd, EPOLL_CTL_MOD, h->so, &ev))
+        return false;
+#endif
+
+    h->interest = interest;
+    return true;
+}
+
+void SocketReactor::detach(handler *h)
+{
+    if(!h || h->loop != this)
+        return;
+
+#ifdef  USE_EPOLL
+    // older kernels require a non-null event even for delete...
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(fd, EPOLL_CTL_DEL, h->so, &ev);
+#endif
+
+    cancel(h);
+    h->loop = NULL;
+    h->interest = 0;
+    --count;
+    h->detach();
+}
+
+void SocketReactor::cancel(handler *h)
+{
+    for(unsigned pos = current; pos < pending; ++pos) {
+        if(ready[pos] == h)
+            ready[pos] = NULL;
+    }
+}
+
+void SocketReactor::dispatch(event **list, unsigned total)
+{
+    pending = 0;
+    while(pending < total && pending < BATCH) {
+        ready[pending] = static_cast<handler *>(list[pending]);
+        flags[pending++] = EXPIRED;
+    }
+    process();
+}
+
+void SocketReactor::process(void)
+{
+    // callbacks may detach or delete any handler, which clears it from
+    // the ready list before we get to it...
+    for(current = 0; current < pending; ++current) {
+        handler *h = ready[current];
+        unsigned events = flags[current];
+
+        if(!h)
+            continue;
+
+        if(events & EXPIRED) {
+            h->disarm();
+            h->expired();
+            continue;
+        }
+
+        if(events & READ) {
+            h->readable();
+            if(!ready[current])
+                continue;
+        }
+
+        if(events & WRITE) {
+            h->writable();
+            if(!ready[current])
+                continue;
+        }
+
+        if(events & HANGUP)
+            h->hangup();
+    }
+    current = pending = 0;
+}
+
+void SocketReactor::collect(timeout_t timeout)
+{
+    pending = 0;
+
+#ifdef  USE_EPOLL
+    struct epoll_event events[BATCH];
+    int result;
+
+    if(timeout == Timer::inf)
+        result = epoll_wait(fd, events, BATCH, -1);
+    else if(timeout > 0x7fffffff)
+        result = epoll_wait(fd, events, BATCH, 0x7fffffff);
+    else
+        result = epoll_wait(fd, events, BATCH, (int)timeout);
+
+    for(int pos = 0; pos < result; ++pos) {
+        handler *h = (handler *)events[pos].data.ptr;
+        unsigned mask = 0;
+
+        if(!h) {
+            reactor_drain(wake[0]);
+            continue;
+        }
+
+        if(events[pos].events & (EPOLLIN | EPOLLPRI))
+            mask |= READ;
+        if(events[pos].events & EPOLLOUT)
+            mask |= WRITE;
+        if(events[pos].events & (EPOLLHUP | EPOLLERR))
+            mask |= HANGUP;
+
+        ready[pending] = h;
+        flags[pending++] = mask;
+    }
+#else
+    struct timeval tv;
+    struct timeval *tvp = &tv;
+    fd_set rfd, wfd;
+    socket_t high = wake[0];
+    linked_pointer<handler> hp = begin();
+
+    FD_ZERO(&rfd);
+    FD_ZERO(&wfd);
+    FD_SET(wake[0], &rfd);
+    while(hp) {
+        if(hp->interest & READ)
+            FD_SET(hp->so, &rfd);
+        if(hp->interest & WRITE)
+            FD_SET(hp->so, &wfd);
+        if(hp->so > high)
+            high = hp->so;
+        hp.next();
+    }
+
+    if(timeout == Timer::inf)
+        tvp = NULL;
+    else {
+        tv.tv_usec = (timeout % 1000) * 1000;
+        tv.tv_sec = timeout / 1000;
+    }
+
+    if(_select_((int)(high + 1), &rfd, &wfd, NULL, tvp) < 1)
+        return;
+
+    if(FD_ISSET(wake[0], &rfd))
+        reactor_drain(wake[0]);
+
+    // select is level triggered, so anything past the batch is seen again...
+    hp = begin();
+    while(is(hp) && pending < BATCH) {
+        unsigned mask = 0;
+        if((hp->interest & READ) && FD_ISSET(hp->so, &rfd))
+            mask |= READ;
+        if((hp->interest & WRITE) && FD_ISSET(hp->so, &wfd))
+            mask |= WRITE;
+        if(mask) {
+            ready[pending] = *hp;
+            flags[pending++] = mask;
+        }
+        hp.next();
+    }
+#endif
+}
+
+bool SocketReactor::poll(timeout_t timeout)
+{
+    timeout_t wait;
+
+    if(stopped || fd == -1)
+        return false;
+
+    wait = expire();
+    if(timeout < wait)
+        wait = timeout;
+
+    if(stopped)
+        return false;
+
+    collect(wait);
+    process();
+    return !stopped;
+}
+
+void SocketReactor::run(void)
+{
+    while(poll())
+        ;
+}
+
+void SocketReactor::stop(void)
+{
+    char byte = 0;
+
+    stopped = true;
+    if(wake[1] == INVALID_SOCKET)
+        return;
+
+#ifdef  _MSWINDOWS_
+    ::send(wake[1], &byte, 1, 0);
+#else
+    if(::write(wake[1], &byte, 1) < 1)
+        return;
+#endif
+}
+
 #ifdef  _MSWINDOWS_
 #undef  AF_UNIX
 #endif
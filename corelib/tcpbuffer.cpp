@@ -29,12 +29,14 @@ using namespace UCOMMON_NAMESPACE;
 TCPBuffer::TCPBuffer() :
 BufferProtocol()
 {
+    zcopy = NULL;
     so = INVALID_SOCKET;
 }
 
 TCPBuffer::TCPBuffer(const char *host, const char *service, size_t size) :
 BufferProtocol()
 {
+    zcopy = NULL;
     so = INVALID_SOCKET;
     open(host, service, size);
 }
@@ -42,6 +44,7 @@ BufferProtocol()
 TCPBuffer::TCPBuffer(const TCPServer *server, size_t size) :
 BufferProtocol()
 {
+    zcopy = NULL;
     so = INVALID_SOCKET;
     open(server, size);
 }
@@ -75,14 +78,31 @@ void TCPBuffer::open(const TCPServer *server, size_t size)
     _buffer(size);
 }
 
-void TCPBuffer::close(void)
+bool TCPBuffer::close(void)
 {
+    bool result = true;
+
     if(so == INVALID_SOCKET)
-        return;
+        return true;
 
     BufferProtocol::release();
+
+    // the kernel may still be sending from posted buffers, and those
+    // not done by now can never be safely passed back to the owner...
+    if(zcopy) {
+        if(!zcopy->drain(iowait)) {
+            ioerr = zcopy->err();
+            if(!ioerr)
+                ioerr = ETIMEDOUT;
+            result = false;
+        }
+        delete zcopy;
+        zcopy = NULL;
+    }
+
     Socket::release(so);
     so = INVALID_SOCKET;
+    return result;
 }
 
 void TCPBuffer::_buffer(size_t size)
@@ -155,6 +175,100 @@ bool TCPBuffer::_blocking(void)
     return false;
 }
 
+bool TCPBuffer::_direct(void)
+{
+    return true;
+}
+
+size_t TCPBuffer::transfer(fsys& file, fsys::offset_t *offset, size_t count)
+{
+    size_t moved = 0;
+    ssize_t result;
+
+    if(ioerr || !flush())
+        return 0;
+
+    // sessions that encode data still have to go through the buffer...
+    if(!_direct()) {
+        char buffer[1024];
+        if(offset && file.seek(*offset))
+            return 0;
+
+        while(moved < count) {
+            size_t chunk = count - moved;
+            if(chunk > sizeof(buffer))
+                chunk = sizeof(buffer);
+            result = file.read(buffer, chunk);
+            if(result < 1 || put(buffer, (size_t)result) < (size_t)result)
+                break;
+            moved += (size_t)result;
+        }
+        if(offset)
+            *offset += (fsys::offset_t)moved;
+        return moved;
+    }
+
+    while(moved < count) {
+        result = fsys::transfer((fd_t)so, *file, offset, count - moved);
+        if(result > 0) {
+            moved += (size_t)result;
+            continue;
+        }
+        if(!result)
+            break;
+        int err = fsys::remapError();
+        if(err != EAGAIN && err != EWOULDBLOCK) {
+            ioerr = err;
+            break;
+        }
+        if(!iowait || !waitSending(iowait))
+            break;
+    }
+    return moved;
+}
+
+bool TCPBuffer::zerocopy(ZeroCopy::release_t release, void *user, size_t threshold)
+{
+    if(zcopy)
+        return zcopy->is_enabled();
+
+    if(so == INVALID_SOCKET || !_direct())
+        return false;
+
+    zcopy = new ZeroCopy(so, release, user, threshold);
+    return zcopy->is_enabled();
+}
+
+size_t TCPBuffer::post(const void *address, size_t len)
+{
+    size_t result;
+
+    if(!zcopy || len < zcopy->threshold()) {
+        result = put(address, len);
+        if(zcopy)
+            zcopy->release(address, len);
+        return result;
+    }
+
+    if(ioerr || !flush()) {
+        zcopy->release(address, len);
+        return 0;
+    }
+
+    result = zcopy->send(address, len, iowait);
+    if(zcopy->err())
+        ioerr = zcopy->err();
+    return result;
+}
+
+unsigned TCPBuffer::reap(timeout_t timeout)
+{
+    if(!zcopy)
+        return 0;
+
+    return zcopy->reap(timeout);
+}
+
 size_t TCPBuffer::_push(const char *address, size_t len)
 {
     if(ioerr)
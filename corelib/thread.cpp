@@ -31,12 +31,72 @@
 static int realtime_policy = SCHED_FIFO;
 #endif
 
+#if defined(__linux__) && !defined(__PTH__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT    0
+#define MPOL_PREFERRED  1
+#endif
+#endif
+
 #undef  _POSIX_SPIN_LOCKS
 
 static unsigned max_sharing = 0;
 
 using namespace UCOMMON_NAMESPACE;
 
+#if defined(HAVE_FUTEX) && defined(HAVE_GCC_ATOMICS) && defined(__ATOMIC_SEQ_CST) && !defined(__PTH__) && !defined(_MSWINDOWS_)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define USE_FUTEX
+
+// backoff rounds a waiter spins before it sleeps in the kernel...
+#define FUTEX_SPINS 6
+
+static unsigned futex_cpus = 0;
+
+static inline void futex_wait(unsigned *word, unsigned value, const struct timespec *ts)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, ts, NULL, 0);
+}
+
+static inline void futex_wake(unsigned *word, int count)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static bool futex_spin(unsigned& spins, unsigned *waits)
+{
+    // spinning only pays off if another cpu can release us, and if no one
+    // is already asleep ahead of us...
+    if(!futex_cpus)
+        futex_cpus = Thread::cpus();
+
+    if(spins >= FUTEX_SPINS || futex_cpus < 2 || __atomic_load_n(waits, __ATOMIC_RELAXED))
+        return false;
+
+    atomic::backoff(spins);
+    return true;
+}
+
+static void futex_mutex(pthread_mutex_t *mutex)
+{
+    // glibc mutexes are futex based and stay in user space when not
+    // contended, adaptive ones also spin briefly before sleeping...
+#ifdef  PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+    crit(pthread_mutex_init(mutex, &attr) == 0, "mutex init failed");
+    pthread_mutexattr_destroy(&attr);
+#else
+    crit(pthread_mutex_init(mutex, NULL) == 0, "mutex init failed");
+#endif
+}
+#endif
+
 #if _POSIX_TIMERS > 0 && defined(POSIX_TIMERS)
 extern int _posix_clocking;
 int _posix_clocking = CLOCK_REALTIME;
@@ -82,6 +142,29 @@ static mutex_index *mutex_table = &single_table;
 static unsigned mutex_indexing = 1;
 static unsigned rwlock_indexing = 1;
 
+// striped tables are padded to a cache line so neighboring stripes never
+// false share; they are sized once at startup and never resized...
+
+#define STRIPE_LINE     64
+#define STRIPE_LIMIT    4096
+
+union mutex_stripe
+{
+    pthread_mutex_t mutex;
+    char pad[((sizeof(pthread_mutex_t) + STRIPE_LINE - 1) / STRIPE_LINE) * STRIPE_LINE];
+};
+
+class __LOCAL rwlock_stripe : public ThreadLock
+{
+private:
+    char pad[STRIPE_LINE - (sizeof(ThreadLock) % STRIPE_LINE)];
+};
+
+static mutex_stripe *mutex_stripes = NULL;
+static rwlock_stripe *rwlock_stripes = NULL;
+static unsigned mutex_striping = 0;
+static unsigned rwlock_striping = 0;
+
 #ifdef  __PTH__
 static pth_key_t threadmap;
 #else
@@ -156,6 +239,40 @@ static unsigned hash_address(const void *ptr, unsigned indexing)
     return key % indexing;
 }
 
+static unsigned hash_stripe(const void *ptr, unsigned mask)
+{
+    size_t addr = (size_t)ptr;
+    unsigned key = (unsigned)((addr >> 4) ^ (addr >> 16));
+
+    // fibonacci hashing spreads aligned addresses over all stripes...
+    key *= 2654435761u;
+    return (key >> 16) & mask;
+}
+
+static unsigned stripe_count(unsigned count)
+{
+    unsigned stripes = 64;
+
+    if(!count)
+        count = Thread::cpus() * 16;
+
+    while(stripes < count && stripes < STRIPE_LIMIT)
+        stripes <<= 1;
+
+    return stripes;
+}
+
+static caddr_t stripe_alloc(size_t size, unsigned count)
+{
+    // the table is never released, so we can simply round up the base...
+    caddr_t mem = (caddr_t)malloc(size * count + STRIPE_LINE);
+    crit(mem != NULL, "stripe alloc failed");
+    size_t offset = (size_t)mem % STRIPE_LINE;
+    if(offset)
+        mem += STRIPE_LINE - offset;
+    return mem;
+}
+
 ReusableAllocator::ReusableAllocator() :
 Conditional()
 {
@@ -226,6 +343,86 @@ void Semaphore::_unlock(void)
     release();
 }
 
+#ifdef  USE_FUTEX
+
+// with futex support the semaphore never touches its conditional; used is
+// the futex word, and waits counts sleepers so release can skip the wake...
+
+bool Semaphore::wait(timeout_t timeout)
+{
+    unsigned spins = 0, current;
+    struct timespec ts, *tp = NULL;
+    Timer expires;
+
+    if(timeout && timeout != Timer::inf)
+        expires.set(timeout);
+
+    for(;;) {
+        current = __atomic_load_n(&used, __ATOMIC_ACQUIRE);
+        if(current < __atomic_load_n(&count, __ATOMIC_RELAXED)) {
+            if(__atomic_compare_exchange_n(&used, &current, current + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return true;
+            continue;
+        }
+
+        if(futex_spin(spins, &waits))
+            continue;
+
+        if(!timeout)
+            return false;
+
+        if(timeout != Timer::inf) {
+            timeout_t remaining = expires.get();
+            if(!remaining)
+                return false;
+            ts.tv_sec = remaining / 1000;
+            ts.tv_nsec = (remaining % 1000) * 1000000l;
+            tp = &ts;
+        }
+
+        __atomic_fetch_add(&waits, 1, __ATOMIC_SEQ_CST);
+        current = __atomic_load_n(&used, __ATOMIC_SEQ_CST);
+        if(current >= __atomic_load_n(&count, __ATOMIC_SEQ_CST))
+            futex_wait(&used, current, tp);
+        __atomic_fetch_sub(&waits, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void Semaphore::wait(void)
+{
+    wait(Timer::inf);
+}
+
+void Semaphore::release(void)
+{
+    unsigned current = __atomic_load_n(&used, __ATOMIC_RELAXED);
+
+    do {
+        if(!current)
+            return;
+    } while(!__atomic_compare_exchange_n(&used, &current, current - 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if(__atomic_load_n(&waits, __ATOMIC_SEQ_CST))
+        futex_wake(&used, 1);
+}
+
+void Semaphore::set(unsigned value)
+{
+    assert(value > 0);
+
+    __atomic_store_n(&count, value, __ATOMIC_SEQ_CST);
+
+    // a new limit does not change the futex word, so a waiter may still be
+    // on its way to sleep against the old one; keep waking until every
+    // sleeper is gone or the new slots are taken...
+    while(__atomic_load_n(&waits, __ATOMIC_SEQ_CST) && __atomic_load_n(&used, __ATOMIC_SEQ_CST) < value) {
+        futex_wake(&used, INT_MAX);
+        Thread::yield();
+    }
+}
+
+#else
+
 bool Semaphore::wait(timeout_t timeout)
 {
     bool result = true;
@@ -289,6 +486,8 @@ void Semaphore::set(unsigned value)
     }
 }
 
+#endif
+
 #ifdef  _MSWINDOWS_
 
 bool Thread::equal(pthread_t t1, pthread_t t2)
@@ -455,8 +654,12 @@ Conditional::Conditional()
     pth_mutex_init(&mutex);
 #else
     crit(pthread_cond_init(&cond, &attr.attr) == 0, "conditional init failed");
+#ifdef  USE_FUTEX
+    futex_mutex(&mutex);
+#else
     crit(pthread_mutex_init(&mutex, NULL) == 0, "mutex init failed");
 #endif
+#endif
 }
 
 Conditional::~Conditional()
@@ -467,6 +670,15 @@ Conditional::~Conditional()
 #endif
 }
 
+#ifdef  UCOMMON_PROFILING
+void Conditional::wait(void)
+{
+    uint64_t start = blocking();
+    pthread_cond_wait(&cond, &mutex);
+    blocked(start);
+}
+#endif
+
 bool Conditional::wait(timeout_t timeout)
 {
     struct timespec ts;
@@ -478,10 +690,17 @@ bool Conditional::wait(struct timespec *ts)
 {
     assert(ts != NULL);
 
+#ifdef  UCOMMON_PROFILING
+    uint64_t start = blocking();
+    int result = pthread_cond_timedwait(&cond, &mutex, ts);
+    blocked(start);
+    return result != ETIMEDOUT;
+#else
     if(pthread_cond_timedwait(&cond, &mutex, ts) == ETIMEDOUT)
         return false;
 
     return true;
+#endif
 }
 
 #endif
@@ -644,6 +863,22 @@ ConditionalAccess::~ConditionalAccess()
 #endif
 }
 
+#ifdef  UCOMMON_PROFILING
+void ConditionalAccess::waitSignal(void)
+{
+    uint64_t start = blocking();
+    pthread_cond_wait(&cond, &mutex);
+    blocked(start);
+}
+
+void ConditionalAccess::waitBroadcast(void)
+{
+    uint64_t start = blocking();
+    pthread_cond_wait(&bcast, &mutex);
+    blocked(start);
+}
+#endif
+
 bool ConditionalAccess::waitSignal(timeout_t timeout)
 {
     struct timespec ts;
@@ -655,10 +890,17 @@ bool ConditionalAccess::waitBroadcast(struct timespec *ts)
 {
     assert(ts != NULL);
 
+#ifdef  UCOMMON_PROFILING
+    uint64_t start = blocking();
+    int result = pthread_cond_timedwait(&bcast, &mutex, ts);
+    blocked(start);
+    return result != ETIMEDOUT;
+#else
     if(pthread_cond_timedwait(&bcast, &mutex, ts) == ETIMEDOUT)
         return false;
 
     return true;
+#endif
 }
 
 bool ConditionalAccess::waitBroadcast(timeout_t timeout)
@@ -672,10 +914,17 @@ bool ConditionalAccess::waitSignal(struct timespec *ts)
 {
     assert(ts != NULL);
 
+#ifdef  UCOMMON_PROFILING
+    uint64_t start = blocking();
+    int result = pthread_cond_timedwait(&cond, &mutex, ts);
+    blocked(start);
+    return result != ETIMEDOUT;
+#else
     if(pthread_cond_timedwait(&cond, &mutex, ts) == ETIMEDOUT)
         return false;
 
     return true;
+#endif
 }
 
 #endif
@@ -750,6 +999,7 @@ Conditional()
 {
     lockers = 0;
     waiting = 0;
+    compose();
 }
 
 void RecursiveMutex::_lock(void)
@@ -764,21 +1014,24 @@ void RecursiveMutex::_unlock(void)
 
 bool RecursiveMutex::lock(timeout_t timeout)
 {
-    bool result = true;
+    bool result = true, delayed = false;
     struct timespec ts;
     set(&ts, timeout);
 
+    uint64_t start = acquiring();
     Conditional::lock();
     while(result && lockers) {
         if(Thread::equal(locker, pthread_self()))
             break;
         ++waiting;
+        delayed = true;
         result = Conditional::wait(&ts);
         --waiting;
     }
     if(!lockers) {
         result = true;
         locker = pthread_self();
+        entered(start, delayed);
     }
     else
         result = false;
@@ -789,16 +1042,22 @@ bool RecursiveMutex::lock(timeout_t timeout)
 
 void RecursiveMutex::lock(void)
 {
+    bool delayed = false;
+    uint64_t start = acquiring();
+
     Conditional::lock();
     while(lockers) {
         if(Thread::equal(locker, pthread_self()))
             break;
         ++waiting;
+        delayed = true;
         Conditional::wait();
         --waiting;
     }
-    if(!lockers)
+    if(!lockers) {
         locker = pthread_self();
+        entered(start, delayed);
+    }
     ++lockers;
     Conditional::unlock();
     return;
@@ -808,6 +1067,8 @@ void RecursiveMutex::release(void)
 {
     Conditional::lock();
     --lockers;
+    if(!lockers)
+        leaving();
     if(!lockers && waiting)
         Conditional::signal();
     Conditional::unlock();
@@ -817,6 +1078,7 @@ ThreadLock::ThreadLock() :
 ConditionalAccess()
 {
     writers = 0;
+    compose();
 }
 
 void ThreadLock::_lock(void)
@@ -836,16 +1098,18 @@ void ThreadLock::_unlock(void)
 
 bool ThreadLock::modify(timeout_t timeout)
 {
-    bool rtn = true;
+    bool rtn = true, delayed = false;
     struct timespec ts;
 
     if(timeout && timeout != Timer::inf)
         set(&ts, timeout);
 
+    uint64_t start = acquiring();
     lock();
     while((writers || sharing) && rtn) {
         if(writers && Thread::equal(writeid, pthread_self()))
             break;
+        delayed = true;
         ++pending;
         if(timeout == Timer::inf)
             waitSignal();
@@ -857,8 +1121,10 @@ bool ThreadLock::modify(timeout_t timeout)
     }
     assert(!max_sharing || writers < max_sharing);
     if(rtn) {
-        if(!writers)
+        if(!writers) {
             writeid = pthread_self();
+            entered(start, delayed);
+        }
         ++writers;
     }
     unlock();
@@ -868,13 +1134,15 @@ bool ThreadLock::modify(timeout_t timeout)
 bool ThreadLock::access(timeout_t timeout)
 {
     struct timespec ts;
-    bool rtn = true;
+    bool rtn = true, delayed = false;
 
     if(timeout && timeout != Timer::inf)
         set(&ts, timeout);
 
+    uint64_t start = acquiring();
     lock();
     while((writers || pending) && rtn) {
+        delayed = true;
         ++waiting;
         if(timeout == Timer::inf)
             waitBroadcast();
@@ -885,8 +1153,10 @@ bool ThreadLock::access(timeout_t timeout)
         --waiting;
     }
     assert(!max_sharing || sharing < max_sharing);
-    if(rtn)
+    if(rtn) {
+        entered(start, delayed, false);
         ++sharing;
+    }
     unlock();
     return rtn;
 }
@@ -899,6 +1169,8 @@ void ThreadLock::release(void)
     if(writers) {
         assert(!sharing);
         --writers;
+        if(!writers)
+            leaving();
         if(pending && !writers)
             signal();
         else if(waiting && !writers)
@@ -990,6 +1262,8 @@ Mutex::Mutex()
 {
 #ifdef  __PTH__
     pth_mutex_init(&mlock);
+#elif defined(USE_FUTEX)
+    futex_mutex(&mlock);
 #else
     crit(pthread_mutex_init(&mlock, NULL) == 0, "mutex init failed");
 #endif
@@ -1000,136 +1274,548 @@ Mutex::~Mutex()
     pthread_mutex_destroy(&mlock);
 }
 
-void Mutex::indexing(unsigned index)
+BigReaderLock::BigReaderLock(unsigned count) :
+readers(LONG_MAX, count), writing(0)
 {
-    if(index > 1) {
-        mutex_table = new mutex_index[index];
-        mutex_indexing = index;
-    }
+#if defined(__PTH__)
+    Thread::init();
+    pth_key_create(&key, NULL);
+#elif defined(_MSWINDOWS_)
+    key = TlsAlloc();
+#else
+    crit(pthread_key_create(&key, NULL) == 0, "reader key failed");
+#endif
 }
 
-void ThreadLock::indexing(unsigned index)
+BigReaderLock::~BigReaderLock()
 {
-    if(index > 1) {
-        rwlock_table = new rwlock_index[index];
-        rwlock_indexing = index;
-    }
+#if defined(__PTH__)
+    pth_key_delete(key);
+#elif defined(_MSWINDOWS_)
+    TlsFree(key);
+#else
+    pthread_key_delete(key);
+#endif
 }
 
-ThreadLock::guard_reader::guard_reader()
+void BigReaderLock::_lock(void)
 {
-    object = NULL;
+    modify();
 }
 
-ThreadLock::guard_reader::guard_reader(const void *obj)
+void BigReaderLock::_share(void)
 {
-    object = obj;
-    if(obj)
-        if(!ThreadLock::reader(object))
-            object = NULL;
+    access();
 }
 
-ThreadLock::guard_reader::~guard_reader()
+void BigReaderLock::_unlock(void)
 {
     release();
 }
 
-void ThreadLock::guard_reader::set(const void *obj)
+void BigReaderLock::access(void)
 {
-    release();
-    object = obj;
-    if(obj)
-        if(!ThreadLock::reader(object))
-            object = NULL;
+    for(;;) {
+        // we may move between cpus, so every change goes to the slot we
+        // entered on...
+        unsigned slot = readers.index();
+
+        // our slot increment and the writer flag are ordered by fences on
+        // both sides, so either we see the writer or it sees us...
+        readers.add(slot, 1);
+        atomic::fence();
+        if(!writing.load()) {
+            void *held = (void *)(uintptr_t)(slot + 1);
+#if defined(__PTH__)
+            pth_key_setdata(key, held);
+#elif defined(_MSWINDOWS_)
+            TlsSetValue(key, held);
+#else
+            pthread_setspecific(key, held);
+#endif
+            return;
+        }
+
+        // back out and wait for the writer to finish...
+        atomic::fence(atomic::RELEASE);
+        readers.add(slot, -1);
+        writer.acquire();
+        writer.release();
+    }
 }
 
-void ThreadLock::guard_reader::release(void)
+void BigReaderLock::modify(void)
 {
-    if(object) {
-        ThreadLock::release(object);
-        object = NULL;
+    unsigned spins;
+
+    writer.acquire();
+    writing.store(1);
+    atomic::fence();
+
+    // readers leave the slot they entered, so each slot drains to zero
+    // on its own, and a reader once seen in a slot keeps it from zero...
+    for(unsigned slot = 0; slot < readers.size(); ++slot) {
+        spins = 0;
+        while(readers.load(slot))
+            atomic::backoff(spins);
     }
+
+    atomic::fence(atomic::ACQUIRE);
 }
 
-ThreadLock::guard_writer::guard_writer()
+void BigReaderLock::release(void)
 {
-    object = NULL;
+    void *held;
+
+#if defined(__PTH__)
+    held = pth_key_getdata(key);
+#elif defined(_MSWINDOWS_)
+    held = TlsGetValue(key);
+#else
+    held = pthread_getspecific(key);
+#endif
+
+    // a thread holding no reader slot must be the writer...
+    if(!held) {
+        writing.store(0);
+        writer.release();
+        return;
+    }
+
+#if defined(__PTH__)
+    pth_key_setdata(key, NULL);
+#elif defined(_MSWINDOWS_)
+    TlsSetValue(key, NULL);
+#else
+    pthread_setspecific(key, NULL);
+#endif
+
+    atomic::fence(atomic::RELEASE);
+    readers.add((unsigned)((uintptr_t)held - 1), -1);
 }
 
-ThreadLock::guard_writer::guard_writer(const void *obj)
+#ifdef  UCOMMON_PROFILING
+
+// the registry uses a raw mutex, as every other lock registers in it...
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static LockProfile *profile_list = NULL;
+
+static uint64_t profile_clock(void)
 {
-    object = obj;
-    if(obj)
-        if(!ThreadLock::writer(object))
-            object = NULL;
+#if _POSIX_TIMERS > 0 && defined(_POSIX_MONOTONIC_CLOCK)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000ull + tv.tv_usec * 1000ull;
+#endif
 }
 
-ThreadLock::guard_writer::~guard_writer()
+LockProfile::LockProfile()
 {
-    release();
+    enlist();
 }
 
-void ThreadLock::guard_writer::set(const void *obj)
+LockProfile::LockProfile(const LockProfile&)
 {
-    release();
-    object = obj;
-    if(obj)
-        if(!ThreadLock::writer(object))
-            object = NULL;
+    enlist();
 }
 
-void ThreadLock::guard_writer::release(void)
+void LockProfile::enlist(void)
 {
-    if(object) {
-        ThreadLock::release(object);
-        object = NULL;
-    }
+    id = NULL;
+    acquired = contended = waited = 0;
+    wait = maxwait = idle = hold = maxhold = held = 0;
+    composite = stalled = false;
+
+    pthread_mutex_lock(&profile_lock);
+    prev = NULL;
+    next = profile_list;
+    if(next)
+        next->prev = this;
+    profile_list = this;
+    pthread_mutex_unlock(&profile_lock);
 }
 
-bool ThreadLock::reader(const void *ptr, timeout_t timeout)
+LockProfile::~LockProfile()
 {
-    rwlock_index *index = &rwlock_table[hash_address(ptr, rwlock_indexing)];
-    rwlock_entry *entry, *empty = NULL;
-
-    if(!ptr)
-        return false;
+    pthread_mutex_lock(&profile_lock);
+    if(prev)
+        prev->next = next;
+    else
+        profile_list = next;
+    if(next)
+        next->prev = prev;
+    pthread_mutex_unlock(&profile_lock);
+}
 
-    index->acquire();
-    entry = index->list;
-    while(entry) {
-        if(entry->count && entry->object == ptr)
-            break;
-        if(!entry->count)
-            empty = entry;
-        entry = entry->next;
-    }
-    if(!entry) {
-        if(empty)
-            entry = empty;
-        else {
-            entry = new rwlock_entry;
-            entry->next = index->list;
-            index->list = entry;
+// statistics are only changed while the profiled mutex is held...
+void LockProfile::locking(pthread_mutex_t *mutex)
+{
+    // a composed lock only notes it was held up by its own mutex...
+    if(composite) {
+        if(pthread_mutex_trylock(mutex)) {
+            pthread_mutex_lock(mutex);
+            stalled = true;
         }
+        return;
     }
-    entry->object = ptr;
-    ++entry->count;
-    index->release();
-    if(entry->access(timeout))
-        return true;
-    index->acquire();
-    --entry->count;
-    index->release();
-    return false;
+
+    if(pthread_mutex_trylock(mutex)) {
+        uint64_t start = profile_clock();
+        pthread_mutex_lock(mutex);
+        held = profile_clock();
+        ++contended;
+        wait += held - start;
+        if(held - start > maxwait)
+            maxwait = held - start;
+    }
+    else
+        held = profile_clock();
+    ++acquired;
 }
 
-bool ThreadLock::writer(const void *ptr, timeout_t timeout)
+void LockProfile::unlocking(pthread_mutex_t *mutex)
 {
-    rwlock_index *index = &rwlock_table[hash_address(ptr, rwlock_indexing)];
-    rwlock_entry *entry, *empty = NULL;
+    if(composite) {
+        stalled = false;
+        pthread_mutex_unlock(mutex);
+        return;
+    }
 
-    if(!ptr)
-        return false;
+    uint64_t period = profile_clock() - held;
+
+    hold += period;
+    if(period > maxhold)
+        maxhold = period;
+    pthread_mutex_unlock(mutex);
+}
+
+uint64_t LockProfile::blocking(void)
+{
+    if(composite)
+        return 0;
+
+    uint64_t now = profile_clock();
+    uint64_t period = now - held;
+
+    hold += period;
+    if(period > maxhold)
+        maxhold = period;
+    return now;
+}
+
+void LockProfile::blocked(uint64_t start)
+{
+    if(composite)
+        return;
+
+    held = profile_clock();
+    ++waited;
+    idle += held - start;
+}
+
+uint64_t LockProfile::acquiring(void)
+{
+    return profile_clock();
+}
+
+void LockProfile::entered(uint64_t start, bool delayed, bool exclusive)
+{
+    uint64_t now = profile_clock();
+
+    ++acquired;
+    if(delayed || stalled) {
+        ++contended;
+        wait += now - start;
+        if(now - start > maxwait)
+            maxwait = now - start;
+    }
+    stalled = false;
+    if(exclusive)
+        held = now;
+}
+
+void LockProfile::leaving(void)
+{
+    uint64_t period = profile_clock() - held;
+
+    hold += period;
+    if(period > maxhold)
+        maxhold = period;
+}
+
+unsigned LockProfile::count(void)
+{
+    unsigned total = 0;
+
+    pthread_mutex_lock(&profile_lock);
+    LockProfile *node = profile_list;
+    while(node) {
+        ++total;
+        node = node->next;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return total;
+}
+
+unsigned LockProfile::snapshot(stats_t *list, unsigned max)
+{
+    unsigned total = 0;
+
+    pthread_mutex_lock(&profile_lock);
+    LockProfile *node = profile_list;
+    while(node && total < max) {
+        list[total].name = node->id;
+        list[total].lock = node;
+        list[total].acquired = node->acquired;
+        list[total].contended = node->contended;
+        list[total].waited = node->waited;
+        list[total].wait = node->wait;
+        list[total].maxwait = node->maxwait;
+        list[total].idle = node->idle;
+        list[total].hold = node->hold;
+        list[total].maxhold = node->maxhold;
+        ++total;
+        node = node->next;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return total;
+}
+
+void LockProfile::dump(FILE *fp)
+{
+    pthread_mutex_lock(&profile_lock);
+    LockProfile *node = profile_list;
+    while(node) {
+        if(node->acquired) {
+            if(node->id)
+                fprintf(fp, "%-24s", node->id);
+            else
+                fprintf(fp, "%-24p", (void *)node);
+            fprintf(fp, " acquired=%lu contended=%lu wait=%llu/%llu waited=%lu idle=%llu hold=%llu/%llu\n",
+                node->acquired, node->contended,
+                (unsigned long long)node->wait, (unsigned long long)node->maxwait,
+                node->waited, (unsigned long long)node->idle,
+                (unsigned long long)node->hold, (unsigned long long)node->maxhold);
+        }
+        node = node->next;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void LockProfile::reset(void)
+{
+    pthread_mutex_lock(&profile_lock);
+    LockProfile *node = profile_list;
+    while(node) {
+        node->acquired = node->contended = node->waited = 0;
+        node->wait = node->maxwait = node->idle = node->hold = node->maxhold = 0;
+        node = node->next;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+#else
+
+unsigned LockProfile::count(void)
+{
+    return 0;
+}
+
+unsigned LockProfile::snapshot(stats_t *, unsigned)
+{
+    return 0;
+}
+
+void LockProfile::dump(FILE *)
+{
+}
+
+void LockProfile::reset(void)
+{
+}
+
+#endif
+
+void Mutex::indexing(unsigned index)
+{
+    if(index > 1) {
+        mutex_table = new mutex_index[index];
+        mutex_indexing = index;
+    }
+}
+
+void ThreadLock::indexing(unsigned index)
+{
+    if(index > 1) {
+        rwlock_table = new rwlock_index[index];
+        rwlock_indexing = index;
+    }
+}
+
+void Mutex::striping(unsigned count)
+{
+    if(mutex_stripes)
+        return;
+
+    count = stripe_count(count);
+    mutex_stripe *table = (mutex_stripe *)stripe_alloc(sizeof(mutex_stripe), count);
+
+#if !defined(_MSWINDOWS_) && !defined(__PTH__)
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    for(unsigned pos = 0; pos < count; ++pos)
+        crit(pthread_mutex_init(&table[pos].mutex, &attr) == 0, "stripe init failed");
+    pthread_mutexattr_destroy(&attr);
+#else
+    // windows critical sections and pth mutexes are already recursive...
+    for(unsigned pos = 0; pos < count; ++pos)
+        pthread_mutex_init(&table[pos].mutex, NULL);
+#endif
+
+    mutex_striping = count;
+    mutex_stripes = table;
+}
+
+void ThreadLock::striping(unsigned count)
+{
+    if(rwlock_stripes)
+        return;
+
+    count = stripe_count(count);
+    rwlock_stripe *table = (rwlock_stripe *)stripe_alloc(sizeof(rwlock_stripe), count);
+
+    for(unsigned pos = 0; pos < count; ++pos)
+        init<rwlock_stripe>(&table[pos]);
+
+    rwlock_striping = count;
+    rwlock_stripes = table;
+}
+
+ThreadLock::guard_reader::guard_reader()
+{
+    object = NULL;
+}
+
+ThreadLock::guard_reader::guard_reader(const void *obj)
+{
+    object = obj;
+    if(obj)
+        if(!ThreadLock::reader(object))
+            object = NULL;
+}
+
+ThreadLock::guard_reader::~guard_reader()
+{
+    release();
+}
+
+void ThreadLock::guard_reader::set(const void *obj)
+{
+    release();
+    object = obj;
+    if(obj)
+        if(!ThreadLock::reader(object))
+            object = NULL;
+}
+
+void ThreadLock::guard_reader::release(void)
+{
+    if(object) {
+        ThreadLock::release(object);
+        object = NULL;
+    }
+}
+
+ThreadLock::guard_writer::guard_writer()
+{
+    object = NULL;
+}
+
+ThreadLock::guard_writer::guard_writer(const void *obj)
+{
+    object = obj;
+    if(obj)
+        if(!ThreadLock::writer(object))
+            object = NULL;
+}
+
+ThreadLock::guard_writer::~guard_writer()
+{
+    release();
+}
+
+void ThreadLock::guard_writer::set(const void *obj)
+{
+    release();
+    object = obj;
+    if(obj)
+        if(!ThreadLock::writer(object))
+            object = NULL;
+}
+
+void ThreadLock::guard_writer::release(void)
+{
+    if(object) {
+        ThreadLock::release(object);
+        object = NULL;
+    }
+}
+
+bool ThreadLock::reader(const void *ptr, timeout_t timeout)
+{
+    rwlock_index *index = &rwlock_table[hash_address(ptr, rwlock_indexing)];
+    rwlock_entry *entry, *empty = NULL;
+
+    if(!ptr)
+        return false;
+
+    if(rwlock_stripes)
+        return rwlock_stripes[hash_stripe(ptr, rwlock_striping - 1)].access(timeout);
+
+    index->acquire();
+    entry = index->list;
+    while(entry) {
+        if(entry->count && entry->object == ptr)
+            break;
+        if(!entry->count)
+            empty = entry;
+        entry = entry->next;
+    }
+    if(!entry) {
+        if(empty)
+            entry = empty;
+        else {
+            entry = new rwlock_entry;
+            entry->next = index->list;
+            index->list = entry;
+        }
+    }
+    entry->object = ptr;
+    ++entry->count;
+    index->release();
+    if(entry->access(timeout))
+        return true;
+    index->acquire();
+    --entry->count;
+    index->release();
+    return false;
+}
+
+bool ThreadLock::writer(const void *ptr, timeout_t timeout)
+{
+    rwlock_index *index = &rwlock_table[hash_address(ptr, rwlock_indexing)];
+    rwlock_entry *entry, *empty = NULL;
+
+    if(!ptr)
+        return false;
+
+    if(rwlock_stripes)
+        return rwlock_stripes[hash_stripe(ptr, rwlock_striping - 1)].modify(timeout);
 
     index->acquire();
     entry = index->list;
@@ -1168,6 +1854,11 @@ void Mutex::protect(const void *ptr)
     if(!ptr)
         return;
 
+    if(mutex_stripes) {
+        pthread_mutex_lock(&mutex_stripes[hash_stripe(ptr, mutex_striping - 1)].mutex);
+        return;
+    }
+
     index->acquire();
     entry = index->list;
     while(entry) {
@@ -1203,6 +1894,11 @@ void ThreadLock::release(const void *ptr)
     if(!ptr)
         return;
 
+    if(rwlock_stripes) {
+        rwlock_stripes[hash_stripe(ptr, rwlock_striping - 1)].release();
+        return;
+    }
+
     index->acquire();
     entry = index->list;
     while(entry) {
@@ -1227,6 +1923,11 @@ void Mutex::release(const void *ptr)
     if(!ptr)
         return;
 
+    if(mutex_stripes) {
+        pthread_mutex_unlock(&mutex_stripes[hash_stripe(ptr, mutex_striping - 1)].mutex);
+        return;
+    }
+
     index->acquire();
     entry = index->list;
     while(entry) {
@@ -1246,12 +1947,12 @@ void Mutex::release(const void *ptr)
 
 void Mutex::_lock(void)
 {
-    pthread_mutex_lock(&mlock);
+    lock();
 }
 
 void Mutex::_unlock(void)
 {
-    pthread_mutex_unlock(&mlock);
+    unlock();
 }
 
 #ifdef  _MSWINDOWS_
@@ -1465,6 +2166,7 @@ ConditionalLock::ConditionalLock() :
 ConditionalAccess()
 {
     contexts = NULL;
+    compose();
 }
 
 ConditionalLock::~ConditionalLock()
@@ -1511,6 +2213,8 @@ void ConditionalLock::_unlock(void)
 void ConditionalLock::modify(void)
 {
     Context *context;
+    bool delayed = false;
+    uint64_t start = acquiring();
 
     lock();
     context = getContext();
@@ -1519,17 +2223,20 @@ void ConditionalLock::modify(void)
 
     sharing -= context->count;
     while(sharing) {
+        delayed = true;
         ++pending;
         waitSignal();
         --pending;
     }
     ++context->count;
+    entered(start, delayed);
 }
 
 void ConditionalLock::commit(void)
 {
     Context *context = getContext();
     --context->count;
+    leaving();
 
     if(context->count) {
         sharing += context->count;
@@ -1558,6 +2265,9 @@ void ConditionalLock::release(void)
 void ConditionalLock::access(void)
 {
     Context *context;
+    bool delayed = false;
+    uint64_t start = acquiring();
+
     lock();
     context = getContext();
     assert(context && (!max_sharing || sharing < max_sharing));
@@ -1568,10 +2278,12 @@ void ConditionalLock::access(void)
     ++context->count;
 
     while(context->count < 2 && pending) {
+        delayed = true;
         ++waiting;
         waitBroadcast();
         --waiting;
     }
+    entered(start, delayed, false);
     ++sharing;
     unlock();
 }
@@ -1579,22 +2291,27 @@ void ConditionalLock::access(void)
 void ConditionalLock::exclusive(void)
 {
     Context *context;
+    bool delayed = false;
+    uint64_t start = acquiring();
 
     lock();
     context = getContext();
     assert(sharing && context && context->count > 0);
     sharing -= context->count;
     while(sharing) {
+        delayed = true;
         ++pending;
         waitSignal();
         --pending;
     }
+    entered(start, delayed);
 }
 
 void ConditionalLock::share(void)
 {
     Context *context = getContext();
     assert(!sharing && context && context->count);
+    leaving();
     sharing += context->count;
     unlock();
 }
@@ -1750,54 +2467,415 @@ SharedObject::~SharedObject()
 {
 }
 
-SharedPointer::SharedPointer() :
-ConditionalAccess()
+SequenceLock::SequenceLock() :
+sequence(0)
 {
-    pointer = NULL;
 }
 
-SharedPointer::~SharedPointer()
+void SequenceLock::read(void *target, const void *source, size_t size)
 {
+    unsigned spins = 0;
+    long seq;
+
+    for(;;) {
+        seq = sequence.load(atomic::ACQUIRE);
+        if(seq & 1) {
+            atomic::backoff(spins);
+            continue;
+        }
+        memcpy(target, source, size);
+        atomic::fence(atomic::ACQUIRE);
+        if(sequence.load(atomic::RELAXED) == seq)
+            return;
+    }
 }
 
-void SharedPointer::replace(SharedObject *ptr)
+void SequenceLock::modify(void)
 {
-    modify();
-
-    if(pointer)
-        delete pointer;
-    pointer = ptr;
-    if(ptr)
-        ptr->commit(this);
-
-    commit();
+    writer.acquire();
+    sequence.store(sequence.load(atomic::RELAXED) + 1, atomic::RELAXED);
+    atomic::fence(atomic::RELEASE);
 }
 
-SharedObject *SharedPointer::share(void)
+void SequenceLock::commit(void)
 {
-    access();
-    return pointer;
+    sequence.store(sequence.load(atomic::RELAXED) + 1, atomic::RELEASE);
+    writer.release();
 }
 
-Thread::Thread(size_t size)
+void SequenceLock::write(void *target, const void *source, size_t size)
 {
-    stack = size;
-    priority = 0;
-#ifdef  _MSWINDOWS_
-    cancellor = INVALID_HANDLE_VALUE;
-#else
-    cancellor = NULL;
-#endif
-    init();
+    modify();
+    memcpy(target, source, size);
+    commit();
 }
 
-#if defined(_MSWINDOWS_)
+// active flag must be first, as the key destructor only sees a void *...
+class __LOCAL EpochDomain::record
+{
+public:
+    volatile bool active;
+    record *next;
+    unsigned nesting;
+    atomic::counter state;
+};
 
-void Thread::setPriority(void)
+class __LOCAL EpochDomain::retired
 {
-    HANDLE hThread = GetCurrentThread();
-    priority += THREAD_PRIORITY_NORMAL;
-    if(priority < THREAD_PRIORITY_LOWEST)
+public:
+    retired *next;
+    void *object;
+    release_t release;
+};
+
+extern "C" {
+
+    static void epoch_release(void *obj)
+    {
+        // record remains listed in the domain, mark for re-use...
+        if(obj)
+            ((volatile bool *)obj)[0] = false;
+    }
+}
+
+EpochDomain::EpochDomain(unsigned limit) :
+epoch(0)
+{
+    records = NULL;
+    limbo[0] = limbo[1] = limbo[2] = NULL;
+    threshold = limit ? limit : 1;
+    retires = count = 0;
+
+#if defined(__PTH__)
+    Thread::init();
+    pth_key_create(&key, &epoch_release);
+#elif defined(_MSWINDOWS_)
+    // no thread exit hook, so records are kept until the domain is deleted...
+    key = TlsAlloc();
+#else
+    crit(pthread_key_create(&key, &epoch_release) == 0, "epoch key failed");
+#endif
+}
+
+EpochDomain::~EpochDomain()
+{
+    record *next;
+
+#if defined(__PTH__)
+    pth_key_delete(key);
+#elif defined(_MSWINDOWS_)
+    TlsFree(key);
+#else
+    pthread_key_delete(key);
+#endif
+
+    for(unsigned pos = 0; pos < 3; ++pos)
+        release(limbo[pos]);
+
+    while(records) {
+        next = records->next;
+        ::free(records);
+        records = next;
+    }
+}
+
+EpochDomain::record *EpochDomain::attach(void)
+{
+    record *rp;
+
+    lock.acquire();
+    rp = records;
+    while(rp) {
+        if(!rp->active)
+            break;
+        rp = rp->next;
+    }
+    if(!rp) {
+        rp = (record *)::malloc(sizeof(record));
+        crit(rp != NULL, "epoch record failed");
+        rp->next = records;
+        records = rp;
+    }
+    rp->nesting = 0;
+    rp->state.store(0);
+    rp->active = true;
+    lock.release();
+
+#if defined(__PTH__)
+    pth_key_setdata(key, rp);
+#elif defined(_MSWINDOWS_)
+    TlsSetValue(key, rp);
+#else
+    pthread_setspecific(key, rp);
+#endif
+    return rp;
+}
+
+EpochDomain::record *EpochDomain::current(void)
+{
+    record *rp;
+
+#if defined(__PTH__)
+    rp = (record *)pth_key_getdata(key);
+#elif defined(_MSWINDOWS_)
+    rp = (record *)TlsGetValue(key);
+#else
+    rp = (record *)pthread_getspecific(key);
+#endif
+
+    if(!rp)
+        rp = attach();
+    return rp;
+}
+
+void EpochDomain::enter(void)
+{
+    record *rp = current();
+
+    if(rp->nesting++)
+        return;
+
+    // announce the epoch we entered in before reading anything shared...
+    rp->state.store((epoch.load(atomic::ACQUIRE) << 1) | 1, atomic::RELAXED);
+    atomic::fence();
+}
+
+void EpochDomain::leave(void)
+{
+    record *rp = current();
+
+    assert(rp->nesting > 0);
+    if(--rp->nesting)
+        return;
+
+    rp->state.store(0, atomic::RELEASE);
+}
+
+// must be called locked; the epoch only advances when every thread inside
+// the domain has seen the current one, and the list retired two epochs
+// ago is then handed back to be released...
+EpochDomain::retired *EpochDomain::advance(void)
+{
+    long current = epoch.load(atomic::RELAXED);
+    record *rp = records;
+    retired *list;
+    long state;
+
+    atomic::fence();
+    while(rp) {
+        if(rp->active) {
+            state = rp->state.load(atomic::RELAXED);
+            if((state & 1) && (state >> 1) != current)
+                return NULL;
+        }
+        rp = rp->next;
+    }
+    atomic::fence(atomic::ACQUIRE);
+
+    ++current;
+    epoch.store(current);
+    list = limbo[(current + 1) % 3];
+    limbo[(current + 1) % 3] = NULL;
+    return list;
+}
+
+void EpochDomain::release(retired *list)
+{
+    retired *next;
+
+    while(list) {
+        next = list->next;
+        list->release(list->object);
+        delete list;
+        list = next;
+    }
+}
+
+void EpochDomain::retire(void *object, release_t release)
+{
+    retired *node = new retired;
+    retired *list = NULL;
+    unsigned freed = 0;
+
+    node->object = object;
+    node->release = release;
+
+    lock.acquire();
+    long current = epoch.load();
+    node->next = limbo[current % 3];
+    limbo[current % 3] = node;
+    ++count;
+    if(++retires >= threshold) {
+        retires = 0;
+        list = advance();
+        for(retired *rp = list; rp; rp = rp->next)
+            ++freed;
+        count -= freed;
+    }
+    lock.release();
+
+    // release outside the lock, as a release may retire other nodes...
+    EpochDomain::release(list);
+}
+
+bool EpochDomain::reclaim(void)
+{
+    retired *list;
+    long prior;
+    unsigned freed = 0;
+
+    lock.acquire();
+    prior = epoch.load(atomic::RELAXED);
+    list = advance();
+    for(retired *rp = list; rp; rp = rp->next)
+        ++freed;
+    count -= freed;
+    bool result = (epoch.load(atomic::RELAXED) != prior);
+    lock.release();
+
+    release(list);
+    return result;
+}
+
+void EpochDomain::synchronize(void)
+{
+    unsigned spins = 0;
+    unsigned advances = 0;
+
+    // nodes retired in the current epoch are free after two advances...
+    while(advances < 2) {
+        if(reclaim()) {
+            ++advances;
+            spins = 0;
+        }
+        else
+            atomic::backoff(spins);
+    }
+}
+
+unsigned EpochDomain::pending(void)
+{
+    unsigned result;
+
+    lock.acquire();
+    result = count;
+    lock.release();
+    return result;
+}
+
+unsigned EpochDomain::threads(void)
+{
+    unsigned total = 0;
+    record *rp;
+
+    lock.acquire();
+    rp = records;
+    while(rp) {
+        ++total;
+        rp = rp->next;
+    }
+    lock.release();
+    return total;
+}
+
+EpochDomain::guard::guard(EpochDomain *dp)
+{
+    domain = dp;
+    domain->enter();
+}
+
+EpochDomain::guard::~guard()
+{
+    release();
+}
+
+void EpochDomain::guard::release(void)
+{
+    if(domain) {
+        domain->leave();
+        domain = NULL;
+    }
+}
+
+RCUPointer::RCUPointer(EpochDomain *dp, EpochDomain::release_t rp) :
+pointer(NULL)
+{
+    domain = dp;
+    release = rp;
+}
+
+RCUPointer::~RCUPointer()
+{
+    void *object = pointer.exchange(NULL);
+
+    if(object)
+        domain->retire(object, release);
+}
+
+void RCUPointer::replace(void *object)
+{
+    void *prior = pointer.exchange(object);
+
+    if(prior)
+        domain->retire(prior, release);
+}
+
+void *RCUPointer::get(void)
+{
+    return pointer.load(atomic::ACQUIRE);
+}
+
+SharedPointer::SharedPointer() :
+ConditionalAccess()
+{
+    pointer = NULL;
+}
+
+SharedPointer::~SharedPointer()
+{
+}
+
+void SharedPointer::replace(SharedObject *ptr)
+{
+    modify();
+
+    if(pointer)
+        delete pointer;
+    pointer = ptr;
+    if(ptr)
+        ptr->commit(this);
+
+    commit();
+}
+
+SharedObject *SharedPointer::share(void)
+{
+    access();
+    return pointer;
+}
+
+Thread::Thread(size_t size)
+{
+    stack = size;
+    priority = 0;
+    node = -1;
+    cpumask = NULL;
+    placed = false;
+#ifdef  _MSWINDOWS_
+    cancellor = INVALID_HANDLE_VALUE;
+#else
+    cancellor = NULL;
+#endif
+    init();
+}
+
+#if defined(_MSWINDOWS_)
+
+void Thread::setPriority(void)
+{
+    HANDLE hThread = GetCurrentThread();
+    priority += THREAD_PRIORITY_NORMAL;
+    if(priority < THREAD_PRIORITY_LOWEST)
         priority = THREAD_PRIORITY_LOWEST;
     else if(priority > THREAD_PRIORITY_HIGHEST)
         priority = THREAD_PRIORITY_HIGHEST;
@@ -1851,6 +2929,298 @@ void Thread::concurrency(int level)
 #endif
 }
 
+unsigned Thread::cpus(void)
+{
+#if defined(_MSWINDOWS_)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if(info.dwNumberOfProcessors > 0)
+        return (unsigned)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if(count > 0)
+        return (unsigned)count;
+#endif
+    return 1;
+}
+
+bool Thread::affinity(unsigned cpu)
+{
+#if defined(_MSWINDOWS_)
+    if(cpu >= sizeof(DWORD_PTR) * 8)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << cpu) != 0;
+#elif defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET) && !defined(__PTH__)
+    cpu_set_t mask;
+
+    if(cpu >= CPU_SETSIZE)
+        return false;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+    return false;
+#endif
+}
+
+bool Thread::affinity(const cpuset& set)
+{
+#if defined(_MSWINDOWS_)
+    DWORD_PTR mask = 0;
+    for(unsigned cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu) {
+        if(set.has(cpu))
+            mask |= ((DWORD_PTR)1) << cpu;
+    }
+    if(!mask)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET) && !defined(__PTH__)
+    cpu_set_t mask;
+    unsigned count = 0;
+
+    CPU_ZERO(&mask);
+    for(unsigned cpu = 0; cpu < cpuset::size() && cpu < CPU_SETSIZE; ++cpu) {
+        if(set.has(cpu)) {
+            CPU_SET(cpu, &mask);
+            ++count;
+        }
+    }
+    if(!count)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+    return false;
+#endif
+}
+
+bool Thread::allowed(cpuset& set)
+{
+    set.clear();
+#if defined(_MSWINDOWS_)
+    DWORD_PTR mask = 0, system = 0;
+    if(!GetProcessAffinityMask(GetCurrentProcess(), &mask, &system))
+        return false;
+    for(unsigned cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu) {
+        if(mask & (((DWORD_PTR)1) << cpu))
+            set.add(cpu);
+    }
+    return !!set;
+#elif defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(CPU_SET) && !defined(__PTH__)
+    cpu_set_t mask;
+
+    CPU_ZERO(&mask);
+    if(pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask))
+        return false;
+    for(unsigned cpu = 0; cpu < cpuset::size() && cpu < CPU_SETSIZE; ++cpu) {
+        if(CPU_ISSET(cpu, &mask))
+            set.add(cpu);
+    }
+    return !!set;
+#else
+    return false;
+#endif
+}
+
+bool Thread::prefer(int id)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy) && !defined(__PTH__)
+    unsigned long mask[cpuset::size() / (sizeof(unsigned long) * 8)];
+    const unsigned bits = sizeof(unsigned long) * 8;
+
+    if(id < 0)
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) == 0;
+
+    if((unsigned)id >= cpuset::size())
+        return false;
+
+    memset(mask, 0, sizeof(mask));
+    mask[id / bits] = 1ul << (id % bits);
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1) == 0;
+#else
+    return false;
+#endif
+}
+
+// small sysfs values are read as a single line...
+static bool sysfs(char *buf, size_t size, const char *format, unsigned id)
+{
+#ifdef  __linux__
+    char path[96];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), format, id);
+    fp = fopen(path, "r");
+    if(!fp)
+        return false;
+
+    buf[0] = 0;
+    if(!fgets(buf, (int)size, fp))
+        buf[0] = 0;
+    fclose(fp);
+    return buf[0] != 0;
+#else
+    return false;
+#endif
+}
+
+unsigned Thread::nodes(void)
+{
+    char buf[256];
+    cpuset set;
+    unsigned count = 0;
+
+    if(!sysfs(buf, sizeof(buf), "/sys/devices/system/node/possible", 0) || !set.parse(buf))
+        return 1;
+
+    // nodes are numbered, so the highest one present sets the count...
+    for(unsigned id = 0; id < cpuset::size(); ++id) {
+        if(set.has(id))
+            count = id + 1;
+    }
+    return count ? count : 1;
+}
+
+bool Thread::nodeset(unsigned id, cpuset& set)
+{
+    char buf[1024];
+
+    set.clear();
+    if(!sysfs(buf, sizeof(buf), "/sys/devices/system/node/node%u/cpulist", id))
+        return false;
+
+    return set.parse(buf);
+}
+
+bool Thread::topology(unsigned cpu, topology_t& info)
+{
+    char buf[1024];
+    unsigned count;
+    cpuset set;
+
+    info.core = info.package = info.node = -1;
+    info.siblings.clear();
+
+    if(!sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/topology/core_id", cpu))
+        return false;
+    info.core = atoi(buf);
+
+    if(sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu))
+        info.package = atoi(buf);
+
+    if(sysfs(buf, sizeof(buf), "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", cpu))
+        info.siblings.parse(buf);
+    else
+        info.siblings.add(cpu);
+
+    // without numa in the kernel everything is on node 0...
+    count = nodes();
+    for(unsigned id = 0; id < count; ++id) {
+        if(nodeset(id, set) && set.has(cpu)) {
+            info.node = (int)id;
+            break;
+        }
+    }
+    if(info.node < 0)
+        info.node = 0;
+    return true;
+}
+
+void Thread::pin(const cpuset& set)
+{
+    if(!cpumask)
+        cpumask = new cpuset;
+    *cpumask = set;
+}
+
+void Thread::place(int id)
+{
+    node = id;
+}
+
+void Thread::setPlacement(void)
+{
+    placed = true;
+    if(cpumask)
+        placed = affinity(*cpumask);
+    else if(node >= 0) {
+        cpuset set;
+        placed = nodeset((unsigned)node, set) && affinity(set);
+    }
+
+    // first touch of the stack and arenas happens after this...
+    if(node >= 0)
+        prefer(node);
+}
+
+Thread::cpuset::cpuset()
+{
+    clear();
+}
+
+void Thread::cpuset::clear(void)
+{
+    memset(bits, 0, sizeof(bits));
+}
+
+void Thread::cpuset::add(unsigned cpu)
+{
+    if(cpu < LIMIT)
+        bits[cpu / WORD] |= 1ul << (cpu % WORD);
+}
+
+void Thread::cpuset::remove(unsigned cpu)
+{
+    if(cpu < LIMIT)
+        bits[cpu / WORD] &= ~(1ul << (cpu % WORD));
+}
+
+bool Thread::cpuset::has(unsigned cpu) const
+{
+    if(cpu >= LIMIT)
+        return false;
+
+    return (bits[cpu / WORD] & (1ul << (cpu % WORD))) != 0;
+}
+
+unsigned Thread::cpuset::count(void) const
+{
+    unsigned total = 0;
+
+    for(unsigned cpu = 0; cpu < LIMIT; ++cpu) {
+        if(has(cpu))
+            ++total;
+    }
+    return total;
+}
+
+bool Thread::cpuset::parse(const char *list)
+{
+    char *ep;
+    unsigned long first, last;
+
+    while(list && *list) {
+        while(*list == ' ' || *list == ',')
+            ++list;
+        if(!*list || *list == '\n')
+            break;
+
+        first = strtoul(list, &ep, 10);
+        if(ep == list)
+            return false;
+        last = first;
+        list = ep;
+        if(*list == '-') {
+            last = strtoul(++list, &ep, 10);
+            if(ep == list || last < first)
+                return false;
+            list = ep;
+        }
+        while(first <= last && first < LIMIT)
+            add((unsigned)first++);
+    }
+    return true;
+}
+
 void Thread::policy(int polid)
 {
 #if _POSIX_PRIORITY_SCHEDULING > 0
@@ -1927,6 +3297,8 @@ void DetachedThread::exit(void)
 
 Thread::~Thread()
 {
+    if(cpumask)
+        delete cpumask;
 }
 
 JoinableThread::~JoinableThread()
@@ -1944,6 +3316,7 @@ extern "C" {
         assert(obj != NULL);
 
         Thread *th = static_cast<Thread *>(obj);
+        th->setPlacement();
         th->setPriority();
         th->run();
         th->exit();
@@ -1955,6 +3328,7 @@ extern "C" {
         assert(obj != NULL);
 
         Thread *th = static_cast<Thread *>(obj);
+        th->setPlacement();
         th->setPriority();
         th->run();
         th->exit();
@@ -2260,3 +3634,422 @@ pthread_t Thread::self(void)
 #endif
 
 
+
+// per-worker deque size; overflow goes to the shared pool list...
+#define POOL_DEQUE  256
+
+class __LOCAL ThreadPool::worker : public JoinableThread
+{
+private:
+    atomic::spinlock guard;
+    ThreadPool::task *deque[POOL_DEQUE];
+    unsigned top, bottom;
+
+public:
+    ThreadPool *pool;
+    unsigned id;
+    int cpu;
+
+    worker(ThreadPool *tp, unsigned index, int pin, size_t stack);
+    ~worker();
+
+    inline void stop(void)
+        {join();};
+
+    bool push(ThreadPool::task *job);
+    ThreadPool::task *pop(void);
+    ThreadPool::task *steal(void);
+    bool empty(void);
+
+    void run(void);
+};
+
+class __LOCAL parallel_state
+{
+public:
+    ThreadPool::loop *body;
+    atomic::counter next;
+    size_t last, grain;
+
+    void run(void);
+};
+
+class __LOCAL parallel_task : public ThreadPool::task
+{
+public:
+    parallel_state *state;
+
+    void run(void);
+};
+
+ThreadPool::worker::worker(ThreadPool *tp, unsigned index, int pin, size_t stack) :
+JoinableThread(stack)
+{
+    pool = tp;
+    id = index;
+    cpu = pin;
+    top = bottom = 0;
+}
+
+ThreadPool::worker::~worker()
+{
+    join();
+}
+
+bool ThreadPool::worker::push(ThreadPool::task *job)
+{
+    bool rtn = false;
+
+    guard.lock();
+    if(bottom - top < POOL_DEQUE) {
+        deque[bottom++ % POOL_DEQUE] = job;
+        rtn = true;
+    }
+    guard.release();
+    return rtn;
+}
+
+ThreadPool::task *ThreadPool::worker::pop(void)
+{
+    ThreadPool::task *job = NULL;
+
+    // owner takes newest work, which is most likely still in cache...
+    guard.lock();
+    if(bottom != top)
+        job = deque[--bottom % POOL_DEQUE];
+    guard.release();
+    return job;
+}
+
+ThreadPool::task *ThreadPool::worker::steal(void)
+{
+    ThreadPool::task *job = NULL;
+
+    // thieves take the oldest work from the other end...
+    guard.lock();
+    if(bottom != top)
+        job = deque[top++ % POOL_DEQUE];
+    guard.release();
+    return job;
+}
+
+bool ThreadPool::worker::empty(void)
+{
+    bool rtn;
+
+    guard.lock();
+    rtn = (bottom == top);
+    guard.release();
+    return rtn;
+}
+
+void ThreadPool::worker::run(void)
+{
+    map();
+    if(cpu >= 0)
+        Thread::affinity((unsigned)cpu);
+
+    for(;;) {
+        if(pool->execute(this))
+            continue;
+
+        if(pool->stopping && !pool->available())
+            return;
+
+        pool->idle(this);
+    }
+}
+
+void parallel_state::run(void)
+{
+    size_t first, end;
+
+    for(;;) {
+        first = (size_t)next.fetch_add((long)grain);
+        if(first >= last)
+            return;
+        end = first + grain;
+        if(end > last)
+            end = last;
+        body->run(first, end);
+    }
+}
+
+void parallel_task::run(void)
+{
+    state->run();
+}
+
+ThreadPool::task::task() :
+pending(0)
+{
+    pool = NULL;
+    next = NULL;
+}
+
+ThreadPool::task::~task()
+{
+    assert(is_done());
+}
+
+bool ThreadPool::task::wait(timeout_t timeout)
+{
+    struct timespec ts;
+    bool rtn = true;
+
+    if(is_done())
+        return true;
+
+    ThreadPool *tp = pool;
+    ThreadPool::worker *self = tp->current();
+
+    // a worker must keep running tasks, the one we wait on may be ours...
+    if(self) {
+        Timer expires;
+        if(timeout != Timer::inf)
+            expires.set(timeout);
+        while(!is_done()) {
+            if(timeout != Timer::inf && !expires.get())
+                return false;
+            if(!tp->execute(self))
+                Thread::yield();
+        }
+        return true;
+    }
+
+    if(!timeout)
+        return false;
+
+    if(timeout != Timer::inf)
+        Conditional::set(&ts, timeout);
+
+    tp->lock();
+    ++tp->sleepers;
+    while(!is_done() && rtn) {
+        if(timeout == Timer::inf)
+            tp->wait();
+        else
+            rtn = tp->wait(&ts);
+    }
+    --tp->sleepers;
+    rtn = is_done();
+    tp->unlock();
+    return rtn;
+}
+
+ThreadPool::loop::~loop()
+{
+}
+
+ThreadPool::ThreadPool(unsigned size, bool pinned, size_t stack) :
+Conditional(), rotor(0), sleepers(0)
+{
+    Thread::init();
+
+    if(!size)
+        size = Thread::cpus();
+
+    count = size;
+    overflow = last = NULL;
+    stopping = false;
+    workers = new worker*[count];
+
+    // cpu ids need not be contiguous, so pin to those we may run on...
+    Thread::cpuset allowed;
+    unsigned cpus = 0;
+    if(pinned && Thread::allowed(allowed))
+        cpus = allowed.count();
+
+    for(unsigned pos = 0; pos < count; ++pos) {
+        int cpu = -1;
+        if(cpus) {
+            unsigned skip = pos % cpus;
+            for(cpu = 0; !allowed.has(cpu) || skip--; ++cpu)
+                ;
+        }
+        else if(pinned)
+            cpu = (int)(pos % Thread::cpus());
+        workers[pos] = new worker(this, pos, cpu, stack);
+    }
+
+    for(unsigned pos = 0; pos < count; ++pos)
+        workers[pos]->start();
+}
+
+ThreadPool::~ThreadPool()
+{
+    lock();
+    stopping = true;
+    broadcast();
+    unlock();
+
+    // workers steal from each other, so all must exit before any is freed...
+    for(unsigned pos = 0; pos < count; ++pos)
+        workers[pos]->stop();
+
+    for(unsigned pos = 0; pos < count; ++pos)
+        delete workers[pos];
+
+    delete[] workers;
+}
+
+ThreadPool::worker *ThreadPool::current(void)
+{
+    Thread *thread = Thread::get();
+
+    for(unsigned pos = 0; thread && pos < count; ++pos) {
+        if(workers[pos] == thread)
+            return workers[pos];
+    }
+    return NULL;
+}
+
+void ThreadPool::wake(void)
+{
+    // pairs with idle workers counting themselves before a final check...
+    atomic::fence();
+    if(sleepers.load(atomic::RELAXED)) {
+        lock();
+        broadcast();
+        unlock();
+    }
+}
+
+void ThreadPool::submit(task *job)
+{
+    assert(job != NULL && job->is_done());
+
+    worker *self = current();
+
+    job->pool = this;
+    job->next = NULL;
+    job->pending.store(1);
+
+    if(!self)
+        self = workers[(unsigned long)rotor.fetch_add(1, atomic::RELAXED) % count];
+
+    if(!self->push(job)) {
+        lock();
+        if(last)
+            last->next = job;
+        else
+            overflow = job;
+        last = job;
+        unlock();
+    }
+    wake();
+}
+
+ThreadPool::task *ThreadPool::take(worker *self)
+{
+    task *job = NULL;
+
+    if(self)
+        job = self->pop();
+
+    for(unsigned pos = 1; !job && pos <= count; ++pos) {
+        unsigned victim = (self ? self->id + pos : pos) % count;
+        if(workers[victim] != self)
+            job = workers[victim]->steal();
+    }
+
+    if(!job && overflow) {
+        lock();
+        job = overflow;
+        if(job) {
+            overflow = job->next;
+            if(!overflow)
+                last = NULL;
+        }
+        unlock();
+    }
+    return job;
+}
+
+bool ThreadPool::available(void)
+{
+    if(overflow)
+        return true;
+
+    for(unsigned pos = 0; pos < count; ++pos) {
+        if(!workers[pos]->empty())
+            return true;
+    }
+    return false;
+}
+
+void ThreadPool::complete(task *job)
+{
+    // once pending is cleared, the waiter may delete the task...
+    job->pending.store(0);
+    atomic::fence();
+    if(sleepers.load(atomic::RELAXED)) {
+        lock();
+        broadcast();
+        unlock();
+    }
+}
+
+bool ThreadPool::execute(worker *self)
+{
+    task *job = take(self);
+
+    if(!job)
+        return false;
+
+    job->run();
+    complete(job);
+    return true;
+}
+
+void ThreadPool::idle(worker *)
+{
+    lock();
+    ++sleepers;
+    while(!stopping && !available())
+        Conditional::wait();
+    --sleepers;
+    unlock();
+}
+
+void ThreadPool::parallel(loop& body, size_t first, size_t end, size_t grain)
+{
+    parallel_state state;
+    unsigned helpers;
+
+    if(end <= first)
+        return;
+
+    if(!grain)
+        grain = (end - first) / (count * 4);
+    if(!grain)
+        grain = 1;
+
+    size_t chunks = (end - first + grain - 1) / grain;
+    helpers = count;
+    if(chunks - 1 < helpers)
+        helpers = (unsigned)(chunks - 1);
+
+    state.body = &body;
+    state.next.store((long)first);
+    state.last = end;
+    state.grain = grain;
+
+    parallel_task *tasks = NULL;
+    if(helpers) {
+        tasks = new parallel_task[helpers];
+        for(unsigned pos = 0; pos < helpers; ++pos) {
+            tasks[pos].state = &state;
+            submit(&tasks[pos]);
+        }
+    }
+
+    // the caller claims chunks too, so the loop completes even if every
+    // worker is busy...
+    state.run();
+
+    for(unsigned pos = 0; pos < helpers; ++pos)
+        tasks[pos].wait();
+
+    delete[] tasks;
+}
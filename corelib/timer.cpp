@@ -106,15 +106,26 @@ const timeout_t Timer::inf = ((timeout_t)(-1));
 const time_t Timer::reset = ((time_t)0);
 #endif
 
+// wheel level of an event that is waiting to be dispatched...
+#define WHEEL_DUE   5
+
 TimerQueue::event::event(timeout_t timeout) :
 Timer(), LinkedList()
 {
+    wnext = NULL;
+    wlink = NULL;
+    due = 0;
+    level = 0;
     set(timeout);
 }
 
 TimerQueue::event::event(TimerQueue *tq, timeout_t timeout) :
 Timer(), LinkedList()
 {
+    wnext = NULL;
+    wlink = NULL;
+    due = 0;
+    level = 0;
     set(timeout);
     Timer::update();
     attach(tq);
@@ -194,6 +205,7 @@ void TimerQueue::event::attach(TimerQueue *tq)
     tq->modify();
     enlist(tq);
     Timer::update();
+    tq->schedule(this);
     tq->update();
 }
 
@@ -203,8 +215,10 @@ void TimerQueue::event::arm(timeout_t timeout)
     if(tq)
         tq->modify();
     set(timeout);
-    if(tq)
+    if(tq) {
+        tq->schedule(this);
         tq->update();
+    }
 }
 
 void TimerQueue::event::disarm(void)
@@ -215,8 +229,10 @@ void TimerQueue::event::disarm(void)
     if(tq && flag)
         tq->modify();
     clear();
-    if(tq && flag)
+    if(tq && flag) {
+        tq->unlink(this);
         tq->update();
+    }
 }
 
 void TimerQueue::event::update(void)
@@ -224,6 +240,7 @@ void TimerQueue::event::update(void)
     TimerQueue *tq = list();
     if(Timer::update() && tq) {
         tq->modify();
+        tq->schedule(this);
         tq->update();
     }
 }
@@ -234,6 +251,7 @@ void TimerQueue::event::detach(void)
     if(tq) {
         tq->modify();
         clear();
+        tq->unlink(this);
         delist();
         tq->update();
     }
@@ -469,28 +487,258 @@ timeout_t TQEvent::timeout(void)
     return timeout;
 }
 
+// the wheel runs from a monotonic clock where there is one, so that it
+// never steps back when the wall clock is changed...
+static Timer::tick_t wheel_clock(void)
+{
+#if _POSIX_TIMERS > 0 && defined(_POSIX_MONOTONIC_CLOCK) && defined(HAVE_CLOCK_GETTIME)
+    struct timespec current;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+    return (Timer::tick_t)current.tv_sec * 1000 + current.tv_nsec / 1000000l;
+#elif _POSIX_TIMERS > 0 && defined(POSIX_TIMERS)
+    struct timespec current;
+    clock_gettime(_posix_clocking, &current);
+    return (Timer::tick_t)current.tv_sec * 1000 + current.tv_nsec / 1000000l;
+#else
+    struct timeval current;
+    gettimeofday(&current, NULL);
+    return (Timer::tick_t)current.tv_sec * 1000 + current.tv_usec / 1000l;
+#endif
+}
+
 TimerQueue::TimerQueue() : OrderedIndex()
 {
+    memset(root, 0, sizeof(root));
+    memset(wheel, 0, sizeof(wheel));
+    memset(counts, 0, sizeof(counts));
+    due = NULL;
+    resolution = 1;
+    epoch = wheel_clock();
+    clock = 0;
+}
+
+TimerQueue::TimerQueue(timeout_t res) : OrderedIndex()
+{
+    memset(root, 0, sizeof(root));
+    memset(wheel, 0, sizeof(wheel));
+    memset(counts, 0, sizeof(counts));
+    due = NULL;
+    resolution = res ? res : 1;
+    epoch = wheel_clock();
+    clock = 0;
 }
 
 TimerQueue::~TimerQueue()
 {
 }
 
-timeout_t TimerQueue::expire(void)
+unsigned long TimerQueue::now(void)
 {
-    timeout_t first = Timer::inf, next;
-    linked_pointer<TimerQueue::event> timer = begin();
-    TimerQueue::event *tp;
+    return (unsigned long)(wheel_clock() - epoch);
+}
+
+void TimerQueue::link(event *timer, event **slot, unsigned level)
+{
+    timer->wnext = *slot;
+    if(timer->wnext)
+        timer->wnext->wlink = &timer->wnext;
+    timer->wlink = slot;
+    timer->level = level;
+    *slot = timer;
+    if(level < LEVELS)
+        ++counts[level];
+}
 
+void TimerQueue::unlink(event *timer)
+{
+    if(!timer->wlink)
+        return;
+
+    *timer->wlink = timer->wnext;
+    if(timer->wnext)
+        timer->wnext->wlink = timer->wlink;
+    if(timer->level < LEVELS)
+        --counts[timer->level];
+    timer->wnext = NULL;
+    timer->wlink = NULL;
+}
+
+void TimerQueue::insert(event *timer)
+{
+    unsigned long expires = timer->due;
+    unsigned long offset = expires - clock;
+
+    if((long)offset < 0)
+        link(timer, &root[clock & (ROOT - 1)], 0);
+    else if(offset < ROOT)
+        link(timer, &root[expires & (ROOT - 1)], 0);
+    else if(offset < (1ul << 14))
+        link(timer, &wheel[0][(expires >> 8) & (SLOTS - 1)], 1);
+    else if(offset < (1ul << 20))
+        link(timer, &wheel[1][(expires >> 14) & (SLOTS - 1)], 2);
+    else if(offset < (1ul << 26))
+        link(timer, &wheel[2][(expires >> 20) & (SLOTS - 1)], 3);
+    else {
+        // beyond the wheel we park in the last slot and re-insert later...
+        if(offset > 0xfffffffful)
+            expires = clock + 0xfffffffful;
+        link(timer, &wheel[3][(expires >> 26) & (SLOTS - 1)], 4);
+    }
+}
+
+void TimerQueue::schedule(event *timer)
+{
+    unlink(timer);
+    if(!timer->is_active())
+        return;
+
+    timer->due = (now() + timer->get() + resolution - 1) / resolution;
+    insert(timer);
+}
+
+unsigned TimerQueue::cascade(unsigned level)
+{
+    unsigned index = (unsigned)((clock >> (8 + (level - 1) * 6)) & (SLOTS - 1));
+    event *timer = wheel[level - 1][index];
+
+    wheel[level - 1][index] = NULL;
     while(timer) {
-        tp = *timer;
-        timer.next();
-        next = tp->timeout();
-        if(next && next < first)
-            first = next;
+        event *next = timer->wnext;
+        --counts[level];
+        timer->wlink = NULL;
+        insert(timer);
+        timer = next;
+    }
+    return index;
+}
+
+void TimerQueue::advance(unsigned long current)
+{
+    while((long)(current - clock) >= 0) {
+        unsigned index = (unsigned)(clock & (ROOT - 1));
+
+        if(!counts[0] && !counts[1] && !counts[2] && !counts[3] && !counts[4]) {
+            clock = current + 1;
+            return;
+        }
+
+        // skip empty root ticks up to the next cascade point...
+        if(index && !counts[0]) {
+            unsigned long boundary = (clock | (ROOT - 1)) + 1;
+            if((long)(boundary - current) > 0) {
+                clock = current + 1;
+                return;
+            }
+            clock = boundary;
+            continue;
+        }
+
+        if(!index && !cascade(1) && !cascade(2) && !cascade(3))
+            cascade(4);
+
+        event *timer = root[index];
+        root[index] = NULL;
+        while(timer) {
+            event *next = timer->wnext;
+            --counts[0];
+            timer->wlink = NULL;
+            link(timer, &due, WHEEL_DUE);
+            timer = next;
+        }
+        ++clock;
+    }
+}
+
+timeout_t TimerQueue::next(void)
+{
+    unsigned long target = 0;
+    bool found = false;
+
+    if(due)
+        return 0;
+
+    if(counts[0]) {
+        for(unsigned offset = 0; offset < ROOT; ++offset) {
+            if(root[(clock + offset) & (ROOT - 1)]) {
+                target = clock + offset;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    // outer wheels only tell us when to next cascade...
+    for(unsigned level = 1; level < LEVELS; ++level) {
+        if(!counts[level])
+            continue;
+        unsigned shift = 8 + (level - 1) * 6;
+        unsigned long base = clock >> shift;
+        for(unsigned offset = 1; offset <= SLOTS; ++offset) {
+            if(wheel[level - 1][(base + offset) & (SLOTS - 1)]) {
+                unsigned long boundary = (base + offset) << shift;
+                if(!found || (long)(boundary - target) < 0)
+                    target = boundary;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    if(!found)
+        return Timer::inf;
+
+    unsigned long ms = now();
+    unsigned long when = target * resolution;
+    if((long)(when - ms) <= 0)
+        return 0;
+    return (timeout_t)(when - ms);
+}
+
+void TimerQueue::dispatch(event **list, unsigned count)
+{
+    for(unsigned pos = 0; pos < count; ++pos) {
+        event *timer = list[pos];
+        timer->timeout();
+
+        // expired handlers may set the timer directly rather than arm...
+        if(timer->is_active() && !timer->wlink && timer->list() == this) {
+            modify();
+            schedule(timer);
+            update();
+        }
+    }
+}
+
+timeout_t TimerQueue::expire(void)
+{
+    event *batch[BATCH];
+    unsigned count;
+    timeout_t timeout;
+
+    for(;;) {
+        count = 0;
+        modify();
+        unsigned long current = now() / resolution;
+        advance(current);
+        while(due && count < BATCH) {
+            event *timer = due;
+            unlink(timer);
+            if(!timer->is_active())
+                continue;
+            // events early by rounding go back on the wheel...
+            if(timer->get()) {
+                schedule(timer);
+                continue;
+            }
+            batch[count++] = timer;
+        }
+        if(!count)
+            timeout = next();
+        update();
+        if(!count)
+            return timeout;
+        dispatch(batch, count);
     }
-    return first;
 }
 
 void TimerQueue::operator+=(event &te) { te.attach(this); }
@@ -53,6 +53,11 @@ if (NOT UCOMMON_LIBS AND NOT UCOMMON_FLAGS)
         endif()
     endif()
 
+    # lock profiling changes lock class layouts, so users must match...
+    if(LOCK_PROFILING)
+        set(UCOMMON_FLAGS ${UCOMMON_FLAGS} -DUCOMMON_PROFILING)
+    endif()
+
     # check final for compiler flags
     foreach(flag ${CHECK_FLAGS})
         check_c_compiler_flag(${flag} CHECK_${flag})
@@ -33,10 +33,10 @@ NAMESPACE_UCOMMON
 
 /**
  * Generic atomic class for referencing atomic objects and static functions.
- * We have an atomic counter and spinlock, and in the future we may add
- * other atomic classes and atomic manipulations needed to create lockfree
- * data structures.  The atomic classes use mutexes if no suitable atomic
- * code is available.
+ * We have atomic counters, pointers, and locks which can be used as the
+ * basis for lockfree data structures.  The atomic classes use gcc atomic
+ * builtins when enabled, and fall back to protected mutexes if no suitable
+ * atomic code is available.
  * @author David Sugar <dyfet@gnutelephony.org>
  */
 class __EXPORT atomic
@@ -47,6 +47,21 @@ public:
      */
     static const bool simulated;
 
+    /**
+     * Memory ordering for atomic operations.  These match the C++11 memory
+     * model.  Where only full barrier atomics are available, every
+     * operation is sequential.
+     */
+    typedef enum {
+        RELAXED, ACQUIRE, RELEASE, ACQREL, SEQUENTIAL
+    } order_t;
+
+    /**
+     * Issue a memory fence.
+     * @param order of fence.
+     */
+    static void fence(order_t order = SEQUENTIAL);
+
     /**
      * Atomic counter class.  Can be used to manipulate value of an
      * atomic counter without requiring explicit thread locking.
@@ -65,6 +80,70 @@ public:
         long operator+=(long offset);
         long operator-=(long offset);
 
+        /**
+         * Get the current value.
+         * @param order of memory access.
+         * @return value of counter.
+         */
+        long load(order_t order = SEQUENTIAL);
+
+        /**
+         * Set a new value.
+         * @param value to store.
+         * @param order of memory access.
+         */
+        void store(long value, order_t order = SEQUENTIAL);
+
+        /**
+         * Set a new value and get the prior one.
+         * @param value to store.
+         * @param order of memory access.
+         * @return prior value.
+         */
+        long exchange(long value, order_t order = SEQUENTIAL);
+
+        /**
+         * Set a new value if the counter holds an expected value.  If it
+         * does not, expected is updated to the value found.
+         * @param expected value, updated on failure.
+         * @param value to store.
+         * @param order of memory access.
+         * @return true if stored.
+         */
+        bool compare_exchange(long& expected, long value, order_t order = SEQUENTIAL);
+
+        /**
+         * Add to counter and get the prior value.
+         * @param offset to add.
+         * @param order of memory access.
+         * @return prior value.
+         */
+        long fetch_add(long offset, order_t order = SEQUENTIAL);
+
+        /**
+         * Subtract from counter and get the prior value.
+         * @param offset to subtract.
+         * @param order of memory access.
+         * @return prior value.
+         */
+        long fetch_sub(long offset, order_t order = SEQUENTIAL);
+
+        /**
+         * Set bits in counter and get the prior value.
+         * @param bits to set.
+         * @param order of memory access.
+         * @return prior value.
+         */
+        long fetch_or(long bits, order_t order = SEQUENTIAL);
+
+        /**
+         * Mask bits in counter and get the prior value.
+         * @param bits to keep.
+         * @param order of memory access.
+         * @return prior value.
+         */
+        long fetch_and(long bits, order_t order = SEQUENTIAL);
+
         inline operator long()
             {return (long)(value);};
 
@@ -72,6 +151,204 @@ public:
             {return value;};
     };
 
+    /**
+     * Sharded counter class.  Statistics that many threads update, such as
+     * request and byte counts, would make every core fight over the cache
+     * line of a single counter.  A sharded counter instead keeps a cache
+     * line padded slot for each cpu, and increments only touch the slot of
+     * the cpu the caller runs on.  When a slot gathers a batch worth of
+     * change it is folded into a shared total.  Reading the shared total
+     * alone is cheap and approximate, off by at most a batch for each
+     * slot, while an exact read also adds up every slot.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT sharded
+    {
+    private:
+        caddr_t memory;
+        void *slots;
+        unsigned mask;
+        long batch;
+        counter total;
+
+        sharded(const sharded& copy);
+        sharded& operator=(const sharded& copy);
+
+    public:
+        /**
+         * Create a sharded counter.
+         * @param batch of change a slot gathers before it is folded.
+         * @param count of slots, 0 for one for each cpu.
+         */
+        sharded(long batch = 64, unsigned count = 0);
+
+        /**
+         * Release slots.
+         */
+        ~sharded();
+
+        /**
+         * Add to the slot of the current cpu.
+         * @param offset to add.
+         * @return approximate value, the shared total plus this slot.
+         */
+        long add(long offset);
+
+        /**
+         * Add to a specific slot, such as one recorded from index.
+         * @param index of slot.
+         * @param offset to add.
+         * @return approximate value, the shared total plus this slot.
+         */
+        long add(unsigned index, long offset);
+
+        /**
+         * Get the slot of the current cpu.
+         * @return slot index.
+         */
+        unsigned index(void) const;
+
+        /**
+         * Get the value held in one slot, not yet folded into the total.
+         * @param index of slot.
+         * @return slot value.
+         */
+        long load(unsigned index);
+
+        /**
+         * Get the exact value by adding up all slots.  This is exact when
+         * no updates are in progress.
+         * @return counter value.
+         */
+        long load(void);
+
+        /**
+         * Get the approximate value from the shared total only.
+         * @return counter value, within a batch for each slot.
+         */
+        inline long approximate(void)
+            {return total.load(RELAXED);};
+
+        /**
+         * Reset the counter and all of its slots to zero.
+         */
+        void clear(void);
+
+        /**
+         * Get the number of slots.
+         * @return slots in counter.
+         */
+        inline unsigned size(void) const
+            {return mask + 1;};
+
+        /**
+         * Unlike counter, the value returned by the update operators is
+         * only approximate, as other slots are not added in, and two
+         * threads may see the same value.  Use load for an exact value.
+         * @return approximate value after the change.
+         */
+        inline long operator++()
+            {return add(1);};
+
+        inline long operator--()
+            {return add(-1);};
+
+        inline long operator+=(long offset)
+            {return add(offset);};
+
+        inline long operator-=(long offset)
+            {return add(-offset);};
+
+        inline operator long()
+            {return load();};
+
+        inline long operator*()
+            {return load();};
+    };
+
+    /**
+     * Atomic 64 bit counter class.  This offers the same operations as
+     * counter, but is always 64 bits wide, even on 32 bit platforms.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT counter64
+    {
+    private:
+        volatile int64_t value;
+
+    public:
+        counter64(int64_t initial = 0);
+
+        int64_t operator++();
+        int64_t operator--();
+        int64_t operator+=(int64_t offset);
+        int64_t operator-=(int64_t offset);
+
+        int64_t load(order_t order = SEQUENTIAL);
+        void store(int64_t value, order_t order = SEQUENTIAL);
+        int64_t exchange(int64_t value, order_t order = SEQUENTIAL);
+        bool compare_exchange(int64_t& expected, int64_t value, order_t order = SEQUENTIAL);
+        int64_t fetch_add(int64_t offset, order_t order = SEQUENTIAL);
+        int64_t fetch_sub(int64_t offset, order_t order = SEQUENTIAL);
+        int64_t fetch_or(int64_t bits, order_t order = SEQUENTIAL);
+        int64_t fetch_and(int64_t bits, order_t order = SEQUENTIAL);
+
+        inline operator int64_t()
+            {return load();};
+
+        inline int64_t operator*()
+            {return load();};
+    };
+
+    /**
+     * Atomic pointer class.  Used to publish and swap pointers between
+     * threads without locking.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT pointer
+    {
+    private:
+        void *volatile value;
+
+    public:
+        pointer(void *initial = NULL);
+
+        /**
+         * Get the current pointer.
+         * @param order of memory access.
+         * @return pointer.
+         */
+        void *load(order_t order = SEQUENTIAL);
+
+        /**
+         * Set a new pointer.
+         * @param value to store.
+         * @param order of memory access.
+         */
+        void store(void *value, order_t order = SEQUENTIAL);
+
+        /**
+         * Set a new pointer and get the prior one.
+         * @param value to store.
+         * @param order of memory access.
+         * @return prior pointer.
+         */
+        void *exchange(void *value, order_t order = SEQUENTIAL);
+
+        /**
+         * Set a new pointer if the expected one is held.  If not, expected
+         * is updated to the pointer found.
+         * @param expected pointer, updated on failure.
+         * @param value to store.
+         * @param order of memory access.
+         * @return true if stored.
+         */
+        bool compare_exchange(void *& expected, void *value, order_t order = SEQUENTIAL);
+
+        inline operator void*()
+            {return load();};
+    };
+
     /**
      * Atomic spinlock class.  Used as high-performance sync lock between
      * threads.
@@ -95,11 +372,107 @@ public:
          */
         bool acquire(void);
 
+        /**
+         * Wait for and acquire the lock.  The wait spins with exponential
+         * backoff, and yields the thread once the backoff limit is reached.
+         */
+        void lock(void);
+
+        /**
+         * Release an acquired spinlock.
+         */
+        void release(void);
+
         /**
          * Release an acquired spinlock.
          */
+        inline void unlock(void)
+            {release();};
+    };
+
+    /**
+     * Atomic ticket lock class.  Unlike a spinlock, waiting threads are
+     * granted the lock in the order they asked for it, so no thread can be
+     * starved under contention.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT ticketlock
+    {
+    private:
+        volatile long next, serving;
+
+    public:
+        /**
+         * Construct and initialize ticket lock.
+         */
+        ticketlock();
+
+        /**
+         * Acquire the lock if no other thread holds or waits for it.
+         * @return true if acquired.
+         */
+        bool acquire(void);
+
+        /**
+         * Take a ticket and wait until it is served.
+         */
+        void lock(void);
+
+        /**
+         * Release the lock to the next ticket holder.
+         */
         void release(void);
+
+        /**
+         * Release the lock to the next ticket holder.
+         */
+        inline void unlock(void)
+            {release();};
     };
+
+    /**
+     * Pause a spinning thread.  Each call waits about twice as long as the
+     * last, and once a limit is reached the thread yields instead.
+     * @param spins count kept by the caller, initially 0.
+     */
+    static void backoff(unsigned& spins);
+};
+
+/**
+ * Typed atomic pointer.  This is used to publish and swap references to
+ * typed objects between threads without locking.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+template<typename T>
+class atomic_pointer : private atomic::pointer
+{
+public:
+    inline atomic_pointer(T *initial = NULL) : atomic::pointer(initial) {};
+
+    inline T *load(atomic::order_t order = atomic::SEQUENTIAL)
+        {return static_cast<T*>(atomic::pointer::load(order));};
+
+    inline void store(T *value, atomic::order_t order = atomic::SEQUENTIAL)
+        {atomic::pointer::store(value, order);};
+
+    inline T *exchange(T *value, atomic::order_t order = atomic::SEQUENTIAL)
+        {return static_cast<T*>(atomic::pointer::exchange(value, order));};
+
+    inline bool compare_exchange(T *& expected, T *value, atomic::order_t order = atomic::SEQUENTIAL) {
+        void *prior = expected;
+        bool result = atomic::pointer::compare_exchange(prior, value, order);
+        expected = static_cast<T*>(prior);
+        return result;
+    }
+
+    inline operator T*()
+        {return load();};
+
+    inline T *operator->()
+        {return load();};
+
+    inline T& operator*()
+        {return *load();};
 };
 
 END_NAMESPACE
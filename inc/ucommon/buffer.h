@@ -58,6 +58,8 @@ NAMESPACE_UCOMMON
 class __EXPORT TCPBuffer : public BufferProtocol, protected Socket
 {
 protected:
+    ZeroCopy *zcopy;
+
     void _buffer(size_t size);
 
     virtual size_t _push(const char *address, size_t size);
@@ -66,6 +68,13 @@ protected:
     void _clear(void);
     bool _blocking(void);
 
+    /**
+     * Check if file transfers may write directly to the socket.  This is
+     * false for sessions which must encode what is sent.
+     * @return true if data can be sent without the buffer.
+     */
+    virtual bool _direct(void);
+
     /**
      * Get the low level socket object.
      * @return socket we are using.
@@ -117,9 +126,54 @@ public:
     void open(const char *host, const char *service, size_t size = 536);
 
     /**
-     * Close active connection.
+     * Close active connection.  Buffers posted with zero copy are waited
+     * for up to the i/o timeout.  Any the kernel still holds are never
+     * released, and this is reported as an error.
+     * @return false if posted buffers were still in flight.
+     */
+    bool close(void);
+
+    /**
+     * Send a range of a file to the peer.  Buffered output is flushed
+     * first, and the file is then moved by the kernel without copying it
+     * through the buffer where possible.  If the socket does not block,
+     * this may send less than requested.
+     * @param file to send from.
+     * @param offset to start from, updated by amount sent, or NULL to use
+     * and advance the file position.
+     * @param count of bytes to send.
+     * @return number of bytes sent.
+     */
+    size_t transfer(fsys& file, fsys::offset_t *offset, size_t count);
+
+    /**
+     * Enable zero copy sending of large posted buffers until the session
+     * is closed.  Sessions that must encode what is sent cannot do this.
+     * @param release callback for posted buffers.
+     * @param user data passed to callback.
+     * @param threshold size below which posted buffers are copied.
+     * @return true if the kernel will send without copying.
+     */
+    bool zerocopy(ZeroCopy::release_t release, void *user = NULL, size_t threshold = 16384);
+
+    /**
+     * Post a caller owned buffer to send.  Once zero copy is enabled, a
+     * large buffer is sent after flushing, straight from the caller's
+     * memory, and is passed back through the release callback when the
+     * kernel is done with it.  Small buffers are copied with put and
+     * released at once.  Without zero copy this is the same as put.
+     * @param buffer to send.
+     * @param size of buffer.
+     * @return number of bytes sent or buffered.
+     */
+    size_t post(const void *buffer, size_t size);
+
+    /**
+     * Release posted buffers whose sends completed.
+     * @param timeout to wait for a completion, 0 to not wait.
+     * @return number of buffers released.
      */
-    void close(void);
+    unsigned reap(timeout_t timeout = 0);
 
 protected:
     /**
@@ -49,6 +49,10 @@
 #include <ucommon/thread.h>
 #endif
 
+#ifndef  _UCOMMON_ATOMIC_H_
+#include <ucommon/atomic.h>
+#endif
+
 NAMESPACE_UCOMMON
 
 /**
@@ -202,6 +206,240 @@ public:
     bool operator!();
 };
 
+/**
+ * A lock-free ring buffer for passing copies of objects between threads.
+ * This is used much like Buffer, but any number of producer and consumer
+ * threads may put and copy objects without taking a lock.  Each slot has
+ * a sequence number that tells producers and consumers whether it is free
+ * or filled, so threads only contend on the head or tail index.  The
+ * conditional is only used to sleep when the ring is full or empty, and
+ * is only signalled when a thread is sleeping.  Objects are copied as
+ * raw memory, so this is meant for plain data records.  The ring is
+ * normally used through the ringof<type> template.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT RingBuffer : protected Conditional
+{
+private:
+    size_t objsize, slotsize;
+    caddr_t slots;
+    unsigned long mask;
+    atomic::counter sleepers;
+
+    // producers and consumers each get their own cache line...
+    char pad1[64];
+    atomic::counter tail;
+    char pad2[64];
+    atomic::counter head;
+    char pad3[64];
+
+    __LOCAL bool push(const void *data);
+    __LOCAL bool pop(void *data);
+    __LOCAL void wake(void);
+
+protected:
+    /**
+     * Create a ring to hold a series of objects.
+     * @param typesize of each object in the ring.
+     * @param count of objects, rounded up to a power of 2.
+     */
+    RingBuffer(size_t typesize, size_t count);
+
+    /**
+     * Deallocate ring.
+     */
+    virtual ~RingBuffer();
+
+    /**
+     * Put (copy) an object into the ring.  This blocks while the ring
+     * is full.
+     * @param data to copy into the ring.
+     */
+    void put(const void *data);
+
+    /**
+     * Put (copy) an object into the ring.
+     * @param data to copy into the ring.
+     * @param timeout to wait if ring is full, 0 to not wait.
+     * @return true if copied, false if timed out while full.
+     */
+    bool put(const void *data, timeout_t timeout);
+
+    /**
+     * Copy the next object from the ring.  This blocks until an object
+     * becomes available.
+     * @param data pointer to copy into.
+     */
+    void copy(void *data);
+
+    /**
+     * Copy the next object from the ring.
+     * @param data pointer to copy into.
+     * @param timeout to wait when ring is empty, 0 to not wait.
+     * @return true if object copied, or false if timed out.
+     */
+    bool copy(void *data, timeout_t timeout);
+
+public:
+    /**
+     * Get the number of objects the ring can hold.
+     * @return size of the ring.
+     */
+    unsigned size(void);
+
+    /**
+     * Get the number of objects in the ring currently.  Since other
+     * threads may be active, this is only a snapshot.
+     * @return number of objects in ring.
+     */
+    unsigned count(void);
+
+    /**
+     * Test if there is data waiting in the ring.
+     * @return true if ring has data.
+     */
+    inline operator bool()
+        {return count() > 0;};
+
+    /**
+     * Test if the ring is empty.
+     * @return true if the ring is empty.
+     */
+    inline bool operator!()
+        {return count() == 0;};
+};
+
+/**
+ * A wait-free pipe for passing copies of objects from exactly one producer
+ * thread to exactly one consumer thread.  Each side owns its own index on
+ * a separate cache line and keeps a cached copy of the other side's index,
+ * so a put or copy normally touches no shared cache line other than the
+ * object data itself.  Objects may be pushed and pulled in batches, in which
+ * case the index is published once for the whole batch.  The conditional is
+ * only used to sleep when the pipe is full or empty.  Objects are copied as
+ * raw memory, so this is meant for plain data records.  The pipe is normally
+ * used through the pipeof<type> template.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT PipeBuffer : protected Conditional
+{
+private:
+    size_t objsize;
+    caddr_t buf;
+    unsigned long mask;
+    atomic::counter sleepers;
+
+    char pad1[64];
+    atomic::counter tail;
+    unsigned long ahead;
+    char pad2[64];
+    atomic::counter head;
+    unsigned long behind;
+    char pad3[64];
+
+    __LOCAL unsigned store(const void *data, unsigned count);
+    __LOCAL unsigned fetch(void *data, unsigned count);
+    __LOCAL void wake(void);
+
+protected:
+    /**
+     * Create a pipe to hold a series of objects.
+     * @param typesize of each object in the pipe.
+     * @param count of objects, rounded up to a power of 2.
+     */
+    PipeBuffer(size_t typesize, size_t count);
+
+    /**
+     * Deallocate pipe.
+     */
+    virtual ~PipeBuffer();
+
+    /**
+     * Push (copy) as many objects as will fit into the pipe without
+     * blocking.  May only be called from the producer thread.
+     * @param data to copy into the pipe.
+     * @param count of objects to copy.
+     * @return number of objects copied.
+     */
+    unsigned push(const void *data, unsigned count);
+
+    /**
+     * Pull (copy) as many objects as are waiting in the pipe without
+     * blocking.  May only be called from the consumer thread.
+     * @param data to copy into.
+     * @param count of objects that can be copied.
+     * @return number of objects copied.
+     */
+    unsigned pull(void *data, unsigned count);
+
+    /**
+     * Put (copy) an object into the pipe.  This blocks while the pipe
+     * is full.
+     * @param data to copy into the pipe.
+     */
+    void put(const void *data);
+
+    /**
+     * Put (copy) an object into the pipe.
+     * @param data to copy into the pipe.
+     * @param timeout to wait if pipe is full, 0 to not wait.
+     * @return true if copied, false if timed out while full.
+     */
+    bool put(const void *data, timeout_t timeout);
+
+    /**
+     * Copy the next object from the pipe.  This blocks until an object
+     * becomes available.
+     * @param data pointer to copy into.
+     */
+    void copy(void *data);
+
+    /**
+     * Copy the next object from the pipe.
+     * @param data pointer to copy into.
+     * @param timeout to wait when pipe is empty, 0 to not wait.
+     * @return true if object copied, or false if timed out.
+     */
+    bool copy(void *data, timeout_t timeout);
+
+    /**
+     * Copy waiting objects from the pipe.  This waits until at least one
+     * object is available, and then copies as many as are waiting.
+     * @param data pointer to copy into.
+     * @param count of objects that can be copied.
+     * @param timeout to wait when pipe is empty, 0 to not wait.
+     * @return number of objects copied, 0 if timed out.
+     */
+    unsigned copy(void *data, unsigned count, timeout_t timeout);
+
+public:
+    /**
+     * Get the number of objects the pipe can hold.
+     * @return size of the pipe.
+     */
+    unsigned size(void);
+
+    /**
+     * Get the number of objects in the pipe currently.
+     * @return number of objects in pipe.
+     */
+    unsigned count(void);
+
+    /**
+     * Test if there is data waiting in the pipe.
+     * @return true if pipe has data.
+     */
+    inline operator bool()
+        {return count() > 0;};
+
+    /**
+     * Test if the pipe is empty.
+     * @return true if the pipe is empty.
+     */
+    inline bool operator!()
+        {return count() == 0;};
+};
+
 /**
  * Manage a thread-safe queue of objects through reference pointers.  This
  * can be particularly interesting when used to enqueue/dequeue reference
@@ -513,6 +751,141 @@ public:
         {return static_cast<T*>(Buffer::peek(offset));}
 };
 
+/**
+ * A templated typed class for lock-free buffering of objects.  This
+ * operates as a fifo ring of typed objects which are physically copied
+ * into and out of the ring, and may be used with any number of producer
+ * and consumer threads.  Since objects are copied as memory, the type
+ * should be plain data.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+template<class T>
+class ringof : public RingBuffer
+{
+public:
+    /**
+     * Create a ring to hold a series of typed objects.
+     * @param capacity of typed objects, rounded up to a power of 2.
+     */
+    inline ringof(unsigned capacity) :
+        RingBuffer(sizeof(T), capacity) {};
+
+    /**
+     * Put (copy) a typed object into the ring.  This blocks while the ring
+     * is full.
+     * @param object to copy into the ring.
+     */
+    inline void put(const T *object)
+        {RingBuffer::put(object);};
+
+    /**
+     * Put (copy) a typed object into the ring.
+     * @param object to copy into the ring.
+     * @param timeout to wait if ring is full, 0 to not wait.
+     * @return true if copied, false if timed out while full.
+     */
+    inline bool put(const T *object, timeout_t timeout)
+        {return RingBuffer::put(object, timeout);};
+
+    /**
+     * Copy the next typed object from the ring.  This blocks until an
+     * object becomes available.
+     * @param object pointer to copy typed object into.
+     */
+    inline void copy(T *object)
+        {RingBuffer::copy(object);};
+
+    /**
+     * Copy the next typed object from the ring.
+     * @param object pointer to copy typed object into.
+     * @param timeout to wait when ring is empty, 0 to not wait.
+     * @return true if object copied, or false if timed out.
+     */
+    inline bool copy(T *object, timeout_t timeout)
+        {return RingBuffer::copy(object, timeout);};
+};
+
+/**
+ * A templated typed class for wait-free piping of objects.  This operates
+ * as a fifo of typed objects which are physically copied between exactly
+ * one producer thread and one consumer thread.  Since objects are copied as
+ * memory, the type should be plain data.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+template<class T>
+class pipeof : public PipeBuffer
+{
+public:
+    /**
+     * Create a pipe to hold a series of typed objects.
+     * @param capacity of typed objects, rounded up to a power of 2.
+     */
+    inline pipeof(unsigned capacity) :
+        PipeBuffer(sizeof(T), capacity) {};
+
+    /**
+     * Push as many typed objects as fit without blocking.
+     * @param objects to copy into the pipe.
+     * @param count of objects to copy.
+     * @return number of objects copied.
+     */
+    inline unsigned push(const T *objects, unsigned count)
+        {return PipeBuffer::push(objects, count);};
+
+    /**
+     * Pull as many typed objects as are waiting without blocking.
+     * @param objects to copy into.
+     * @param count of objects that can be copied.
+     * @return number of objects copied.
+     */
+    inline unsigned pull(T *objects, unsigned count)
+        {return PipeBuffer::pull(objects, count);};
+
+    /**
+     * Put (copy) a typed object into the pipe.  This blocks while the pipe
+     * is full.
+     * @param object to copy into the pipe.
+     */
+    inline void put(const T *object)
+        {PipeBuffer::put(object);};
+
+    /**
+     * Put (copy) a typed object into the pipe.
+     * @param object to copy into the pipe.
+     * @param timeout to wait if pipe is full, 0 to not wait.
+     * @return true if copied, false if timed out while full.
+     */
+    inline bool put(const T *object, timeout_t timeout)
+        {return PipeBuffer::put(object, timeout);};
+
+    /**
+     * Copy the next typed object from the pipe.  This blocks until an
+     * object becomes available.
+     * @param object pointer to copy typed object into.
+     */
+    inline void copy(T *object)
+        {PipeBuffer::copy(object);};
+
+    /**
+     * Copy the next typed object from the pipe.
+     * @param object pointer to copy typed object into.
+     * @param timeout to wait when pipe is empty, 0 to not wait.
+     * @return true if object copied, or false if timed out.
+     */
+    inline bool copy(T *object, timeout_t timeout)
+        {return PipeBuffer::copy(object, timeout);};
+
+    /**
+     * Copy waiting typed objects, waiting for at least one.
+     * @param objects to copy into.
+     * @param count of objects that can be copied.
+     * @param timeout to wait when pipe is empty, 0 to not wait.
+     * @return number of objects copied, 0 if timed out.
+     */
+    inline unsigned copy(T *objects, unsigned count, timeout_t timeout)
+        {return PipeBuffer::copy(objects, count, timeout);};
+};
+
 /**
  * A templated typed class for thread-safe stack of object pointers.  This
  * allows one to use the stack class in a typesafe manner for a specific
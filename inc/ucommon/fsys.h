@@ -178,6 +178,14 @@ public:
      */
     static const offset_t end;
 
+    /**
+     * Copy progress callback.  This is passed how much of the source has
+     * been copied, including skipped holes, and the total size of the
+     * source, or 0 if the source is a stream.
+     * @return false to cancel the copy.
+     */
+    typedef bool (*progress_t)(void *user, offset_t copied, offset_t total);
+
     /**
      * Construct an unattached fsys descriptor.
      */
@@ -328,6 +336,17 @@ public:
      */
     ssize_t write(const void *buffer, size_t count);
 
+    /**
+     * Transfer a range of this file to another descriptor without copying
+     * through a user buffer where possible.
+     * @param target descriptor to write to.
+     * @param offset to start from, updated by amount moved, or NULL to
+     * use and advance the file position.
+     * @param count of bytes to move.
+     * @return bytes transferred, -1 if error.
+     */
+    ssize_t transfer(fd_t target, offset_t *offset, size_t count);
+
     /**
      * Get status of open descriptor.
      * @param buffer to save status info in.
@@ -382,13 +401,50 @@ public:
     static int erase(const char *path);
 
     /**
-     * Copy a file.
+     * Copy a file.  This uses the same kernel assisted copy as copying
+     * between descriptors.
      * @param source file.
      * @param target file.
-     * @param size of buffer.
+     * @param size of buffer if the kernel cannot copy, 0 for default.
      * @return error number or 0 on success.
      */
-    static int copy(const char *source, const char *target, size_t size = 1024);
+    static int copy(const char *source, const char *target, size_t size = 0);
+
+    /**
+     * Copy the contents of one descriptor to another.  A regular file is
+     * first cloned as a reflink where the filesystem supports it.  Else it
+     * is copied with copy_file_range or sendfile, and only with an aligned
+     * buffer if the kernel can do neither.  Holes in a sparse source are
+     * skipped and remain holes in the target.  Other sources are copied
+     * until end of file.
+     * @param target descriptor to replace content of.
+     * @param source descriptor to copy from.
+     * @param progress callback, or NULL if none.
+     * @param user data passed to progress callback.
+     * @param size of buffer if the kernel cannot copy, 0 for default.
+     * @return error number or 0 on success, ECANCELED if cancelled.
+     */
+    static int copy(fd_t target, fd_t source, progress_t progress = NULL, void *user = NULL, size_t size = 0);
+
+    /**
+     * Transfer a range of one descriptor to another.  This uses sendfile
+     * where the kernel offers it, or splices through a pipe, and otherwise
+     * reads into and writes from a buffer.  The target may be a file, a
+     * pipe, or, other than on windows, a socket.  If the target does not
+     * block, fewer bytes than requested may be moved, and the remainder
+     * may be sent later from the updated offset.  A pipe or socket source
+     * is only read from once such a target is ready, and anything already
+     * read is always written.  If an error stops the transfer after some
+     * bytes were moved, the count is returned and errno holds the error.
+     * As with write, a closed pipe or socket target may raise SIGPIPE.
+     * @param target descriptor to write to.
+     * @param source descriptor to read from.
+     * @param offset in source to start from, updated by amount moved, or
+     * NULL to use and advance the source file position.
+     * @param count of bytes to move.
+     * @return bytes transferred, less if end of file, -1 if error.
+     */
+    static ssize_t transfer(fd_t target, fd_t source, offset_t *offset, size_t count);
 
     /**
      * Rename a file.
@@ -65,6 +65,7 @@ private:
     size_t pagesize, align;
     unsigned count;
 
+protected:
     typedef struct mempage {
         struct mempage *next;
         union {
@@ -73,13 +74,22 @@ private:
         };
     }   page_t;
 
+private:
+    enum {SPARES = 8};
+
     page_t *page;
+    page_t *spare[SPARES];
+
+    __LOCAL void retire(page_t *page);
 
 protected:
     unsigned limit;
 
     /**
      * Acquire a new page from the heap.  This is mostly used internally.
+     * The new page becomes the current page allocated from, and the prior
+     * current page is kept in a small index of spare pages if it still has
+     * usable space left.
      * @return page structure of the newly acquired memory page.
      */
     page_t *pager(void);
@@ -145,7 +155,9 @@ public:
     /**
      * Allocate memory from the pager heap.  The size of the request must be
      * less than the size of the memory page used.  This implements the
-     * memory protocol allocation method.
+     * memory protocol allocation method.  Only the current page and a small
+     * fixed index of spare pages with remaining space are examined, so the
+     * cost of an allocation does not grow with the number of pages.
      * @param size of memory request.
      * @return allocated memory or NULL if not possible.
      */
@@ -218,7 +230,7 @@ public:
     /**
      * Purge all allocated memory and heap pages immediately.
      */
-    void purge(void);
+    virtual void purge(void);
 
     /**
      * Return memory back to pager heap.  This actually does nothing, but
@@ -240,6 +252,165 @@ public:
     virtual void *_alloc(size_t size);
 };
 
+/**
+ * A managed private heap with thread-local page arenas.  The arenapager
+ * behaves as a mempager, but each thread that allocates from it is given
+ * it's own current page to allocate from.  Allocations made from a thread's
+ * current page require no locking, so allocation throughput is not limited
+ * by a single pager mutex when many threads share the same heap.  The pager
+ * mutex is only acquired when a thread needs a new page from the real heap.
+ *
+ * All pages remain on the common page list of the pager, so purge() and
+ * utilization() still operate on every page from every thread.  As with
+ * any pager, purge should only be called when no other thread is still
+ * using or allocating memory from the pager.  A thread's arena is returned
+ * to the pager for re-use by a later thread when the thread exits.  Since
+ * each arenapager uses a thread-specific data key, these are best used
+ * for long lived heaps rather than created in large numbers.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT arenapager : public mempager
+{
+private:
+    class arena;
+
+    arena *arenas;
+    volatile unsigned generation;
+
+#if defined(__PTH__)
+    pth_key_t key;
+#elif defined(_MSWINDOWS_)
+    DWORD key;
+#else
+    pthread_key_t key;
+#endif
+
+    __LOCAL arena *attach(void);
+
+public:
+    /**
+     * Construct a thread-local arena pager.
+     * @param page size to use or 0 for OS allocation size.
+     */
+    arenapager(size_t page = 0);
+
+    /**
+     * Destroy arena pager.  Release all pages and arenas back to the heap.
+     */
+    virtual ~arenapager();
+
+    /**
+     * Purge all allocated memory and heap pages immediately.  The current
+     * page of every thread arena is also invalidated.
+     */
+    virtual void purge(void);
+
+    /**
+     * Get the number of thread arenas that have been created.
+     * @return count of thread arenas.
+     */
+    unsigned threads(void);
+
+    /**
+     * Allocate memory from the current thread's arena.  The size of the
+     * request must be less than the size of the memory page used.  The
+     * pager is only locked if a new page has to be acquired.
+     * @param size of memory request.
+     * @return allocated memory or NULL if not possible.
+     */
+    virtual void *_alloc(size_t size);
+};
+
+/**
+ * A managed private heap with size class free lists.  This is a mempager
+ * which also implements dealloc, so memory released back to the pool is
+ * kept on a free list for it's size class and re-used by later requests
+ * of a similar size.  This allows long running services that create and
+ * destroy many small objects to stay within a bounded private heap rather
+ * than growing until the pager is purged.  Size classes are powers of two
+ * up to the usable size of a memory page, and each allocation carries a
+ * small header recording it's requested size.  Since it is a mempager, a
+ * mempool can be used anywhere a mempager or memory protocol is accepted,
+ * such as for the pager template.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT mempool : public mempager
+{
+private:
+    enum {CLASSES = 32};
+
+    void *freelist[CLASSES];
+    size_t limits[CLASSES];
+    unsigned classes;
+    size_t carved, requested, highmark;
+    unsigned idle;
+
+    __LOCAL unsigned sizeclass(size_t size) const;
+
+public:
+    /**
+     * Construct a size class memory pool.
+     * @param page size to use or 0 for OS allocation size.
+     */
+    mempool(size_t page = 0);
+
+    /**
+     * Destroy memory pool.  Release all pages back to the heap at once.
+     */
+    virtual ~mempool();
+
+    /**
+     * Purge all allocated memory, free lists, and heap pages immediately.
+     * The high water mark is also reset.
+     */
+    virtual void purge(void);
+
+    /**
+     * Return memory back to the pool for re-use by later requests.
+     * @param memory to free back to private heap.
+     */
+    virtual void dealloc(void *memory);
+
+    /**
+     * Allocate memory from the pool.  A block from the free list of the
+     * matching size class is re-used if one is available.  The size of
+     * the request must be less than the size of the memory page used.
+     * @param size of memory request.
+     * @return allocated memory or NULL if not possible.
+     */
+    virtual void *_alloc(size_t size);
+
+    /**
+     * Get the number of bytes currently allocated to callers.  This is
+     * the total of requested sizes of all blocks not yet released.
+     * @return bytes in use.
+     */
+    size_t used(void);
+
+    /**
+     * Get the largest number of bytes that were ever in use at one time
+     * since the pool was created or last purged.
+     * @return high water mark in bytes.
+     */
+    size_t highwater(void);
+
+    /**
+     * Determine fragmentation of memory carved from our heap pages.  This
+     * is the % (0-100) of carved memory that is not currently in use by
+     * callers, either because it is held in a free list or is lost to
+     * size class rounding.  A high value with a low high water mark may
+     * suggest memory is being held by free lists after a usage peak.
+     * @return pool fragmentation.
+     */
+    unsigned fragmentation(void);
+
+    /**
+     * Get the number of blocks currently held in free lists.
+     * @return free blocks available for re-use.
+     */
+    unsigned reusable(void);
+};
+
 class __EXPORT ObjectPager : protected memalloc
 {
 public:
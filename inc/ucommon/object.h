@@ -41,6 +41,10 @@
 #include <ucommon/protocols.h>
 #endif
 
+#ifndef _UCOMMON_ATOMIC_H_
+#include <ucommon/atomic.h>
+#endif
+
 #include <stdlib.h>
 
 NAMESPACE_UCOMMON
@@ -119,6 +123,77 @@ public:
     void release(void);
 };
 
+/**
+ * A reference counted object that may be shared between threads.  This
+ * offers the same interface as CountedObject, but the reference count is
+ * kept with atomic operations, so objects held through auto_object or
+ * object_pointer in several threads need no external lock.  Retaining is
+ * a relaxed increment, and only the final release synchronizes with the
+ * other owners before the object is dealloc'd.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT AtomicObject : public ObjectProtocol
+{
+private:
+    atomic::counter count;
+
+protected:
+    /**
+     * Construct an atomic counted object, mark initially as unreferenced.
+     */
+    AtomicObject();
+
+    /**
+     * Construct a copy of an atomic counted object.  As with CountedObject
+     * our instance is a duplicate and is initially unreferenced.
+     */
+    AtomicObject(const ObjectProtocol &ref);
+
+    /**
+     * Dealloc object no longer referenced.
+     */
+    virtual void dealloc(void);
+
+    /**
+     * Force reset of count.
+     */
+    inline void reset(void)
+        {count.store(0);}
+
+public:
+    /**
+     * Test if the object has copied references.
+     * @return true if referenced by more than one object.
+     */
+    inline bool is_copied(void)
+        {return count.load(atomic::RELAXED) > 1;};
+
+    /**
+     * Test if the object has been referenced (retained) by anyone yet.
+     * @return true if retained.
+     */
+    inline bool is_retained(void)
+        {return count.load(atomic::RELAXED) > 0;};
+
+    /**
+     * Return the number of active references (retentions) to our object.
+     * @return number of references to our object.
+     */
+    inline unsigned copied(void)
+        {return (unsigned)count.load(atomic::RELAXED);};
+
+    /**
+     * Increase reference count when retained.
+     */
+    void retain(void);
+
+    /**
+     * Decrease reference count when released.  If no longer retained, then
+     * the object is dealloc'd.
+     */
+    void release(void);
+};
+
 /**
  * A general purpose smart pointer helper class.  This is particularly
  * useful in conjunction with reference counted objects which can be
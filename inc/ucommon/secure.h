@@ -247,6 +247,9 @@ public:
 
     bool _pending(void);
 
+    inline bool _direct(void)
+        {return bio == NULL;};
+
     inline bool is_secure(void)
         {return bio != NULL;};
 };
@@ -38,6 +38,10 @@
 #include <ucommon/string.h>
 #endif
 
+#ifndef _UCOMMON_ATOMIC_H_
+#include <ucommon/atomic.h>
+#endif
+
 extern "C" {
     struct addrinfo;
 }
@@ -174,6 +178,8 @@ public:
      */
     typedef LinkedObject policy;
 
+    class table;
+
     /**
      * Create an uninitialized cidr.
      */
@@ -300,6 +306,68 @@ public:
         {return !is_member(address);};
 };
 
+/**
+ * A compiled index of a cidr policy chain.  The policy is built into
+ * path compressed binary tries for ipv4 and ipv6, so finding the most
+ * specific cidr for an address takes time in proportion to the address
+ * length rather than the number of cidr entries.  The results are the
+ * same as cidr::find for the policy it was built from.  The index may be
+ * rebuilt from a changed policy while other threads continue lookups, and
+ * a prior index is only freed once no lookup still uses it.  The index
+ * refers to the cidr objects of the policy, which must remain valid until
+ * the index is rebuilt or destroyed.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT cidr::table
+{
+private:
+    mutable atomic::pointer root;
+    mutable atomic::counter readers[2];
+    mutable atomic::counter phase;
+    atomic::spinlock writer;
+
+    __LOCAL void *enter(unsigned& reader) const;
+    __LOCAL void leave(unsigned reader) const;
+
+    table(const table& copy);
+    table& operator=(const table& copy);
+
+public:
+    /**
+     * Create an index, optionally from a policy.
+     * @param policy chain to build from.
+     */
+    table(const policy *policy = NULL);
+
+    /**
+     * Destroy index.  No lookups may still be running.
+     */
+    ~table();
+
+    /**
+     * Rebuild the index from a policy chain and swap it in.  Lookups
+     * started before the swap finish on the prior index, which is then
+     * freed.  Only one rebuild happens at a time.
+     * @param policy chain to build from.
+     * @return false if the index could not be allocated.
+     */
+    bool rebuild(const policy *policy);
+
+    /**
+     * Find the smallest cidr entry in the index that matches the socket
+     * address.
+     * @param address to search for.
+     * @return smallest cidr or NULL if none match.
+     */
+    const cidr *find(const struct sockaddr *address) const;
+
+    /**
+     * Get the number of cidr entries indexed.
+     * @return entries in index.
+     */
+    unsigned count(void) const;
+};
+
 /**
  * A generic socket base class.  This class can be used directly or as a
  * base class for building network protocol stacks.  This common base tries
@@ -778,6 +846,30 @@ public:
     inline int ttl(unsigned char time)
         {return ttl(so, time);};
 
+    /**
+     * Set default udp segmentation offload size for sends.
+     * @param size of each datagram sent, 0 to disable.
+     * @return 0 on success, error code if not supported.
+     */
+    inline int offload(unsigned size)
+        {return offload(so, size);};
+
+    /**
+     * Set udp receive offload to coalesce datagrams.
+     * @param enable coalescing if true.
+     * @return 0 on success, error code if not supported.
+     */
+    inline int coalesce(bool enable)
+        {return coalesce(so, enable);};
+
+    /**
+     * Set zero copy sending for the socket.
+     * @param enable zero copy if true.
+     * @return 0 on success, error code if not supported.
+     */
+    inline int zerocopy(bool enable)
+        {return zerocopy(so, enable);};
+
     /**
      * Set the size of the socket send buffer.
      * @param size of send buffer to set.
@@ -983,6 +1075,7 @@ public:
      * @param size of input line buffer.
      * @param timeout to wait for a complete input line.
      * @return number of bytes read, 0 if none, -1 if error.
+     * @see LineReader for servers that read many lines.
      */
     static ssize_t readline(socket_t socket, char *data, size_t size, timeout_t timeout = Timer::inf);
 
@@ -1179,6 +1272,35 @@ public:
      */
     static int ttl(socket_t socket, unsigned char time);
 
+    /**
+     * Set default udp segmentation offload size for a socket descriptor.
+     * Every large send is then split by the kernel, or the nic, into
+     * datagrams of this size.
+     * @param socket descriptor.
+     * @param size of each datagram sent, 0 to disable.
+     * @return 0 on success, error code if not supported.
+     */
+    static int offload(socket_t socket, unsigned size);
+
+    /**
+     * Set udp receive offload for a socket descriptor.  When enabled,
+     * datagrams of equal size from the same peer may be received together
+     * in one buffer, and recvsegments reports the size to split them by.
+     * @param socket descriptor.
+     * @param enable coalescing if true.
+     * @return 0 on success, error code if not supported.
+     */
+    static int coalesce(socket_t socket, bool enable);
+
+    /**
+     * Set zero copy sending for a socket descriptor.  This is needed
+     * before sending with MSG_ZEROCOPY, as ZeroCopy does.
+     * @param socket descriptor.
+     * @param enable zero copy if true.
+     * @return 0 on success, error code if not supported.
+     */
+    static int zerocopy(socket_t socket, bool enable);
+
     /**
      * Get the address family of the socket descriptor.
      * @return address family.
@@ -1258,6 +1380,35 @@ public:
      */
     static ssize_t recvinet(socket_t socket, void *buffer, size_t size, int flags = 0, struct sockaddr_internet *address = NULL);
 
+    /**
+     * Send a buffer as a train of equal sized datagrams.  Every segment
+     * size bytes of the buffer is sent as a datagram, with the last one
+     * holding what remains.  Where the kernel supports udp segmentation
+     * offload this is done with as few sends as the kernel limits allow,
+     * otherwise each datagram is sent separately.
+     * @param socket to send to.
+     * @param buffer to send.
+     * @param size of data buffer to send.
+     * @param segment size of each datagram.
+     * @param address of destination, NULL if connected.
+     * @return number of bytes sent, -1 if error.
+     */
+    static ssize_t sendsegments(socket_t socket, const void *buffer, size_t size, unsigned segment, const struct sockaddr *address = NULL);
+
+    /**
+     * Receive datagrams that may have been coalesced.  If coalesce was
+     * enabled, the buffer may hold several datagrams from the same peer,
+     * each of the segment size but the last, which may be shorter.  The
+     * buffer should be large enough for a coalesced receive, 64k.
+     * @param socket to get from.
+     * @param buffer to save.
+     * @param size of data buffer to request.
+     * @param segment size of datagrams received, or total if only one.
+     * @param address of source.
+     * @return number of bytes received, -1 if error.
+     */
+    static ssize_t recvsegments(socket_t socket, void *buffer, size_t size, unsigned *segment, struct sockaddr_storage *address = NULL);
+
     /**
      * Bind the socket descriptor to a known interface and service port.
      * @param socket descriptor to bind.
@@ -1655,6 +1806,589 @@ public:
     TCPServer(const char *address, const char *service, unsigned backlog = 5);
 };
 
+/**
+ * An event loop for many sockets serviced from a single thread.  Sockets
+ * are attached to the reactor through handler objects, which receive
+ * callbacks when their socket becomes readable or writable.  Handlers are
+ * also timer events on the reactor's timer queue, so an idle timeout can be
+ * armed on each connection and is dispatched from the same loop.  On linux
+ * this uses edge triggered epoll, so handlers must read or write until the
+ * socket would block.  Other platforms fall back to select, which limits
+ * the reactor to FD_SETSIZE sockets.  Handlers should only be attached,
+ * changed, armed, or detached from the thread that runs the reactor, while
+ * stop may be called from any thread.  A server would normally run one
+ * reactor per thread, each holding many idle connections.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT SocketReactor : protected TimerQueue
+{
+public:
+    /**
+     * Interest and event flags for a handler.
+     */
+    typedef enum {READ = 0x01, WRITE = 0x02, HANGUP = 0x04, EXPIRED = 0x08} event_t;
+
+    /**
+     * A socket serviced by a reactor.  The derived class implements the
+     * callbacks it is interested in.  A handler may detach and delete
+     * itself from within any of its callbacks.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT handler : public TimerQueue::event
+    {
+    private:
+        friend class SocketReactor;
+
+        SocketReactor *loop;
+        unsigned interest;
+
+    protected:
+        socket_t so;
+
+        /**
+         * Create a handler for a socket.  The handler does not own the
+         * socket and does not close it.
+         * @param socket to service.
+         * @param timeout for idle timer, 0 if none.
+         */
+        handler(socket_t socket, timeout_t timeout = 0);
+
+        /**
+         * Called when the socket has data pending or the peer closed.
+         */
+        virtual void readable(void);
+
+        /**
+         * Called when the socket can be written again.
+         */
+        virtual void writable(void);
+
+        /**
+         * Called when the socket has an error or was hung up.  By default
+         * the handler is detached from the reactor.
+         */
+        virtual void hangup(void);
+
+        /**
+         * Called when the handler's timer expires.  The timer is disarmed
+         * before this is called, and may be re-armed from here.
+         */
+        virtual void expired(void);
+
+    public:
+        /**
+         * Detach from reactor when destroyed.
+         */
+        virtual ~handler();
+
+        /**
+         * Get the reactor we are attached to.
+         * @return reactor or NULL if not attached.
+         */
+        inline SocketReactor *reactor(void) const
+            {return loop;};
+
+        /**
+         * Get the socket we service.
+         * @return socket descriptor.
+         */
+        inline socket_t handle(void) const
+            {return so;};
+    };
+
+    /**
+     * A handler that accepts connections from a listener.  Each pending
+     * connection is accepted and passed to accepted when the listener
+     * becomes readable.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT acceptor : public handler
+    {
+    protected:
+        /**
+         * Create an acceptor for a listening socket.
+         * @param listener to accept connections from.
+         */
+        acceptor(const ListenSocket& listener);
+
+        /**
+         * Accept all pending connections.
+         */
+        virtual void readable(void);
+
+        /**
+         * Retry accepting after running out of descriptors or memory.
+         */
+        virtual void expired(void);
+
+        /**
+         * Called for each newly accepted connection.  The new socket is
+         * owned by the derived class.
+         * @param socket of accepted connection.
+         * @param address of peer.
+         */
+        virtual void accepted(socket_t socket, struct sockaddr_storage *address) = 0;
+    };
+
+private:
+    enum {BATCH = 64};
+
+    int fd;
+    socket_t wake[2];
+    unsigned count;
+    volatile bool stopped;
+    unsigned current, pending;
+    handler *ready[BATCH];
+    unsigned flags[BATCH];
+
+    __LOCAL void cancel(handler *h);
+    __LOCAL void collect(timeout_t timeout);
+    __LOCAL void process(void);
+
+protected:
+    void modify(void);
+    void update(void);
+    void dispatch(event **list, unsigned count);
+
+public:
+    /**
+     * Create a reactor.
+     * @param resolution of timer wheel in milliseconds.
+     */
+    SocketReactor(timeout_t resolution = 1);
+
+    /**
+     * Destroy reactor.  Any handlers still attached are detached but not
+     * deleted, and their sockets are not closed.
+     */
+    virtual ~SocketReactor();
+
+    /**
+     * Attach a handler to the reactor.  The socket is set non-blocking
+     * and the handler's timer is placed on the reactor's timer queue.
+     * @param handler to attach.
+     * @param interest in READ and/or WRITE events.
+     * @return true if attached.
+     */
+    bool attach(handler *handler, unsigned interest = READ);
+
+    /**
+     * Change the events a handler is interested in.  With epoll this also
+     * re-reports readiness that is already pending.
+     * @param handler to change.
+     * @param interest in READ and/or WRITE events.
+     * @return true if changed.
+     */
+    bool change(handler *handler, unsigned interest);
+
+    /**
+     * Detach a handler from the reactor.  No further callbacks are made
+     * for the handler, including events already collected in this pass.
+     * @param handler to detach.
+     */
+    void detach(handler *handler);
+
+    /**
+     * Wait for and dispatch one pass of socket and timer events.
+     * @param timeout to wait for an event.
+     * @return false if the reactor was stopped.
+     */
+    bool poll(timeout_t timeout = Timer::inf);
+
+    /**
+     * Dispatch events until stopped.
+     */
+    void run(void);
+
+    /**
+     * Stop the reactor.  This may be called from any thread, and wakes the
+     * reactor if it is waiting.
+     */
+    void stop(void);
+
+    /**
+     * Get the number of attached handlers.
+     * @return handler count.
+     */
+    inline unsigned size(void) const
+        {return count;};
+
+    /**
+     * Test if the reactor could be created.
+     * @return true if usable.
+     */
+    inline bool is_valid(void) const
+        {return fd != -1;};
+};
+
+/**
+ * A buffered line reader for a connected stream socket.  Socket::readline
+ * peeks to find the end of line and then reads again to consume it, which
+ * costs two system calls per line.  The line reader instead receives large
+ * blocks into its own buffer and returns each line from there, so a burst
+ * of short lines is read with a single system call.  Lines can be taken
+ * in place without copying, or copied with the same newline handling as
+ * Socket::readline.  Data past the last line stays buffered, so reads from
+ * the socket itself should go through the reader once it is in use.  For
+ * non-blocking sockets an incomplete line is kept until the rest arrives.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT LineReader
+{
+private:
+    socket_t so;
+    char *buffer;
+    size_t bufsize, head, tail, scan;
+    int ioerr;
+    bool eof;
+
+    __LOCAL bool fill(timeout_t timeout);
+    __LOCAL char *fetch(size_t limit, size_t& count, timeout_t timeout);
+
+public:
+    /**
+     * Create a line reader for a socket.  The reader does not own the
+     * socket.
+     * @param socket to read from.
+     * @param size of receive buffer, which is also the longest line.
+     */
+    LineReader(socket_t socket, size_t size = 4096);
+
+    /**
+     * Release receive buffer.
+     */
+    ~LineReader();
+
+    /**
+     * Get the next line in place.  The trailing newline, and a carriage
+     * return before it, are removed and the line is NULL terminated in
+     * the reader's buffer.  The line remains valid until the next call.
+     * A line longer than the buffer is returned in buffer sized pieces,
+     * and a final line without a newline is returned at end of data.
+     * @param length of line returned, if not NULL.
+     * @param timeout to wait for more data, 0 to only read what is ready.
+     * @return line or NULL if none, err() has error.
+     */
+    char *getline(size_t *length = NULL, timeout_t timeout = Timer::inf);
+
+    /**
+     * Read a newline of text data and save in NULL terminated string.
+     * This follows the semantics of Socket::readline, including the size
+     * returned counting the dropped newline.
+     * @param data to save input line.
+     * @param size of input line buffer.
+     * @param timeout to wait for a complete input line.
+     * @return number of bytes read, 0 if none, -1 if error.
+     */
+    ssize_t readline(char *data, size_t size, timeout_t timeout = Timer::inf);
+
+    /**
+     * Read data following a line, such as a message body.  Buffered data
+     * is returned first, and only when the buffer is empty is the socket
+     * read directly.
+     * @param data to save into.
+     * @param size of data to read.
+     * @param timeout to wait for data.
+     * @return number of bytes read, 0 if none, -1 if error.
+     */
+    ssize_t read(void *data, size_t size, timeout_t timeout = Timer::inf);
+
+    /**
+     * Get the number of bytes received but not yet returned.
+     * @return bytes buffered.
+     */
+    inline size_t pending(void) const
+        {return tail - head;};
+
+    /**
+     * Test if the peer closed the connection.  Lines still buffered may
+     * be returned after this is set.
+     * @return true if end of data reached.
+     */
+    inline bool is_eof(void) const
+        {return eof;};
+
+    /**
+     * Get error code of last operation.
+     * @return error code or 0 if none.
+     */
+    inline int err(void) const
+        {return ioerr;};
+
+    /**
+     * Get the socket we read from.
+     * @return socket descriptor.
+     */
+    inline socket_t handle(void) const
+        {return so;};
+};
+
+/**
+ * A batch of datagrams for a socket.  Socket::readfrom and Socket::writeto
+ * move one datagram for each system call, which limits busy udp services.
+ * A packet batch keeps a preallocated buffer for each of a number of
+ * datagrams, and receives or sends all of them with a single system call
+ * where recvmmsg and sendmmsg are available.  Each packet records it's
+ * peer as an internet socket address, so received packets can be changed
+ * in place and sent back as replies.  Elsewhere the batch is moved one
+ * datagram at a time.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT PacketBatch
+{
+public:
+    /**
+     * A datagram in the batch.
+     */
+    typedef struct {
+        caddr_t data;
+        size_t length;
+        struct sockaddr_internet address;
+    } packet_t;
+
+private:
+    socket_t so;
+    caddr_t buffers;
+    packet_t *list;
+    void *headers;
+    unsigned limit, used;
+    size_t mtu;
+    int ioerr;
+
+    PacketBatch(const PacketBatch& copy);
+    PacketBatch& operator=(const PacketBatch& copy);
+
+public:
+    /**
+     * Create a packet batch for a socket.  The batch does not own the
+     * socket.
+     * @param socket to receive and send on.
+     * @param count of packets in the batch.
+     * @param size of each packet buffer.
+     */
+    PacketBatch(socket_t socket, unsigned count = 32, size_t size = 2048);
+
+    /**
+     * Release packet buffers.
+     */
+    ~PacketBatch();
+
+    /**
+     * Receive a batch of datagrams.  This waits for the first datagram,
+     * and then takes whatever else is already queued, up to the size of
+     * the batch.  Packets held before are replaced.
+     * @param timeout to wait for the first datagram, 0 to not wait.
+     * @return number of packets received, 0 if none, err() has error.
+     */
+    unsigned recv(timeout_t timeout = Timer::inf);
+
+    /**
+     * Send the packets held in the batch.  Packets with no address are
+     * sent to the peer of a connected socket.
+     * @return number of packets sent from the start of the batch.
+     */
+    unsigned send(void);
+
+    /**
+     * Add a packet to send.  The data is copied into the next buffer.
+     * @param data to send.
+     * @param size of data.
+     * @param address of peer, or NULL if connected.
+     * @return true if added, false if batch full or data too large.
+     */
+    bool put(const void *data, size_t size, const struct sockaddr *address = NULL);
+
+    /**
+     * Remove all packets from the batch.
+     */
+    inline void clear(void)
+        {used = 0;};
+
+    /**
+     * Get the number of packets held.
+     * @return packets in batch.
+     */
+    inline unsigned count(void) const
+        {return used;};
+
+    /**
+     * Get the number of packets the batch can hold.
+     * @return size of batch.
+     */
+    inline unsigned size(void) const
+        {return limit;};
+
+    /**
+     * Get the size of each packet buffer.
+     * @return buffer size.
+     */
+    inline size_t max(void) const
+        {return mtu;};
+
+    /**
+     * Get error code of last operation.
+     * @return error code or 0 if none.
+     */
+    inline int err(void) const
+        {return ioerr;};
+
+    /**
+     * Get the socket we use.
+     * @return socket descriptor.
+     */
+    inline socket_t handle(void) const
+        {return so;};
+
+    /**
+     * Access a packet in the batch.
+     * @param index of packet.
+     * @return packet.
+     */
+    inline packet_t& operator[](unsigned index)
+        {return list[index];};
+};
+
+/**
+ * Zero copy sender for large stream payloads.  Large buffers are sent
+ * with MSG_ZEROCOPY, so the kernel transmits straight from the caller's
+ * memory rather than copying it into the socket.  The caller must not
+ * change or free a buffer until it is passed back through the release
+ * callback, which happens once the kernel reports completion on the socket
+ * error queue.  Buffers smaller than the threshold, and all buffers where
+ * zero copy is not supported, are sent normally and released at once.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT ZeroCopy
+{
+public:
+    /**
+     * Callback to pass a buffer back to its owner.
+     */
+    typedef void (*release_t)(void *user, const void *buffer, size_t size);
+
+private:
+    typedef struct {
+        const void *buffer;
+        size_t size;
+        uint32_t first, count, done;
+    } pending_t;
+
+    socket_t so;
+    release_t callback;
+    void *user;
+    pending_t *list, *filling;
+    unsigned limit, head, used, active;
+    unsigned long copies;
+    size_t minsize;
+    uint32_t sequence;
+    bool enabled;
+    int ioerr;
+
+    ZeroCopy(const ZeroCopy& copy);
+    ZeroCopy& operator=(const ZeroCopy& copy);
+
+    void complete(uint32_t low, uint32_t high);
+
+    size_t write(const void *buffer, size_t size, int flags, timeout_t timeout);
+
+public:
+    /**
+     * Create a zero copy sender for a connected socket.  This enables
+     * zero copy on the socket if supported.  The sender does not own the
+     * socket.
+     * @param socket to send on.
+     * @param release callback for buffers that were sent.
+     * @param user data passed to callback.
+     * @param threshold size below which buffers are copied.
+     * @param count of buffers that may be in flight.
+     */
+    ZeroCopy(socket_t socket, release_t release, void *user = NULL, size_t threshold = 16384, unsigned count = 64);
+
+    /**
+     * Reap any completions and release only the buffers that completed.
+     * Buffers still in flight are never passed back, as the kernel may
+     * still be sending from them, so use drain first to get them all.
+     */
+    ~ZeroCopy();
+
+    /**
+     * Send a buffer.  This waits if the socket is full, or if the limit of
+     * buffers in flight is reached.  The buffer is released through the
+     * callback once, even if only part of it was sent.
+     * @param buffer to send.
+     * @param size of buffer.
+     * @param timeout to wait for socket, 0 to not wait.
+     * @return number of bytes sent.
+     */
+    size_t send(const void *buffer, size_t size, timeout_t timeout = Timer::inf);
+
+    /**
+     * Release buffers whose sends completed.
+     * @param timeout to wait for a completion, 0 to not wait.
+     * @return number of buffers released.
+     */
+    unsigned reap(timeout_t timeout = 0);
+
+    /**
+     * Wait until all buffers in flight are released.
+     * @param timeout to wait for each completion.
+     * @return true if none are still in flight.
+     */
+    bool drain(timeout_t timeout = Timer::inf);
+
+    /**
+     * Forget buffers still in flight without releasing them.  This is for
+     * a socket closed before the kernel was done with them, as the owner
+     * may not reuse or free memory the kernel may still be sending from.
+     */
+    void abandon(void);
+
+    /**
+     * Pass a buffer back to its owner through the release callback.  This
+     * is for buffers the owner copied elsewhere instead of sending here.
+     * @param buffer to release.
+     * @param size of buffer.
+     */
+    inline void release(const void *buffer, size_t size)
+        {callback(user, buffer, size);};
+
+    /**
+     * Get the number of buffers still in flight.
+     * @return buffers not yet released.
+     */
+    inline unsigned pending(void) const
+        {return active;};
+
+    /**
+     * Get the size below which buffers are copied.
+     * @return threshold in bytes.
+     */
+    inline size_t threshold(void) const
+        {return minsize;};
+
+    /**
+     * Get the number of zero copy sends the kernel copied anyway, such as
+     * over loopback.  If this grows with sends, zero copy is not helping.
+     * @return sends copied by kernel.
+     */
+    inline unsigned long copied(void) const
+        {return copies;};
+
+    /**
+     * Check if zero copy is active on the socket.
+     * @return true if sending with zero copy.
+     */
+    inline bool is_enabled(void) const
+        {return enabled;};
+
+    /**
+     * Get last error from a send or reap.
+     * @return error number of last error.
+     */
+    inline int err(void) const
+        {return ioerr;};
+};
+
 /**
  * Helper function for linked_pointer<struct sockaddr>.
  */
@@ -1833,6 +2567,14 @@ String str(Socket& so, strsize_t size);
 
 typedef TCPServer   tcpserv_t;
 
+typedef SocketReactor reactor_t;
+
+typedef LineReader linereader_t;
+
+typedef PacketBatch packets_t;
+
+typedef ZeroCopy zerocopy_t;
+
 END_NAMESPACE
 
 #endif
@@ -69,10 +69,167 @@
 #include <ucommon/memory.h>
 #endif
 
+#ifndef _UCOMMON_ATOMIC_H_
+#include <ucommon/atomic.h>
+#endif
+
+#if defined(UCOMMON_PROFILING) && (defined(_MSWINDOWS_) || defined(__PTH__))
+#undef  UCOMMON_PROFILING
+#endif
+
 NAMESPACE_UCOMMON
 
 class SharedPointer;
 
+/**
+ * Lock contention profile.  When the library and application are built
+ * with UCOMMON_PROFILING, every Mutex and every lock built on a Conditional
+ * counts how often it was acquired, how often a thread had to wait for it,
+ * and how long threads waited for and held it.  Waits on a conditional
+ * are counted apart, as idle time rather than contention.  Locks such as
+ * RecursiveMutex and ThreadLock that are built from a conditional are
+ * measured at their own lock and release, including waits for the holder.  Locks can be given a name,
+ * and a registry lists and dumps all the locks that exist.  Without
+ * UCOMMON_PROFILING this is an empty base class, naming a lock does
+ * nothing, and the registry is always empty, so there is no overhead.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT LockProfile
+{
+public:
+    /**
+     * Snapshot of lock statistics.  Times are in nanoseconds.
+     */
+    typedef struct {
+        const char *name;
+        const void *lock;
+        unsigned long acquired, contended, waited;
+        uint64_t wait, maxwait, idle, hold, maxhold;
+    } stats_t;
+
+#ifdef  UCOMMON_PROFILING
+private:
+    LockProfile *next, *prev;
+    const char *id;
+    unsigned long acquired, contended, waited;
+    uint64_t wait, maxwait, idle, hold, maxhold, held;
+    bool composite, stalled;
+
+    __LOCAL void enlist(void);
+
+protected:
+    LockProfile();
+    LockProfile(const LockProfile& copy);
+    ~LockProfile();
+
+    inline LockProfile& operator=(const LockProfile&)
+        {return *this;};
+
+    /**
+     * Lock a mutex and record the acquisition.
+     * @param mutex to lock.
+     */
+    void locking(pthread_mutex_t *mutex);
+
+    /**
+     * Record the hold time and unlock a mutex.
+     * @param mutex to unlock.
+     */
+    void unlocking(pthread_mutex_t *mutex);
+
+    /**
+     * Record the hold time before a conditional wait releases the mutex.
+     * @return time the wait started.
+     */
+    uint64_t blocking(void);
+
+    /**
+     * Record a conditional wait once the mutex is held again.  Time
+     * spent waiting to be signalled is idle time, not contention.
+     * @param start of wait.
+     */
+    void blocked(uint64_t start);
+
+    /**
+     * Profile a lock built on this one at its own boundaries, rather than
+     * the supporting mutex and conditional waits it uses internally.
+     */
+    inline void compose(void)
+        {composite = true;};
+
+    /**
+     * Note when a composed lock starts to be acquired.
+     * @return time of request.
+     */
+    uint64_t acquiring(void);
+
+    /**
+     * Record acquiring a composed lock.  This is called with the
+     * supporting mutex held.
+     * @param start of request.
+     * @param delayed if another holder had to be waited for.
+     * @param exclusive if held exclusively, to time how long it is held.
+     */
+    void entered(uint64_t start, bool delayed, bool exclusive = true);
+
+    /**
+     * Record the hold time of an exclusive holder of a composed lock.
+     * This is called with the supporting mutex held.
+     */
+    void leaving(void);
+
+public:
+    /**
+     * Name the lock in the profile registry.
+     * @param name to use, which must remain valid for the life of the lock.
+     */
+    inline void profile(const char *name)
+        {id = name;};
+#else
+protected:
+    inline void compose(void)
+        {};
+
+    inline uint64_t acquiring(void)
+        {return 0;};
+
+    inline void entered(uint64_t, bool, bool = true)
+        {};
+
+    inline void leaving(void)
+        {};
+
+public:
+    inline void profile(const char *)
+        {};
+#endif
+
+    /**
+     * Get the number of locks in the registry.
+     * @return count of locks.
+     */
+    static unsigned count(void);
+
+    /**
+     * Copy statistics of the locks in the registry.
+     * @param list to fill.
+     * @param max entries in list.
+     * @return number of entries filled.
+     */
+    static unsigned snapshot(stats_t *list, unsigned max);
+
+    /**
+     * Print statistics of every lock that was acquired to a file.
+     * @param output file to print to.
+     */
+    static void dump(FILE *output);
+
+    /**
+     * Reset statistics of every lock in the registry.
+     */
+    static void reset(void);
+};
+
 /**
  * The conditional is a common base for other thread synchronizing classes.
  * Many of the complex sychronization objects, including barriers, semaphores,
@@ -83,7 +240,7 @@ class SharedPointer;
  * behaviors on different pthread implimentations and platforms.
  * @author David Sugar <dyfet@gnutelephony.org>
  */
-class __EXPORT Conditional
+class __EXPORT Conditional : public LockProfile
 {
 private:
     friend class ConditionalAccess;
@@ -141,6 +298,21 @@ protected:
     void signal(void);
     void broadcast(void);
 
+#elif defined(UCOMMON_PROFILING)
+    inline void lock(void)
+        {locking(&mutex);};
+
+    inline void unlock(void)
+        {unlocking(&mutex);};
+
+    void wait(void);
+
+    inline void signal(void)
+        {pthread_cond_signal(&cond);};
+
+    inline void broadcast(void)
+        {pthread_cond_broadcast(&cond);};
+
 #else
     /**
      * Lock the conditional's supporting mutex.
@@ -259,6 +431,21 @@ protected:
     inline static void set(struct timespec *hires, timeout_t timeout)
         {Conditional::set(hires, timeout);};
 
+    /**
+     * Profile a lock built on this one at its own boundaries.
+     */
+    inline void compose(void)
+        {Conditional::compose();};
+
+    inline uint64_t acquiring(void)
+        {return Conditional::acquiring();};
+
+    inline void entered(uint64_t start, bool delayed, bool exclusive = true)
+        {Conditional::entered(start, delayed, exclusive);};
+
+    inline void leaving(void)
+        {Conditional::leaving();};
+
 
 #ifdef  _MSWINDOWS_
     inline void lock(void)
@@ -276,6 +463,22 @@ protected:
     inline void broadcast(void)
         {Conditional::broadcast();};
 
+#elif defined(UCOMMON_PROFILING)
+    inline void lock(void)
+        {locking(&mutex);};
+
+    inline void unlock(void)
+        {unlocking(&mutex);};
+
+    void waitSignal(void);
+    void waitBroadcast(void);
+
+    inline void signal(void)
+        {pthread_cond_signal(&cond);};
+
+    inline void broadcast(void)
+        {pthread_cond_broadcast(&bcast);};
+
 #else
     /**
      * Lock the conditional's supporting mutex.
@@ -325,6 +528,13 @@ public:
      */
     ~ConditionalAccess();
 
+    /**
+     * Name the lock in the profile registry.
+     * @param name to use.
+     */
+    inline void profile(const char *name)
+        {Conditional::profile(name);};
+
     /**
      * Access mode shared thread scheduling.
      */
@@ -481,6 +691,13 @@ public:
      * Release or decrease locking.
      */
     void release(void);
+
+    /**
+     * Name the lock in the profile registry.
+     * @param name to use.
+     */
+    inline void profile(const char *name)
+        {Conditional::profile(name);};
 };
 
 /**
@@ -613,6 +830,13 @@ public:
      */
     ThreadLock();
 
+    /**
+     * Name the lock in the profile registry.
+     * @param name to use.
+     */
+    inline void profile(const char *name)
+        {ConditionalAccess::profile(name);};
+
     /**
      * Request modify (write) access through the lock.
      * @param timeout in milliseconds to wait for lock.
@@ -635,6 +859,19 @@ public:
      */
     static void indexing(unsigned size);
 
+    /**
+     * Use a fixed table of cache line padded rwlocks for reader and writer
+     * rather than the hash indexed list of dynamic locks.  Objects are
+     * hashed directly to a stripe, so no index lock is taken.  Objects that
+     * share a stripe share a lock, so a thread must not hold a read lock
+     * on one object while requesting write access to another.  This should
+     * be called at initialization time from the main thread before any
+     * other threads are created.
+     * @param count of stripes, rounded up to a power of 2, or 0 for a default
+     * based on the number of processors.
+     */
+    static void striping(unsigned count = 0);
+
     /**
       * Write protect access to an arbitrary object.  This is like the
       * protect function of mutex.
@@ -741,6 +978,13 @@ public:
      */
     ~ConditionalLock();
 
+    /**
+     * Name the lock in the profile registry.
+     * @param name to use.
+     */
+    inline void profile(const char *name)
+        {ConditionalAccess::profile(name);};
+
     /**
      * Acquire write (exclusive modify) lock.
      */
@@ -916,7 +1160,7 @@ public:
  * access by reducing the chance for collisions on the primary index mutex.
  * @author David Sugar <dyfet@gnutelephony.org>
  */
-class __EXPORT Mutex : public ExclusiveAccess
+class __EXPORT Mutex : public ExclusiveAccess, public LockProfile
 {
 protected:
     pthread_mutex_t mlock;
@@ -987,6 +1231,19 @@ public:
      */
     ~Mutex();
 
+#ifdef  UCOMMON_PROFILING
+    inline void acquire(void)
+        {locking(&mlock);};
+
+    inline void lock(void)
+        {locking(&mlock);};
+
+    inline void unlock(void)
+        {unlocking(&mlock);};
+
+    inline void release(void)
+        {unlocking(&mlock);};
+#else
     /**
      * Acquire mutex lock.  This is a blocking operation.
      */
@@ -1010,6 +1267,7 @@ public:
      */
     inline void release(void)
         {pthread_mutex_unlock(&mlock);};
+#endif
 
     /**
      * Convenience function to acquire os native mutex lock directly.
@@ -1033,6 +1291,19 @@ public:
      */
     static void indexing(unsigned size);
 
+    /**
+     * Use a fixed table of cache line padded recursive mutexes for protect
+     * and release rather than the hash indexed list of dynamic mutexes.
+     * Objects are hashed directly to a stripe, so an uncontended protect
+     * is a single mutex lock.  Objects that share a stripe also share
+     * their lock, so threads which nest protect calls must always do so
+     * in a consistent order.  This should be called at initialization time
+     * from the main thread before any other threads are created.
+     * @param count of stripes, rounded up to a power of 2, or 0 for a default
+     * based on the number of processors.
+     */
+    static void striping(unsigned count = 0);
+
     /**
      * Specify pointer/object/resource to guard protect.  This uses a
      * dynamically managed mutex.
@@ -1047,6 +1318,77 @@ public:
     static void release(const void *pointer);
 };
 
+/**
+ * A big reader lock for read mostly data.  Each reader only touches the
+ * cache line padded slot of the cpu it entered on, so readers on different
+ * cores never contend with each other.  The slot is remembered for the
+ * thread, so a reader that moves to another cpu still leaves the slot it
+ * entered.  A writer serializes with other writers, raises a writing flag,
+ * and then waits for each reader slot in turn to drain.  Readers that arrive while a writer is active back out and queue
+ * behind it.  This makes reads very cheap and writes expensive.  Both the
+ * exclusive and shared protocols are implemented, so it may be used with
+ * exclusive_access and shared_access.  Neither mode is recursive.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT BigReaderLock : public ExclusiveAccess, public SharedAccess
+{
+private:
+    atomic::sharded readers;
+    atomic::counter writing;
+    Mutex writer;
+
+#if defined(__PTH__)
+    pth_key_t key;
+#elif defined(_MSWINDOWS_)
+    DWORD key;
+#else
+    pthread_key_t key;
+#endif
+
+    BigReaderLock(const BigReaderLock& copy);
+    BigReaderLock& operator=(const BigReaderLock& copy);
+
+protected:
+    virtual void _lock(void);
+    virtual void _share(void);
+    virtual void _unlock(void);
+
+public:
+    /**
+     * Create a big reader lock.
+     * @param count of reader slots, 0 for one for each cpu.
+     */
+    BigReaderLock(unsigned count = 0);
+
+    /**
+     * Destroy the lock.
+     */
+    ~BigReaderLock();
+
+    /**
+     * Request modify (write) access through the lock.  This waits for
+     * all current readers to leave.
+     */
+    void modify(void);
+
+    /**
+     * Request shared (read) access through the lock.
+     */
+    void access(void);
+
+    /**
+     * Release the lock, whether held for modify or access.
+     */
+    void release(void);
+
+    /**
+     * Get the number of reader slots.
+     * @return reader slots in lock.
+     */
+    inline unsigned size(void) const
+        {return readers.size();};
+};
+
 /**
  * A mutex locked object smart pointer helper class.  This is particularly
  * useful in referencing objects which will be protected by the mutex
@@ -1181,6 +1523,67 @@ public:
     virtual ~SharedObject();
 };
 
+/**
+ * A sequence lock for small shared snapshots.  Readers never write to
+ * shared memory; they copy the protected data and retry if a writer
+ * changed it while they were copying.  Writers are serialized with a mutex
+ * and make the sequence odd while an update is in progress.  This class is
+ * used to support the templated seqlock_of class, and copies raw memory,
+ * so it is only suited for plain data without pointers to owned memory.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT SequenceLock
+{
+private:
+    atomic::counter sequence;
+    Mutex writer;
+
+    SequenceLock(const SequenceLock& copy);
+    SequenceLock& operator=(const SequenceLock& copy);
+
+protected:
+    /**
+     * Create a sequence lock.
+     */
+    SequenceLock();
+
+    /**
+     * Copy a consistent snapshot of protected data.
+     * @param target to copy into.
+     * @param source of protected data.
+     * @param size of data.
+     */
+    void read(void *target, const void *source, size_t size);
+
+    /**
+     * Update protected data.
+     * @param target protected data to update.
+     * @param source of new data.
+     * @param size of data.
+     */
+    void write(void *target, const void *source, size_t size);
+
+    /**
+     * Begin an in place update of protected data.  Readers retry until
+     * commit is called.
+     */
+    void modify(void);
+
+    /**
+     * Finish an in place update.
+     */
+    void commit(void);
+
+public:
+    /**
+     * Get the number of updates made so far.  This can be used to check
+     * if a snapshot is stale without copying it again.
+     * @return number of completed updates.
+     */
+    inline unsigned long generation(void)
+        {return (unsigned long)sequence.load() >> 1;};
+};
+
 /**
  * The shared pointer is used to manage a singleton instance of shared object.
  * This class is used to support the templated shared_pointer class and the
@@ -1225,6 +1628,190 @@ protected:
     SharedObject *share(void);
 };
 
+/**
+ * An epoch based reclamation domain.  Lock free structures cannot free a
+ * node when it is unlinked, because other threads may still be reading it.
+ * Readers instead enter the domain around each access, and nodes that are
+ * unlinked are retired to the domain rather than freed.  A retired node is
+ * only released once every thread that was inside the domain at the time
+ * has left it, which the domain detects by advancing a global epoch.  Each
+ * thread is registered with the domain the first time it enters, using a
+ * thread-specific data key, and the registration is re-used by a later
+ * thread when it exits.  Registering takes the domain lock, but once a
+ * thread is registered, entering and leaving never block or lock.
+ * Retired nodes are reclaimed in batches from retire once enough have
+ * gathered.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT EpochDomain
+{
+public:
+    /**
+     * Function used to release a retired node.
+     */
+    typedef void (*release_t)(void *object);
+
+    /**
+     * Guard class to apply scope based access to an epoch domain.  The
+     * thread enters the domain when the guard is created, and leaves when
+     * it falls out of scope.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT guard
+    {
+    private:
+        EpochDomain *domain;
+
+    public:
+        /**
+         * Enter a domain for the life of the guard.
+         * @param domain to enter.
+         */
+        guard(EpochDomain *domain);
+
+        /**
+         * Leave domain when guard falls out of scope.
+         */
+        ~guard();
+
+        /**
+         * Prematurely leave the domain.
+         */
+        void release(void);
+    };
+
+private:
+    class record;
+    class retired;
+
+    record *records;
+    retired *limbo[3];
+    unsigned threshold, retires, count;
+    atomic::counter epoch;
+    Mutex lock;
+
+#if defined(__PTH__)
+    pth_key_t key;
+#elif defined(_MSWINDOWS_)
+    DWORD key;
+#else
+    pthread_key_t key;
+#endif
+
+    EpochDomain(const EpochDomain& copy);
+    EpochDomain& operator=(const EpochDomain& copy);
+
+    __LOCAL record *attach(void);
+    __LOCAL record *current(void);
+    __LOCAL retired *advance(void);
+    __LOCAL static void release(retired *list);
+
+public:
+    /**
+     * Create an epoch domain.
+     * @param threshold of retired nodes before reclaiming.
+     */
+    EpochDomain(unsigned threshold = 64);
+
+    /**
+     * Destroy domain.  Any nodes still retired are released, so no thread
+     * may still be inside the domain.
+     */
+    ~EpochDomain();
+
+    /**
+     * Enter a critical section.  Nodes reachable from the structure while
+     * inside will not be released until the thread leaves.  Sections may
+     * be nested.  The first enter from a thread registers it, which takes
+     * the domain lock and may allocate a record.
+     */
+    void enter(void);
+
+    /**
+     * Leave a critical section.
+     */
+    void leave(void);
+
+    /**
+     * Retire a node that was unlinked from a shared structure.  The node
+     * is released once no thread can still be reading it.
+     * @param object to retire.
+     * @param release function to call for object.
+     */
+    void retire(void *object, release_t release);
+
+    /**
+     * Try to advance the epoch and release nodes that are now safe.  This
+     * is called from retire, but may also be called from an idle thread.
+     * @return true if the epoch was advanced.
+     */
+    bool reclaim(void);
+
+    /**
+     * Wait until every node retired so far is released.  This must not be
+     * called from inside the domain.
+     */
+    void synchronize(void);
+
+    /**
+     * Get the number of retired nodes waiting to be released.
+     * @return pending nodes.
+     */
+    unsigned pending(void);
+
+    /**
+     * Get the number of threads that have been registered.
+     * @return count of thread records.
+     */
+    unsigned threads(void);
+};
+
+/**
+ * A read copy update pointer to a singleton object.  This is used much like
+ * a shared pointer, but readers do not take any lock.  A reader enters the
+ * epoch domain of the pointer, and the object it gets stays valid until it
+ * leaves.  A writer replaces the object with a new copy, and the prior one
+ * is retired to the domain.  This class is used to support the templated
+ * rcu_pointer class, and is not meant to be used directly.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT RCUPointer
+{
+private:
+    atomic::pointer pointer;
+    EpochDomain::release_t release;
+
+    RCUPointer(const RCUPointer& copy);
+    RCUPointer& operator=(const RCUPointer& copy);
+
+protected:
+    EpochDomain *domain;
+
+    /**
+     * Create pointer in an epoch domain.
+     * @param domain to retire objects to.
+     * @param release function for objects.
+     */
+    RCUPointer(EpochDomain *domain, EpochDomain::release_t release);
+
+    /**
+     * Retire the current object.
+     */
+    ~RCUPointer();
+
+    /**
+     * Replace the current object.  The prior object is retired.
+     * @param object to publish.
+     */
+    void replace(void *object);
+
+    /**
+     * Get the current object.  The caller must be inside the domain.
+     * @return current object.
+     */
+    void *get(void);
+};
+
 /**
  * An abstract class for defining classes that operate as a thread.  A derived
  * thread class has a run method that is invoked with the newly created
@@ -1237,6 +1824,87 @@ protected:
  */
 class __EXPORT Thread
 {
+public:
+    /**
+     * A set of processors.  This is used to bind threads to processors
+     * and to report processor topology.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT cpuset
+    {
+    private:
+        enum {LIMIT = 1024, WORD = sizeof(unsigned long) * 8};
+
+        unsigned long bits[LIMIT / WORD];
+
+    public:
+        /**
+         * Create an empty set.
+         */
+        cpuset();
+
+        /**
+         * Remove all processors from the set.
+         */
+        void clear(void);
+
+        /**
+         * Add a processor to the set.
+         * @param cpu to add.
+         */
+        void add(unsigned cpu);
+
+        /**
+         * Remove a processor from the set.
+         * @param cpu to remove.
+         */
+        void remove(unsigned cpu);
+
+        /**
+         * Test if a processor is in the set.
+         * @param cpu to test.
+         * @return true if in set.
+         */
+        bool has(unsigned cpu) const;
+
+        /**
+         * Get the number of processors in the set.
+         * @return processors in set.
+         */
+        unsigned count(void) const;
+
+        /**
+         * Add processors from a linux style list, such as "0-3,8".
+         * @param list of processors.
+         * @return true if list was valid.
+         */
+        bool parse(const char *list);
+
+        /**
+         * Get the largest processor number a set can hold.
+         * @return size of sets.
+         */
+        inline static unsigned size(void)
+            {return LIMIT;};
+
+        inline bool operator!() const
+            {return count() == 0;};
+    };
+
+    /**
+     * Placement of a processor in the system topology.
+     */
+    typedef struct {
+        int core;
+        int package;
+        int node;
+        cpuset siblings;
+    } topology_t;
+
+private:
+    Thread(const Thread& copy);
+    Thread& operator=(const Thread& copy);
+
 protected:
 // may be used in future if we need cancelable threads...
 #ifdef  _MSWINDOWS_
@@ -1249,6 +1917,9 @@ protected:
     pthread_t tid;
     size_t stack;
     int priority;
+    int node;
+    cpuset *cpumask;
+    bool placed;
 
     /**
      * Create a thread object that will have a preset stack size.  If 0
@@ -1277,6 +1948,36 @@ public:
      */
     void setPriority(void);
 
+    /**
+     * Apply the processor and node placement of the thread.  This is
+     * called when the thread starts, and is meant for internal use.
+     */
+    void setPlacement(void);
+
+    /**
+     * Bind the thread to a set of processors when it is started.
+     * @param set of processors to run on.
+     */
+    void pin(const cpuset& set);
+
+    /**
+     * Place the thread on a numa node when it is started.  Unless the
+     * thread is also pinned, it is bound to the processors of the node.
+     * Memory the thread first touches, including it's stack and thread
+     * arenas, is then preferably allocated from the node.
+     * @param node to place thread on, or -1 for none.
+     */
+    void place(int node);
+
+    /**
+     * Check if the processor placement of the thread was applied when it
+     * started.  This is meaningful from within run, or once the thread
+     * was joined.
+     * @return true if bound as requested, or if no placement was requested.
+     */
+    inline bool is_placed(void) const
+        {return placed;};
+
     /**
      * Yield execution context of the current thread. This is a static
      * and may be used anywhere.
@@ -1335,6 +2036,64 @@ public:
      */
     static void concurrency(int level);
 
+    /**
+     * Get the number of processors online.  This is useful for sizing
+     * pools of worker threads.
+     * @return number of processors, at least 1.
+     */
+    static unsigned cpus(void);
+
+    /**
+     * Bind the current thread to a single processor.
+     * @param cpu to run on, from 0 to cpus() - 1.
+     * @return true if bound, false if not supported or invalid.
+     */
+    static bool affinity(unsigned cpu);
+
+    /**
+     * Bind the current thread to a set of processors.
+     * @param set of processors to run on.
+     * @return true if bound, false if not supported or invalid.
+     */
+    static bool affinity(const cpuset& set);
+
+    /**
+     * Get the processors the current thread may run on, as limited by its
+     * affinity, and by any cpuset or container it runs in.
+     * @param set to fill with allowed processors.
+     * @return true if known.
+     */
+    static bool allowed(cpuset& set);
+
+    /**
+     * Prefer memory from a numa node for the current thread.
+     * @param node to allocate from, or -1 for the system default.
+     * @return true if set, false if not supported.
+     */
+    static bool prefer(int node);
+
+    /**
+     * Get the number of numa nodes.
+     * @return number of nodes, at least 1.
+     */
+    static unsigned nodes(void);
+
+    /**
+     * Get the processors of a numa node.
+     * @param node to query.
+     * @param set to fill with processors of node.
+     * @return true if found.
+     */
+    static bool nodeset(unsigned node, cpuset& set);
+
+    /**
+     * Get the placement of a processor from the system topology.
+     * @param cpu to query.
+     * @param info to fill in.
+     * @return true if topology is known.
+     */
+    static bool topology(unsigned cpu, topology_t& info);
+
     /**
      * Determine if two thread identifiers refer to the same thread.
      * @param thread1 to test.
@@ -1471,6 +2230,145 @@ public:
     void start(int priority = 0);
 };
 
+/**
+ * A pool of worker threads that run submitted tasks.  Rather than creating
+ * a thread for each unit of work, tasks are queued to a fixed set of worker
+ * threads created when the pool is constructed, one per processor by
+ * default.  Each worker has its own deque of tasks which it runs newest
+ * first, and idle workers steal the oldest tasks from other workers, so
+ * workers rarely contend for the same queue.  Tasks submitted from within
+ * a worker go to that worker's own deque.  A task may be waited on for
+ * completion, and a worker waiting on a task runs other tasks meanwhile.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT ThreadPool : protected Conditional
+{
+public:
+    /**
+     * A unit of work run by a thread pool.  Derived classes implement the
+     * run method.  Once submitted, the task must not be deleted or
+     * re-submitted until it has completed.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT task
+    {
+    private:
+        friend class ThreadPool;
+
+        ThreadPool *pool;
+        task *next;
+        atomic::counter pending;
+
+    protected:
+        /**
+         * Work to perform in a worker thread.
+         */
+        virtual void run(void) = 0;
+
+    public:
+        /**
+         * Create a task that is not yet submitted.
+         */
+        task();
+
+        /**
+         * Destroy task.  The task must not still be pending.
+         */
+        virtual ~task();
+
+        /**
+         * Wait for a submitted task to complete.  If called from a worker
+         * of the same pool, other tasks are run while waiting.
+         * @param timeout to wait in milliseconds.
+         * @return true if completed, false if timed out.
+         */
+        bool wait(timeout_t timeout = Timer::inf);
+
+        /**
+         * Test if task has completed, or was never submitted.
+         * @return true if done.
+         */
+        inline bool is_done(void)
+            {return pending.load(atomic::ACQUIRE) == 0;};
+    };
+
+    /**
+     * Body of a parallel loop.  The loop range is split into chunks of
+     * indexes which are run in worker threads and the calling thread.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class __EXPORT loop
+    {
+    public:
+        virtual ~loop();
+
+        /**
+         * Run a chunk of the loop.
+         * @param first index of chunk.
+         * @param last index of chunk, exclusive.
+         */
+        virtual void run(size_t first, size_t last) = 0;
+    };
+
+private:
+    class worker;
+    friend class worker;
+    friend class task;
+
+    worker **workers;
+    unsigned count;
+    task *overflow, *last;
+    atomic::counter rotor, sleepers;
+    volatile bool stopping;
+
+    __LOCAL worker *current(void);
+    __LOCAL task *take(worker *self);
+    __LOCAL bool available(void);
+    __LOCAL bool execute(worker *self);
+    __LOCAL void idle(worker *self);
+    __LOCAL void complete(task *job);
+    __LOCAL void wake(void);
+
+public:
+    /**
+     * Create a pool of worker threads.
+     * @param size of pool, or 0 for one worker per processor.
+     * @param pinned to bind each worker to its own processor, chosen from
+     * those the process may run on.
+     * @param stack size of worker threads, or 0 for default.
+     */
+    ThreadPool(unsigned size = 0, bool pinned = false, size_t stack = 0);
+
+    /**
+     * Destroy pool.  Tasks already submitted are completed before the
+     * worker threads are joined.
+     */
+    virtual ~ThreadPool();
+
+    /**
+     * Submit a task to be run by a worker thread.
+     * @param job to run.
+     */
+    void submit(task *job);
+
+    /**
+     * Run a loop in parallel.  The calling thread takes part in the loop,
+     * and this returns when all of the loop has been run.
+     * @param body of loop to run.
+     * @param first index of loop.
+     * @param last index of loop, exclusive.
+     * @param grain of indexes per chunk, or 0 to pick one from the pool size.
+     */
+    void parallel(loop& body, size_t first, size_t last, size_t grain = 0);
+
+    /**
+     * Get the number of worker threads in the pool.
+     * @return number of workers.
+     */
+    inline unsigned size(void)
+        {return count;};
+};
+
 /**
  * Auto-pointer support class for locked objects.  This is used as a base
  * class for the templated locked_instance class that uses the managed
@@ -1632,6 +2530,123 @@ public:
         {return dup();};
 };
 
+/**
+ * Templated sequence lock for a small shared value of specific type.  This
+ * is meant for data that is read very often and changed rarely, such as a
+ * configuration generation, a cached time, or a small table.  Reading the
+ * value copies it without taking any lock.  The type must be plain data
+ * that may be copied with memcpy.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+template<typename T>
+class seqlock_of : public SequenceLock
+{
+private:
+    T value;
+
+public:
+    /**
+     * Create a sequence locked value.
+     */
+    inline seqlock_of() : SequenceLock() {};
+
+    /**
+     * Create a sequence locked value with an initial value.
+     * @param initial value.
+     */
+    inline seqlock_of(const T& initial) : SequenceLock()
+        {value = initial;};
+
+    /**
+     * Copy a consistent snapshot of the value.
+     * @param result to copy into.
+     */
+    inline void get(T& result)
+        {read(&result, &value, sizeof(T));};
+
+    /**
+     * Get a consistent snapshot of the value.
+     * @return copy of value.
+     */
+    inline T get(void)
+        {T result; read(&result, &value, sizeof(T)); return result;};
+
+    /**
+     * Replace the value.
+     * @param update to store.
+     */
+    inline void set(const T& update)
+        {write(&value, &update, sizeof(T));};
+
+    /**
+     * Begin an in place update of the value.  The value is modified
+     * through the returned pointer, and commit must be called when done.
+     * @return pointer to value.
+     */
+    inline T *begin(void)
+        {modify(); return &value;};
+
+    /**
+     * Finish an in place update of the value.
+     */
+    inline void end(void)
+        {commit();};
+
+    inline seqlock_of& operator=(const T& update)
+        {set(update); return *this;};
+
+    inline T operator*()
+        {return get();};
+
+    inline operator T()
+        {return get();};
+};
+
+/**
+ * Templated read copy update pointer for objects of specific type.  Readers
+ * use an EpochDomain::guard, or enter and leave the domain, around access
+ * to the object, and never lock.  Writers publish a new object, and the
+ * prior one is deleted when no reader can still see it.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+template<class T>
+class rcu_pointer : public RCUPointer
+{
+private:
+    static void release(void *object)
+        {delete static_cast<T*>(object);};
+
+public:
+    /**
+     * Create a typed read copy update pointer.
+     * @param domain to retire objects to.
+     */
+    inline rcu_pointer(EpochDomain *domain) : RCUPointer(domain, &release) {};
+
+    /**
+     * Get the current typed object.  The caller must be inside the domain.
+     * @return typed object.
+     */
+    inline const T *get(void)
+        {return static_cast<const T*>(RCUPointer::get());};
+
+    /**
+     * Replace the current typed object with a new one.
+     * @param object to publish.
+     */
+    inline void replace(T *object)
+        {RCUPointer::replace(object);};
+
+    inline void operator=(T *object)
+        {replace(object);};
+
+    inline const T *operator*()
+        {return get();};
+
+    inline const T *operator->()
+        {return get();};
+};
+
 /**
  * Templated locked pointer for referencing locked objects of specific type.
  * This is used as typed template for the LockedPointer object reference
@@ -1847,6 +2862,11 @@ typedef Mutex mutex_t;
  */
 typedef ThreadLock rwlock_t;
 
+/**
+ * Convenience type for using big reader locks.
+ */
+typedef BigReaderLock brlock_t;
+
 /**
  * Convenience type for using recursive exclusive locks.
  */
@@ -264,7 +264,11 @@ public:
  * on events that have expired.  The timer queue also determines the
  * wait time until the next timer will expire.  When timer events are
  * modified, they can retrigger the queue to re-examine the list to
- * find when the next timer will now expire.
+ * find when the next timer will now expire.  Armed events are kept in a
+ * hierarchical timing wheel, so arming, disarming, and expiring an event
+ * takes constant time no matter how many events are on the queue.  The
+ * wheel ticks at a resolution set when the queue is created, and events
+ * expire on the first tick at or after their timeout.
  * @author David Sugar <dyfet@gnutelephony.org>
  */
 class __EXPORT TimerQueue : public OrderedIndex
@@ -280,6 +284,11 @@ public:
      */
     class __EXPORT event : protected Timer, public LinkedList
     {
+    private:
+        event *wnext, **wlink;
+        unsigned long due;
+        unsigned level;
+
     protected:
         friend class TimerQueue;
 
@@ -302,8 +311,9 @@ public:
         virtual void expired(void) = 0;
 
         /**
-         * Expected next timeout for the timer.  This may be overriden
-         * for strategy purposes when evaluted by timer queue's expire.
+         * Expected next timeout for the timer.  This is called by the
+         * timer queue's dispatch when the event is due, and calls the
+         * expired method.  It may be overriden for strategy purposes.
          * @return milliseconds until timer next triggers.
          */
         virtual timeout_t timeout(void);
@@ -357,6 +367,27 @@ public:
             {return static_cast<TimerQueue*>(Root);};
     };
 
+private:
+    // a 256 slot root wheel and four 64 slot outer wheels cover 2^32 ticks
+    enum {ROOT = 256, SLOTS = 64, LEVELS = 5, BATCH = 32};
+
+    event *root[ROOT];
+    event *wheel[LEVELS - 1][SLOTS];
+    event *due;
+    unsigned counts[LEVELS];
+    unsigned long clock;
+    timeout_t resolution;
+    Timer::tick_t epoch;
+
+    __LOCAL unsigned long now(void);
+    __LOCAL void link(event *timer, event **slot, unsigned level);
+    __LOCAL void unlink(event *timer);
+    __LOCAL void insert(event *timer);
+    __LOCAL void schedule(event *timer);
+    __LOCAL unsigned cascade(unsigned level);
+    __LOCAL void advance(unsigned long current);
+    __LOCAL timeout_t next(void);
+
 protected:
     friend class event;
 
@@ -373,12 +404,30 @@ protected:
      */
     virtual void update(void) = 0;
 
+    /**
+     * Dispatch a batch of expired events.  This is called from expire
+     * outside of modify and update, and by default calls the timeout
+     * method of each event.  A derived queue may override this to handle
+     * expired events together, such as handing them to a thread pool.
+     * @param list of expired events.
+     * @param count of events in list.
+     */
+    virtual void dispatch(event **list, unsigned count);
+
 public:
     /**
-     * Create an empty timer queue.
+     * Create an empty timer queue with millisecond resolution.
      */
     TimerQueue();
 
+    /**
+     * Create an empty timer queue with a specific resolution.  A coarse
+     * resolution lets long session timers be tracked with fewer wheel
+     * ticks.
+     * @param resolution of wheel ticks in milliseconds.
+     */
+    TimerQueue(timeout_t resolution);
+
     /**
      * Destroy queue, does not remove event objects.
      */
@@ -400,7 +449,10 @@ public:
      * Process timer queue and find when next event triggers.  This function
      * will call the expired methods on expired timers.  Normally this function
      * will be called in the context of a timer thread which sleeps for the
-     * timeout returned unless it is awoken on an update event.
+     * timeout returned unless it is awoken on an update event.  Events that
+     * expire together are dispatched in batches.  The timeout returned may
+     * be early for far off events, in which case the next call will find
+     * nothing expired and return a new timeout.
      * @return timeout until next timer expires in milliseconds.
      */
     timeout_t expire();
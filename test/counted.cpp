@@ -0,0 +1,131 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+//
+// This file is part of GNU uCommon C++.
+//
+// GNU uCommon C++ is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// GNU uCommon C++ is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with GNU uCommon C++.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <ucommon/ucommon.h>
+
+#include <stdio.h>
+
+using namespace UCOMMON_NAMESPACE;
+
+// retain/release timings for counted objects shared between threads.  The
+// locked case is what sharing a CountedObject safely needs today...
+
+#define ITERATIONS  1000000
+
+class countedObject : public CountedObject
+{
+};
+
+class atomicObject : public AtomicObject
+{
+};
+
+static Mutex guard;
+
+class benchThread : public JoinableThread
+{
+public:
+    ObjectProtocol *object;
+    bool locking;
+
+    benchThread() : JoinableThread() {object = NULL; locking = false;};
+
+    void run(void) {
+        for(unsigned pos = 0; pos < ITERATIONS; ++pos) {
+            if(locking) {
+                guard.acquire();
+                object->retain();
+                guard.release();
+                guard.acquire();
+                object->release();
+                guard.release();
+            }
+            else {
+                object->retain();
+                object->release();
+            }
+        }
+    };
+
+    ~benchThread() {
+        join();
+    }
+};
+
+static void bench(const char *name, unsigned threads, ObjectProtocol **objects, bool locking)
+{
+    benchThread **list = new benchThread *[threads];
+    Timer::tick_t started = Timer::ticks();
+
+    for(unsigned pos = 0; pos < threads; ++pos) {
+        list[pos] = new benchThread();
+        list[pos]->object = objects[pos];
+        list[pos]->locking = locking;
+        list[pos]->start();
+    }
+
+    for(unsigned pos = 0; pos < threads; ++pos)
+        delete list[pos];
+
+    // ticks are 100ns units, and each iteration is a retain and release...
+    double elapsed = (double)(Timer::ticks() - started) * 100.0;
+    printf("%-28s %2u threads %8.1f ns/op\n", name, threads,
+        elapsed / ((double)ITERATIONS * 2.0 * threads));
+
+    delete[] list;
+}
+
+extern "C" int main()
+{
+    unsigned cpus = Thread::cpus();
+    unsigned threads = cpus < 2 ? 2 : cpus;
+    ObjectProtocol **shared = new ObjectProtocol *[threads];
+    ObjectProtocol **single = new ObjectProtocol *[threads];
+
+    printf("%u cpus\n", cpus);
+
+    countedObject *counted = new countedObject();
+    counted->retain();
+    for(unsigned pos = 0; pos < threads; ++pos)
+        shared[pos] = counted;
+    bench("CountedObject, mutex", 1, shared, true);
+    bench("CountedObject, mutex", threads, shared, true);
+
+    atomicObject *atomics = new atomicObject();
+    atomics->retain();
+    for(unsigned pos = 0; pos < threads; ++pos) {
+        shared[pos] = atomics;
+        single[pos] = new atomicObject();
+        single[pos]->retain();
+    }
+    bench("AtomicObject, shared", 1, shared, false);
+    bench("AtomicObject, shared", threads, shared, false);
+    bench("AtomicObject, per thread", threads, single, false);
+
+    counted->release();
+    atomics->release();
+    for(unsigned pos = 0; pos < threads; ++pos)
+        single[pos]->release();
+
+    delete[] shared;
+    delete[] single;
+    return 0;
+}
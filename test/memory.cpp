@@ -25,8 +25,68 @@
 
 using namespace UCOMMON_NAMESPACE;
 
+class arenaThread : public JoinableThread
+{
+private:
+    arenapager *heap;
+
+public:
+    arenaThread(arenapager *pager) : JoinableThread() {
+        heap = pager;
+    }
+
+    void run(void) {
+        for(unsigned count = 0; count < 1000; ++count) {
+            unsigned *value = (unsigned *)heap->alloc(sizeof(unsigned));
+            *value = count;
+        }
+    }
+
+    ~arenaThread() {
+        join();
+    }
+};
+
 extern "C" int main()
 {
+    arenapager arenas(1024);
+    arenaThread *t1 = new arenaThread(&arenas);
+    arenaThread *t2 = new arenaThread(&arenas);
+
+    // arena of an exited thread is re-used by the next thread...
+    t1->start();
+    delete t1;
+    t2->start();
+    delete t2;
+    assert(arenas.threads() == 1);
+    assert(arenas.pages() > 2);
+    assert(arenas.utilization() > 0);
+
+    char *mem = (char *)arenas.alloc(16);
+    assert(mem != NULL);
+    assert(arenas.threads() == 1);
+    arenas.purge();
+    assert(arenas.pages() == 0);
+    mem = (char *)arenas.alloc(16);
+    assert(mem != NULL && arenas.pages() == 1);
+
+    mempool pool(1024);
+    void *b1 = pool.alloc(20);
+    void *b2 = pool.alloc(100);
+    assert(pool.used() == 120);
+    pool.dealloc(b1);
+    assert(pool.used() == 100 && pool.reusable() == 1);
+    assert(pool.highwater() == 120);
+    assert(pool.fragmentation() > 0);
+    // freed block re-used for a request of the same size class...
+    assert(pool.alloc(24) == b1);
+    assert(pool.reusable() == 0);
+    pool.dealloc(b2);
+    assert(pool.alloc(90) == b2);
+    assert(pool.pages() == 1);
+    pool.purge();
+    assert(pool.used() == 0 && pool.highwater() == 0);
+
     stringlist_t mylist;
     stringlistitem_t *item;
 
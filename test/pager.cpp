@@ -0,0 +1,121 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+//
+// This file is part of GNU uCommon C++.
+//
+// GNU uCommon C++ is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// GNU uCommon C++ is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with GNU uCommon C++.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <ucommon/ucommon.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace UCOMMON_NAMESPACE;
+
+// timings of allocations that do not fit in any existing page as a pager
+// grows.  The first fit pager walks every page from the newest, as
+// memalloc used to, so it slows with the number of pages...
+
+#define PAGESIZE    1024
+#define ALLOCS      1000
+
+class firstfit
+{
+private:
+    typedef struct page {
+        struct page *next;
+        size_t used;
+    } page_t;
+
+    page_t *list;
+    unsigned count;
+
+public:
+    firstfit() {list = NULL; count = 0;};
+
+    ~firstfit() {
+        while(list) {
+            page_t *next = list->next;
+            free(list);
+            list = next;
+        }
+    };
+
+    inline unsigned pages(void) const
+        {return count;};
+
+    void *alloc(size_t size) {
+        page_t *p = list;
+
+        while(size % sizeof(void *))
+            ++size;
+
+        while(p) {
+            if(size <= PAGESIZE - p->used)
+                break;
+            p = p->next;
+        }
+        if(!p) {
+            p = (page_t *)malloc(PAGESIZE);
+            crit(p != NULL, "page alloc failed");
+            p->used = sizeof(page_t);
+            p->next = list;
+            list = p;
+            ++count;
+        }
+        caddr_t mem = ((caddr_t)p) + p->used;
+        p->used += size;
+        return mem;
+    };
+};
+
+// ticks are 100ns units...
+static unsigned long walked(unsigned pages)
+{
+    firstfit heap;
+    Timer::tick_t start;
+
+    while(heap.pages() < pages)
+        heap.alloc(600);
+
+    start = Timer::ticks();
+    for(unsigned count = 0; count < ALLOCS; ++count)
+        heap.alloc(600);
+    return (unsigned long)((Timer::ticks() - start) * 100 / ALLOCS);
+}
+
+static unsigned long indexed(unsigned pages)
+{
+    memalloc heap(PAGESIZE);
+    Timer::tick_t start;
+
+    while(heap.pages() < pages)
+        heap.alloc(600);
+
+    start = Timer::ticks();
+    for(unsigned count = 0; count < ALLOCS; ++count)
+        heap.alloc(600);
+    return (unsigned long)((Timer::ticks() - start) * 100 / ALLOCS);
+}
+
+extern "C" int main()
+{
+    printf("%8s %14s %14s\n", "pages", "first fit", "memalloc");
+    for(unsigned pages = 256; pages <= 16384; pages *= 2)
+        printf("%8u %11lu ns %11lu ns\n", pages, walked(pages), indexed(pages));
+    return 0;
+}
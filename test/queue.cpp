@@ -40,6 +40,107 @@ static mempager pool;
 static paged_reuse<myobject> myobjects(&pool, 100);
 static queueof<myobject> mycache(&pool, 10);
 
+typedef struct {
+    unsigned id, seq;
+} record_t;
+
+static ringof<record_t> ring(16);
+static atomic::counter received;
+static atomic::counter64 checksum;
+
+class producer : public JoinableThread
+{
+public:
+    unsigned id;
+
+    producer(unsigned ident) : JoinableThread() {
+        id = ident;
+    }
+
+    void run(void) {
+        record_t rec;
+        rec.id = id;
+        for(rec.seq = 0; rec.seq < 50000; ++rec.seq)
+            ring.put(&rec);
+    }
+
+    ~producer() {
+        join();
+    }
+};
+
+class consumer : public JoinableThread
+{
+public:
+    consumer() : JoinableThread() {};
+
+    void run(void) {
+        record_t rec;
+        while(ring.copy(&rec, 1000)) {
+            checksum += rec.seq;
+            ++received;
+        }
+    }
+
+    ~consumer() {
+        join();
+    }
+};
+
+static pipeof<unsigned> pipeline(64);
+static unsigned piped = 0;
+
+class pipeWriter : public JoinableThread
+{
+public:
+    pipeWriter() : JoinableThread() {};
+
+    void run(void) {
+        unsigned batch[10];
+        unsigned seq = 0, pos;
+
+        while(seq < 100000) {
+            for(pos = 0; pos < 10; ++pos)
+                batch[pos] = seq + pos;
+            // use blocking put for the remainder of a partial batch...
+            pos = pipeline.push(batch, 10);
+            while(pos < 10)
+                pipeline.put(&batch[pos++]);
+            seq += 10;
+        }
+    }
+
+    ~pipeWriter() {
+        join();
+    }
+};
+
+class pipeReader : public JoinableThread
+{
+public:
+    pipeReader() : JoinableThread() {};
+
+    void run(void) {
+        unsigned batch[16];
+        unsigned count;
+
+        while(piped < 100000) {
+            count = pipeline.copy(batch, 16, 1000);
+            if(!count)
+                break;
+            for(unsigned pos = 0; pos < count; ++pos) {
+                if(batch[pos] != piped)
+                    return;
+                ++piped;
+            }
+        }
+    }
+
+    ~pipeReader() {
+        join();
+    }
+};
+
 extern "C" int main()
 {
 	unsigned i;
@@ -69,6 +170,66 @@ extern "C" int main()
     x = init<myobject>(NULL);
     assert(x == NULL);
     assert(reused == 11);
+
+    record_t rec, out;
+    assert(ring.size() == 16);
+    assert(!ring);
+    assert(!ring.copy(&out, 0));
+    for(i = 0; i < 16; ++i) {
+        rec.id = 0;
+        rec.seq = i;
+        assert(ring.put(&rec, 0));
+    }
+    assert(ring.count() == 16);
+    assert(!ring.put(&rec, 10));
+    ring.copy(&out);
+    assert(out.seq == 0);
+    assert(ring.put(&rec, 0));
+    for(i = 1; i < 16; ++i) {
+        ring.copy(&out);
+        assert(out.seq == i);
+    }
+    ring.copy(&out);
+    assert(out.seq == 15);
+    assert(!ring);
+
+    // producers block on a full ring and consumers on an empty one...
+    producer *p1 = new producer(1);
+    producer *p2 = new producer(2);
+    consumer *c1 = new consumer();
+    consumer *c2 = new consumer();
+    c1->start();
+    c2->start();
+    p1->start();
+    p2->start();
+    delete p1;
+    delete p2;
+    delete c1;
+    delete c2;
+    assert((long)received == 100000);
+    assert(*checksum == 2 * (49999ll * 50000ll / 2));
+
+    unsigned values[4] = {1, 2, 3, 4}, value;
+    assert(pipeline.size() == 64);
+    assert(pipeline.push(values, 4) == 4);
+    assert(pipeline.count() == 4);
+    assert(pipeline.pull(values, 2) == 2);
+    assert(values[0] == 1 && values[1] == 2);
+    pipeline.copy(&value);
+    assert(value == 3);
+    assert(pipeline.copy(&value, 0));
+    assert(value == 4);
+    assert(!pipeline.copy(&value, 10));
+    assert(!pipeline);
+
+    // batches wrap around the end of the pipe and stay in order...
+    pipeWriter *w = new pipeWriter();
+    pipeReader *r = new pipeReader();
+    r->start();
+    w->start();
+    delete w;
+    delete r;
+    assert(piped == 100000);
     return 0;
 }
 
@@ -22,6 +22,7 @@
 #include <ucommon/ucommon.h>
 
 #include <stdio.h>
+#include <fcntl.h>
 
 using namespace UCOMMON_NAMESPACE;
 
@@ -31,6 +32,68 @@ static Socket::address testing6("44:022:66::1", 4444);
 static Socket::address localhost6("::1", 4444);
 #endif
 
+static unsigned accepts = 0, received = 0, idle = 0;
+
+class echoHandler : public SocketReactor::handler
+{
+public:
+    echoHandler(socket_t so) : SocketReactor::handler(so, 50) {};
+
+    ~echoHandler() {
+        if(reactor())
+            reactor()->detach(this);
+        Socket::release(so);
+    };
+
+protected:
+    void readable(void) {
+        char buf[64];
+        ssize_t len;
+
+        while((len = ::recv(so, buf, sizeof(buf), 0)) > 0) {
+            received += (unsigned)len;
+            ::send(so, buf, len, 0);
+            arm(50);
+        }
+        if(len == 0)
+            delete this;
+    };
+
+    void expired(void) {
+        ++idle;
+        delete this;
+    };
+};
+
+class testAcceptor : public SocketReactor::acceptor
+{
+public:
+    testAcceptor(const ListenSocket& listener) : SocketReactor::acceptor(listener) {};
+
+protected:
+    void accepted(socket_t so, struct sockaddr_storage *peer) {
+        ++accepts;
+        reactor()->attach(new echoHandler(so));
+    };
+};
+
+static fsys::offset_t reported = 0;
+
+static bool progress(void *user, fsys::offset_t copied, fsys::offset_t total)
+{
+    assert(copied > *(fsys::offset_t *)user && copied <= total);
+    *(fsys::offset_t *)user = copied;
+    return true;
+}
+
+static unsigned released = 0;
+
+static void release(void *user, const void *buffer, size_t size)
+{
+    ++released;
+    *(size_t *)user += size;
+}
+
 extern "C" int main()
 {
     struct sockaddr_internet addr;
@@ -58,5 +121,353 @@ extern "C" int main()
         assert(0 == strcmp(addrbuf, "44:22:66::1"));
     }
 #endif
+
+    ListenSocket listener("127.0.0.1", "4445", 5, AF_INET);
+    Socket::address server("127.0.0.1", 4445);
+    SocketReactor reactor;
+    testAcceptor acceptor(listener);
+    char buf[8];
+
+    assert(reactor.is_valid());
+    assert(reactor.attach(&acceptor));
+
+    socket_t active = Socket::create(AF_INET, SOCK_STREAM, 0);
+    socket_t quiet = Socket::create(AF_INET, SOCK_STREAM, 0);
+    assert(Socket::connectto(active, server.getList()) == 0);
+    assert(Socket::connectto(quiet, server.getList()) == 0);
+    assert(::send(active, "hello", 5, 0) == 5);
+
+    for(unsigned loops = 0; loops < 100 && (accepts < 2 || received < 5); ++loops)
+        reactor.poll(10);
+    assert(accepts == 2 && received == 5);
+    assert(reactor.size() == 3);
+    assert(::recv(active, buf, sizeof(buf), 0) == 5);
+
+    // closing one and letting the other idle out removes both...
+    Socket::release(active);
+    for(unsigned loops = 0; loops < 100 && reactor.size() > 1; ++loops)
+        reactor.poll(10);
+    assert(reactor.size() == 1);
+    assert(idle == 1);
+    Socket::release(quiet);
+
+    reactor.stop();
+    assert(!reactor.poll());
+
+    socket_t writer = Socket::create(AF_INET, SOCK_STREAM, 0);
+    assert(Socket::connectto(writer, server.getList()) == 0);
+    assert(Socket::wait(listener.handle(), 1000));
+    socket_t client = Socket::acceptfrom(listener.handle());
+    assert(client != INVALID_SOCKET);
+    Socket::blocking(client, true);
+
+    const char *lines = "one\r\ntwo\nsomewhat longer\nlast";
+    assert(::send(writer, lines, strlen(lines), 0) == (ssize_t)strlen(lines));
+    Socket::release(writer);
+
+    LineReader reader(client, 8);
+    size_t len;
+    char *line = reader.getline(&len);
+    assert(line && len == 3 && eq(line, "one"));
+    assert(reader.readline(buf, sizeof(buf)) == 4);
+    assert(eq(buf, "two"));
+    line = reader.getline(&len);
+    assert(line && len == 8 && eq(line, "somewhat"));
+    line = reader.getline(&len);
+    assert(line && eq(line, " longer"));
+    line = reader.getline(&len);
+    assert(line && eq(line, "last"));
+    assert(reader.getline() == NULL);
+    assert(reader.is_eof() && !reader.err());
+    Socket::release(client);
+
+    // the compiled table must agree with a linear cidr::find...
+    cidr::policy *policy = NULL;
+    char cbuf[64];
+    srand(1);
+    for(unsigned pos = 0; pos < 300; ++pos) {
+        snprintf(cbuf, sizeof(cbuf), "%u.%u.%u.%u/%u", 10 + rand() % 2, rand() % 4,
+            rand() % 256, rand() % 256, 1 + rand() % 32);
+        new cidr(&policy, cbuf);
+    }
+    new cidr(&policy, "fd00::/8");
+    new cidr(&policy, "fd00:1234::/32");
+    cidr::table index(policy);
+    assert(index.count() == 302);
+
+    struct sockaddr_in host;
+    memset(&host, 0, sizeof(host));
+    host.sin_family = AF_INET;
+    for(unsigned pos = 0; pos < 5000; ++pos) {
+        uint32_t ip = ((10 + rand() % 2) << 24) | ((rand() % 4) << 16) | (rand() % 65536);
+        host.sin_addr.s_addr = htonl(ip);
+        assert(index.find((struct sockaddr *)&host) == cidr::find(policy, (struct sockaddr *)&host));
+    }
+
+#ifdef  AF_INET6
+    Socket::address inner("fd00:1234::1", 4444);
+    Socket::address outer("fd01::1", 4444);
+    assert(index.find(inner.get(AF_INET6)) != NULL);
+    assert(index.find(inner.get(AF_INET6))->getMask() == 32);
+    assert(index.find(outer.get(AF_INET6))->getMask() == 8);
+    assert(index.find(outer.get(AF_INET6)) == cidr::find(policy, outer.get(AF_INET6)));
+#endif
+
+    cidr::policy *narrow = NULL;
+    cidr local(&narrow, "127.0.0.0/8");
+    assert(index.rebuild(narrow));
+    assert(index.count() == 1);
+    host.sin_addr.s_addr = htonl(0x7f000001);
+    assert(index.find((struct sockaddr *)&host) == &local);
+
+    // a batch sent from one datagram socket is collected by another...
+    Socket::address inbox("127.0.0.1", 4446);
+    socket_t rx = Socket::create(AF_INET, SOCK_DGRAM, 0);
+    socket_t tx = Socket::create(AF_INET, SOCK_DGRAM, 0);
+    assert(Socket::bindto(rx, "127.0.0.1", "4446") == 0);
+    assert(Socket::bindto(tx, "127.0.0.1", "4447") == 0);
+
+    PacketBatch outgoing(tx, 4, 64);
+    PacketBatch incoming(rx, 8, 64);
+    assert(incoming.recv(0) == 0 && !incoming.err());
+    assert(outgoing.put("first", 5, inbox.get(AF_INET)));
+    assert(outgoing.put("second", 6, inbox.get(AF_INET)));
+    assert(outgoing.put("third", 5, inbox.get(AF_INET)));
+    assert(!outgoing.put(cbuf, sizeof(cbuf) + 1, inbox.get(AF_INET)));
+    assert(outgoing.count() == 3);
+    assert(outgoing.send() == 3 && !outgoing.err());
+
+    unsigned got = 0;
+    for(unsigned loops = 0; loops < 10 && got < 3; ++loops) {
+        unsigned count = incoming.recv(100);
+        for(unsigned pos = 0; pos < count; ++pos, ++got) {
+            PacketBatch::packet_t& pkt = incoming[pos];
+            if(got == 1)
+                assert(pkt.length == 6 && !memcmp(pkt.data, "second", 6));
+            else
+                assert(pkt.length == 5);
+            assert(Socket::service(&pkt.address) == 4447);
+        }
+    }
+    assert(got == 3);
+    assert(incoming.recv(0) == 0);
+
+    // a segmented send arrives as datagrams, or one coalesced buffer...
+    char train[350], coalesced[2048];
+    for(unsigned pos = 0; pos < sizeof(train); ++pos)
+        train[pos] = (char)('a' + pos / 100);
+    Socket::coalesce(rx, true);
+    assert(Socket::sendsegments(tx, train, sizeof(train), 100, inbox.get(AF_INET)) == (ssize_t)sizeof(train));
+
+    unsigned datagrams = 0;
+    size_t total = 0;
+    while(total < sizeof(train) && Socket::wait(rx, 1000)) {
+        unsigned segment = 0;
+        ssize_t result = Socket::recvsegments(rx, coalesced, sizeof(coalesced), &segment);
+        assert(result > 0 && segment > 0);
+        for(ssize_t offset = 0; offset < result; offset += segment, ++datagrams) {
+            size_t size = segment;
+            if(offset + size > (size_t)result)
+                size = result - offset;
+            assert(size == (datagrams < 3 ? 100u : 50u));
+            assert(coalesced[offset] == (char)('a' + datagrams));
+            assert(!memcmp(coalesced + offset, train + total + offset, size));
+        }
+        total += result;
+    }
+    assert(total == sizeof(train) && datagrams == 4);
+
+    // a train too long for one segmented send is split up...
+    static char longtrain[100000], longbuf[65536];
+    for(unsigned pos = 0; pos < sizeof(longtrain); ++pos)
+        longtrain[pos] = (char)(pos / 1000);
+    Socket::recvsize(rx, 262144);
+    assert(Socket::sendsegments(tx, longtrain, sizeof(longtrain), 1000, inbox.get(AF_INET)) == (ssize_t)sizeof(longtrain));
+
+    datagrams = 0;
+    total = 0;
+    while(total < sizeof(longtrain) && Socket::wait(rx, 1000)) {
+        unsigned segment = 0;
+        ssize_t result = Socket::recvsegments(rx, longbuf, sizeof(longbuf), &segment);
+        assert(result > 0 && segment == 1000 && result % 1000 == 0);
+        for(ssize_t offset = 0; offset < result; offset += segment, ++datagrams)
+            assert(longbuf[offset] == (char)datagrams);
+        assert(!memcmp(longbuf, longtrain + total, result));
+        total += result;
+    }
+    assert(total == sizeof(longtrain) && datagrams == 100);
+
+    // ranges of a file move to another file, a pipe, and a tcp session...
+    char block[10000], check[10000];
+    for(unsigned pos = 0; pos < sizeof(block); ++pos)
+        block[pos] = (char)(pos % 251);
+    fsys source("transfer.src", fsys::OWNER_PRIVATE, fsys::REWRITE);
+    fsys target("transfer.dst", fsys::OWNER_PRIVATE, fsys::REWRITE);
+    assert(is(source) && is(target));
+    assert(source.write(block, sizeof(block)) == (ssize_t)sizeof(block));
+
+    fsys::offset_t offset = 100;
+    assert(source.transfer(*target, &offset, 5000) == 5000);
+    assert(offset == 5100);
+    assert(fsys::transfer(*target, *source, &offset, 10000) == 4900);
+    assert(offset == 10000);
+    assert(fsys::transfer(*target, *source, &offset, 100) == 0);
+    target.seek(0);
+    assert(target.read(check, sizeof(check)) == 9900);
+    assert(!memcmp(check, block + 100, 9900));
+
+    fd_t pin, pout;
+    assert(fsys::pipe(pin, pout) == 0);
+    assert(fsys::transfer(pout, *source, NULL, 0) == 0);
+    offset = 0;
+    assert(fsys::transfer(pout, *source, &offset, 1000) == 1000);
+    fsys::release(pout);
+    target.seek(0);
+    assert(fsys::transfer(*target, pin, NULL, 2000) == 1000);
+    fsys::release(pin);
+    target.seek(0);
+    assert(target.read(check, 1000) == 1000);
+    assert(!memcmp(check, block, 1000));
+
+    // a full non-blocking target returns rather than waiting...
+    assert(fsys::pipe(pin, pout) == 0);
+    fcntl(pout, F_SETFL, fcntl(pout, F_GETFL) | O_NONBLOCK);
+    while(::write(pout, block, sizeof(block)) > 0)
+        ;
+    offset = 0;
+    assert(fsys::transfer(pout, *source, &offset, 1000) == -1 && errno == EAGAIN);
+    assert(offset == 0);
+    fd_t qin, qout;
+    assert(fsys::pipe(qin, qout) == 0);
+    assert(::write(qout, block, 1000) == 1000);
+    assert(fsys::transfer(pout, qin, NULL, 1000) == -1 && errno == EAGAIN);
+    fcntl(pin, F_SETFL, fcntl(pin, F_GETFL) | O_NONBLOCK);
+    while(::read(pin, check, sizeof(check)) > 0)
+        ;
+    assert(fsys::transfer(pout, qin, NULL, 1000) == 1000);
+    assert(::read(pin, check, sizeof(check)) == 1000);
+    assert(!memcmp(check, block, 1000));
+    fsys::release(qin);
+    fsys::release(qout);
+    fsys::release(pin);
+    fsys::release(pout);
+
+    TCPBuffer session("127.0.0.1", "4445");
+    assert(Socket::wait(listener.handle(), 1000));
+    client = Socket::acceptfrom(listener.handle());
+    assert(client != INVALID_SOCKET);
+    Socket::blocking(client, true);
+    session.put("head", 4);
+    offset = 2000;
+    assert(session.transfer(source, &offset, 3000) == 3000);
+    assert(offset == 5000);
+    session.close();
+
+    total = 0;
+    while(total < 3004) {
+        ssize_t result = ::recv(client, check + total, sizeof(check) - total, 0);
+        if(result < 1)
+            break;
+        total += result;
+    }
+    assert(total == 3004);
+    assert(!memcmp(check, "head", 4) && !memcmp(check + 4, block + 2000, 3000));
+    Socket::release(client);
+    target.close();
+
+    // copies keep content, and holes of a sparse source...
+    assert(fsys::copy("transfer.src", "transfer.dst") == 0);
+    target.open("transfer.dst", fsys::RDONLY);
+    assert(target.read(check, sizeof(check)) == (ssize_t)sizeof(check));
+    assert(!memcmp(check, block, sizeof(block)));
+    target.close();
+
+    target.open("transfer.dst", fsys::OWNER_PRIVATE, fsys::REWRITE);
+    assert(target.write(block, sizeof(block)) == (ssize_t)sizeof(block));
+    assert(target.write(block, sizeof(block)) == (ssize_t)sizeof(block));
+    assert(fsys::copy(*target, *source) == 0);
+    fsys::fileinfo_t cinfo;
+    target.info(&cinfo);
+    assert(cinfo.st_size == (off_t)sizeof(block));
+    target.close();
+
+    source.seek(4 * 1048576);
+    assert(source.write(block, 100) == 100);
+    target.open("transfer.dst", fsys::OWNER_PRIVATE, fsys::REWRITE);
+    assert(fsys::copy(*target, *source, &progress, &reported) == 0);
+    assert(reported == 4 * 1048576 + 100);
+    fsys::fileinfo_t sinfo, tinfo;
+    source.info(&sinfo);
+    target.info(&tinfo);
+    assert(tinfo.st_size == sinfo.st_size);
+    if(sinfo.st_blocks * 512 < sinfo.st_size)
+        assert(tinfo.st_blocks * 512 < tinfo.st_size);
+    target.seek(4 * 1048576 - 10);
+    assert(target.read(check, 110) == 110);
+    assert(!memcmp(check, "\0\0\0\0\0\0\0\0\0\0", 10) && !memcmp(check + 10, block, 100));
+
+    source.close();
+    target.close();
+    fsys::erase("transfer.src");
+    fsys::erase("transfer.dst");
+
+    // large sends are released on completion, small ones at once...
+    static char payload[32768];
+    size_t bytes = 0;
+    for(unsigned pos = 0; pos < sizeof(payload); ++pos)
+        payload[pos] = (char)(pos % 253);
+    writer = Socket::create(AF_INET, SOCK_STREAM, 0);
+    assert(Socket::connectto(writer, server.getList()) == 0);
+    assert(Socket::wait(listener.handle(), 1000));
+    client = Socket::acceptfrom(listener.handle());
+    assert(client != INVALID_SOCKET);
+    Socket::blocking(client, true);
+
+    ZeroCopy sender(writer, &release, &bytes, 4096, 4);
+    assert(sender.send(payload, 1000) == 1000);
+    assert(released == 1 && bytes == 1000 && sender.pending() == 0);
+    assert(sender.send(payload, sizeof(payload)) == sizeof(payload));
+    assert(sender.drain(1000));
+    assert(released == 2 && bytes == 1000 + sizeof(payload));
+
+    static char incoming_data[sizeof(payload) + 1000];
+    total = 0;
+    while(total < sizeof(incoming_data)) {
+        ssize_t result = ::recv(client, incoming_data + total, sizeof(incoming_data) - total, 0);
+        if(result < 1)
+            break;
+        total += result;
+    }
+    assert(total == sizeof(incoming_data));
+    assert(!memcmp(incoming_data, payload, 1000) && !memcmp(incoming_data + 1000, payload, sizeof(payload)));
+    Socket::release(writer);
+    Socket::release(client);
+
+    TCPBuffer stream("127.0.0.1", "4445");
+    assert(Socket::wait(listener.handle(), 1000));
+    client = Socket::acceptfrom(listener.handle());
+    assert(client != INVALID_SOCKET);
+    Socket::blocking(client, true);
+    released = 0;
+    bytes = 0;
+    stream.zerocopy(&release, &bytes, 4096);
+    assert(stream.post("head", 4) == 4);
+    assert(released == 1);
+    assert(stream.post(payload, sizeof(payload)) == sizeof(payload));
+    assert(stream.close());
+    assert(released == 2 && bytes == 4 + sizeof(payload));
+
+    total = 0;
+    while(total < sizeof(payload) + 4) {
+        ssize_t result = ::recv(client, incoming_data + total, sizeof(incoming_data) - total, 0);
+        if(result < 1)
+            break;
+        total += result;
+    }
+    assert(total == sizeof(payload) + 4);
+    assert(!memcmp(incoming_data, "head", 4) && !memcmp(incoming_data + 4, payload, sizeof(payload)));
+    Socket::release(client);
+    Socket::release(tx);
+    Socket::release(rx);
     return 0;
 }
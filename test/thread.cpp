@@ -19,13 +19,22 @@
 #define DEBUG
 #endif
 
+#include <ucommon-config.h>
 #include <ucommon/ucommon.h>
 
 #include <stdio.h>
 
+#if defined(HAVE_SCHED_GETCPU) && !defined(_MSWINDOWS_)
+#include <sched.h>
+#endif
+
 using namespace UCOMMON_NAMESPACE;
 
 static unsigned count = 0;
+static unsigned shared = 0;
+static unsigned locked = 0;
+static atomic::spinlock spin;
+static atomic::ticketlock ticket;
 
 class testThread : public JoinableThread
 {
@@ -38,6 +47,354 @@ public:
     };
 };
 
+class protectThread : public JoinableThread
+{
+public:
+    protectThread() : JoinableThread() {};
+
+    void run(void) {
+        for(unsigned pos = 0; pos < 10000; ++pos) {
+            SYNC(&shared) {
+                ++shared;
+            }
+        }
+    };
+
+    ~protectThread() {
+        join();
+    }
+};
+
+class lockThread : public JoinableThread
+{
+public:
+    lockThread() : JoinableThread() {};
+
+    void run(void) {
+        for(unsigned pos = 0; pos < 10000; ++pos) {
+            spin.lock();
+            ++locked;
+            spin.unlock();
+            ticket.lock();
+            ++locked;
+            ticket.unlock();
+        }
+    };
+
+    ~lockThread() {
+        join();
+    }
+};
+
+static unsigned deallocs = 0;
+
+class sharedObject : public AtomicObject
+{
+protected:
+    void dealloc(void) {
+        ++deallocs;
+        delete this;
+    };
+};
+
+class retainThread : public JoinableThread
+{
+public:
+    ObjectProtocol *object;
+
+    retainThread(ObjectProtocol *obj) : JoinableThread() {object = obj;};
+
+    void run(void) {
+        for(unsigned pos = 0; pos < 20000; ++pos) {
+            auto_object ref(object);
+        }
+    };
+
+    ~retainThread() {
+        join();
+    }
+};
+
+static atomic::counter ran;
+static atomic::sharded hits(16);
+
+class hitThread : public JoinableThread
+{
+public:
+    hitThread() : JoinableThread() {};
+
+    void run(void) {
+        for(unsigned pos = 0; pos < 10000; ++pos)
+            ++hits;
+        hits += 500;
+    };
+
+    ~hitThread() {
+        join();
+    }
+};
+
+static Semaphore gate(2);
+static atomic::counter inside;
+static unsigned crowded = 0;
+
+class gateThread : public JoinableThread
+{
+public:
+    gateThread() : JoinableThread() {};
+
+    void run(void) {
+        for(unsigned pos = 0; pos < 2000; ++pos) {
+            gate.wait();
+            if(++inside > 2)
+                ++crowded;
+            --inside;
+            gate.release();
+        }
+    };
+
+    ~gateThread() {
+        join();
+    }
+};
+
+static BigReaderLock brlock;
+static unsigned left = 0, right = 0;
+static unsigned torn = 0;
+
+class readerThread : public JoinableThread
+{
+public:
+    bool writer;
+
+    readerThread(bool write = false) : JoinableThread() {writer = write;};
+
+    void run(void) {
+        for(unsigned pos = 0; pos < 5000; ++pos) {
+            if(writer && !(pos % 10)) {
+                exclusive_access lock(&brlock);
+                ++left;
+                Thread::yield();
+                ++right;
+                continue;
+            }
+            shared_access lock(&brlock);
+            if(left != right)
+                ++torn;
+        }
+    };
+
+    ~readerThread() {
+        join();
+    }
+};
+
+typedef struct {
+    long first, second;
+} snapshot_t;
+
+static seqlock_of<snapshot_t> snapshot;
+static unsigned mixed = 0;
+
+class snapshotThread : public JoinableThread
+{
+public:
+    bool writer;
+
+    snapshotThread(bool write = false) : JoinableThread() {writer = write;};
+
+    void run(void) {
+        snapshot_t copy;
+        for(long pos = 1; pos <= 5000; ++pos) {
+            if(writer) {
+                copy.first = copy.second = pos;
+                snapshot = copy;
+                continue;
+            }
+            snapshot.get(copy);
+            if(copy.first != copy.second)
+                ++mixed;
+        }
+    };
+
+    ~snapshotThread() {
+        join();
+    }
+};
+
+static atomic::counter released;
+static EpochDomain epochs(8);
+static atomic::counter stale;
+
+class configObject
+{
+public:
+    long serial;
+    bool valid;
+
+    configObject(long id) {serial = id; valid = true;};
+
+    ~configObject() {valid = false; ++released;};
+};
+
+static rcu_pointer<configObject> config(&epochs);
+
+class configThread : public JoinableThread
+{
+public:
+    bool writer;
+
+    configThread(bool write = false) : JoinableThread() {writer = write;};
+
+    void run(void) {
+        for(long pos = 1; pos <= 2000; ++pos) {
+            if(writer) {
+                config = new configObject(pos);
+                continue;
+            }
+            EpochDomain::guard section(&epochs);
+            const configObject *cfg = *config;
+            Thread::yield();
+            if(!cfg || !cfg->valid)
+                ++stale;
+        }
+    };
+
+    ~configThread() {
+        join();
+    }
+};
+
+static bool ranplaced = false;
+static unsigned placecpu = 0;
+
+class placedThread : public JoinableThread
+{
+public:
+    placedThread() : JoinableThread() {};
+
+    void run(void) {
+#if defined(HAVE_SCHED_GETCPU) && !defined(_MSWINDOWS_)
+        if(is_placed())
+            assert(sched_getcpu() == (int)placecpu);
+#endif
+        ranplaced = true;
+    };
+
+    ~placedThread() {
+        join();
+    }
+};
+
+class idleConditional : public Conditional
+{
+public:
+    bool idle(timeout_t timeout) {
+        lock();
+        bool result = wait(timeout);
+        unlock();
+        return result;
+    }
+};
+
+static RecursiveMutex hotrec;
+static ThreadLock hotrw;
+
+class contendThread : public JoinableThread
+{
+public:
+    contendThread() : JoinableThread() {};
+
+    void run(void) {
+        hotrec.lock();
+        hotrec.release();
+        hotrw.modify();
+        hotrw.release();
+    };
+
+    ~contendThread() {
+        join();
+    }
+};
+
+class countTask : public ThreadPool::task
+{
+public:
+    void run(void) {
+        ++ran;
+    };
+};
+
+static Thread::cpuset usable;
+
+class cpuTask : public ThreadPool::task
+{
+public:
+    void run(void) {
+#if defined(HAVE_SCHED_GETCPU) && !defined(_MSWINDOWS_)
+        if(!!usable)
+            assert(usable.has(sched_getcpu()));
+#endif
+        ++ran;
+    };
+};
+
+class sumLoop : public ThreadPool::loop
+{
+public:
+    atomic::counter64 total;
+
+    void run(size_t first, size_t last) {
+        int64_t sum = 0;
+        while(first < last)
+            sum += first++;
+        total += sum;
+    };
+};
+
+// a task that forks more tasks from inside a worker and waits on them...
+class forkTask : public ThreadPool::task
+{
+public:
+    ThreadPool *tp;
+
+    void run(void) {
+        countTask children[8];
+        for(unsigned pos = 0; pos < 8; ++pos)
+            tp->submit(&children[pos]);
+        for(unsigned pos = 0; pos < 8; ++pos)
+            children[pos].wait();
+    };
+};
+
+static unsigned fired = 0;
+
+class testQueue : public TimerQueue
+{
+public:
+    unsigned batches;
+
+    testQueue() : TimerQueue(2) {batches = 0;};
+
+    void modify(void) {};
+    void update(void) {};
+
+    void dispatch(event **list, unsigned count) {
+        ++batches;
+        TimerQueue::dispatch(list, count);
+    };
+};
+
+class testEvent : public TQEvent
+{
+public:
+    testEvent(TimerQueue *tq, timeout_t timeout) : TQEvent(tq, timeout) {};
+
+    void expired(void) {
+        ++fired;
+    };
+};
+
 extern "C" int main()
 {
     time_t now, later;
@@ -57,6 +414,301 @@ extern "C" int main()
     evt.wait(2000);
     time(&later);
     assert(later >= now + 1);
+
+    int a, b;
+    Mutex::protect(&a);
+    Mutex::protect(&b);
+    Mutex::release(&b);
+    Mutex::release(&a);
+
+    // striped protect must nest and serialize like the dynamic one...
+    Mutex::striping(64);
+    Mutex::protect(&a);
+    Mutex::protect(&b);
+    Mutex::protect(&a);
+    Mutex::release(&a);
+    Mutex::release(&b);
+    Mutex::release(&a);
+
+    protectThread *p1 = new protectThread();
+    protectThread *p2 = new protectThread();
+    start(p1);
+    start(p2);
+    delete p1;
+    delete p2;
+    assert(shared == 20000);
+
+    ThreadLock::striping();
+    assert(ThreadLock::writer(&a));
+    assert(ThreadLock::writer(&a));
+    ThreadLock::release(&a);
+    ThreadLock::release(&a);
+    assert(ThreadLock::reader(&b));
+    assert(ThreadLock::reader(&b));
+    ThreadLock::release(&b);
+    ThreadLock::release(&b);
+
+    atomic::counter c(5);
+    long expected = 4;
+    assert(!c.compare_exchange(expected, 9));
+    assert(expected == 5);
+    assert(c.compare_exchange(expected, 9));
+    assert(c.exchange(12) == 9);
+    assert(c.fetch_or(3) == 12);
+    assert(c.fetch_and(6, atomic::RELAXED) == 15);
+    assert(c.load(atomic::ACQUIRE) == 6);
+    assert(c.fetch_sub(2) == 6);
+    assert(++c == 5);
+
+    atomic::counter64 big(0x100000000ll);
+    big += 0x100000000ll;
+    assert(big.load() == 0x200000000ll);
+    int64_t wide = 0x200000000ll;
+    assert(big.compare_exchange(wide, 1));
+    assert(*big == 1);
+
+    atomic_pointer<int> ap(&a);
+    int *ip = &b;
+    assert(!ap.compare_exchange(ip, &b));
+    assert(ip == &a);
+    assert(ap.exchange(&b, atomic::ACQREL) == &a);
+    assert(ap.load() == &b);
+    atomic::fence();
+
+    assert(spin.acquire());
+    assert(!spin.acquire());
+    spin.release();
+    assert(ticket.acquire());
+    assert(!ticket.acquire());
+    ticket.release();
+
+    lockThread *l1 = new lockThread();
+    lockThread *l2 = new lockThread();
+    start(l1);
+    start(l2);
+    delete l1;
+    delete l2;
+    assert(locked == 40000);
+
+    sharedObject *so = new sharedObject();
+    so->retain();
+    retainThread *r1 = new retainThread(so);
+    retainThread *r2 = new retainThread(so);
+    start(r1);
+    start(r2);
+    delete r1;
+    delete r2;
+    assert(so->copied() == 1);
+    assert(deallocs == 0);
+    so->release();
+    assert(deallocs == 1);
+
+    assert(Thread::cpus() >= 1);
+
+    hitThread *h1 = new hitThread();
+    hitThread *h2 = new hitThread();
+    start(h1);
+    start(h2);
+    delete h1;
+    delete h2;
+    assert(hits.load() == 21000);
+    assert(hits.approximate() <= 21000);
+    assert(hits.approximate() >= (long)(21000 - hits.size() * 16));
+    hits.clear();
+    assert(*hits == 0);
+    unsigned slot = hits.index();
+    assert(hits.add(slot, 3) == 3);
+    assert(hits.load(slot) == 3 && hits.load() == 3);
+    assert(++hits >= 1 && --hits <= 3);
+    hits.add(slot, -3);
+    assert(*hits == 0);
+
+    ThreadPool *tp = new ThreadPool(4);
+    assert(tp->size() == 4);
+    countTask *jobs = new countTask[1000];
+    for(unsigned pos = 0; pos < 1000; ++pos)
+        tp->submit(&jobs[pos]);
+    for(unsigned pos = 0; pos < 1000; ++pos)
+        assert(jobs[pos].wait());
+    assert((long)ran == 1000);
+    delete[] jobs;
+
+    forkTask forks[4];
+    for(unsigned pos = 0; pos < 4; ++pos) {
+        forks[pos].tp = tp;
+        tp->submit(&forks[pos]);
+    }
+    for(unsigned pos = 0; pos < 4; ++pos)
+        forks[pos].wait();
+    assert((long)ran == 1032);
+
+    sumLoop body;
+    tp->parallel(body, 0, 100000);
+    assert(*body.total == 4999950000ll);
+
+    // tasks still queued are completed before the pool goes away...
+    countTask tail[16];
+    for(unsigned pos = 0; pos < 16; ++pos)
+        tp->submit(&tail[pos]);
+    delete tp;
+    assert((long)ran == 1048);
+
+    gateThread *gates[4];
+    for(unsigned pos = 0; pos < 4; ++pos) {
+        gates[pos] = new gateThread();
+        gates[pos]->start();
+    }
+    for(unsigned pos = 0; pos < 4; ++pos)
+        delete gates[pos];
+    assert(crowded == 0);
+    assert((long)inside == 0);
+
+    // exhausted semaphore refuses a try, and a raised limit admits more...
+    gate.wait();
+    gate.wait();
+    assert(!gate.wait(0));
+    assert(!gate.wait(5));
+    gate.set(3);
+    assert(gate.wait(0));
+    gate.release();
+    gate.release();
+    gate.release();
+
+    readerThread *readers[4];
+    for(unsigned pos = 0; pos < 4; ++pos) {
+        readers[pos] = new readerThread(pos == 0);
+        readers[pos]->start();
+    }
+    for(unsigned pos = 0; pos < 4; ++pos)
+        delete readers[pos];
+    assert(torn == 0);
+    assert(left == 500 && right == 500);
+    assert(brlock.size() >= 1);
+
+    snapshot_t init = {0, 0};
+    snapshot = init;
+    snapshotThread *snapshots[3];
+    for(unsigned pos = 0; pos < 3; ++pos) {
+        snapshots[pos] = new snapshotThread(pos == 0);
+        snapshots[pos]->start();
+    }
+    for(unsigned pos = 0; pos < 3; ++pos)
+        delete snapshots[pos];
+    assert(mixed == 0);
+    assert((*snapshot).first == 5000);
+    assert(snapshot.generation() == 5001);
+    snapshot.begin()->second = 7;
+    snapshot.end();
+    assert(snapshot.get().second == 7);
+
+    config = new configObject(0);
+    configThread *configs[3];
+    for(unsigned pos = 0; pos < 3; ++pos) {
+        configs[pos] = new configThread(pos == 0);
+        configs[pos]->start();
+    }
+    for(unsigned pos = 0; pos < 3; ++pos)
+        delete configs[pos];
+    assert((long)stale == 0);
+    epochs.synchronize();
+    assert(epochs.pending() == 0);
+    assert((long)released == 2000);
+    assert(config->serial == 2000);
+    assert(epochs.threads() >= 1);
+
+    Mutex hot;
+    hot.profile("hot");
+    hot.lock();
+    hot.unlock();
+    idleConditional cold;
+    cold.profile("cold");
+    assert(!cold.idle(5));
+    hotrec.profile("hotrec");
+    hotrw.profile("hotrw");
+    hotrec.lock();
+    hotrw.modify();
+    contendThread *contender = new contendThread();
+    contender->start();
+    Thread::sleep(20);
+    hotrec.release();
+    Thread::sleep(20);
+    hotrw.release();
+    delete contender;
+#ifdef  UCOMMON_PROFILING
+    unsigned profiled = LockProfile::count();
+    LockProfile::stats_t *stats = new LockProfile::stats_t[profiled];
+    profiled = LockProfile::snapshot(stats, profiled);
+    bool found = false, waited = false, recursive = false, rwlock = false;
+    for(unsigned pos = 0; pos < profiled; ++pos) {
+        if(!stats[pos].name)
+            continue;
+        if(!strcmp(stats[pos].name, "hot"))
+            found = (stats[pos].acquired == 1 && stats[pos].contended == 0);
+        if(!strcmp(stats[pos].name, "cold"))
+            waited = (stats[pos].contended == 0 && stats[pos].waited == 1 && stats[pos].idle > 0);
+        if(!strcmp(stats[pos].name, "hotrec"))
+            recursive = (stats[pos].acquired == 2 && stats[pos].contended > 0 && stats[pos].maxhold >= 10000000ull);
+        if(!strcmp(stats[pos].name, "hotrw"))
+            rwlock = (stats[pos].acquired == 2 && stats[pos].contended > 0 && stats[pos].waited == 0);
+    }
+    delete[] stats;
+    assert(found && waited && recursive && rwlock);
+#else
+    assert(LockProfile::count() == 0);
+#endif
+
+    Thread::cpuset set;
+    assert(set.parse("0-2,5"));
+    assert(set.count() == 4 && set.has(5) && !set.has(3));
+    set.remove(5);
+    assert(!set.parse("3-1"));
+    Thread::topology_t info;
+    if(Thread::topology(0, info)) {
+        assert(info.siblings.has(0));
+        assert(info.node >= 0 && (unsigned)info.node < Thread::nodes());
+    }
+    if(Thread::allowed(set)) {
+        while(!set.has(placecpu))
+            ++placecpu;
+    }
+    set.clear();
+    set.add(placecpu);
+    placedThread *pinned = new placedThread();
+    pinned->pin(set);
+    pinned->place(0);
+    pinned->start();
+    delete pinned;
+    assert(ranplaced);
+
+    // pinned pool workers only bind to processors we may run on...
+    Thread::allowed(usable);
+    tp = new ThreadPool(3, true);
+    cpuTask probes[12];
+    for(unsigned pos = 0; pos < 12; ++pos)
+        tp->submit(&probes[pos]);
+    for(unsigned pos = 0; pos < 12; ++pos)
+        assert(probes[pos].wait());
+    delete tp;
+    assert((long)ran == 1060);
+
+    testQueue tq;
+    testEvent *events[40];
+    for(unsigned pos = 0; pos < 40; ++pos)
+        events[pos] = new testEvent(&tq, 10);
+    testEvent distant(&tq, 600000);
+    events[39]->disarm();
+    timeout_t wait = tq.expire();
+    assert(wait > 0 && wait <= 10);
+    Thread::sleep(20);
+    assert(tq.expire() > 1000);
+    assert(fired == 39);
+    assert(tq.batches == 2);
+    events[0]->arm(5);
+    Thread::sleep(10);
+    tq.expire();
+    assert(fired == 40);
+    for(unsigned pos = 0; pos < 40; ++pos)
+        delete events[pos];
     return 0;
 }
 
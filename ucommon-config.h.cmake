@@ -36,6 +36,10 @@
 #cmakedefine HAVE_REGEX_H 1
 #cmakedefine HAVE_SYS_INOTIFY_H 1
 #cmakedefine HAVE_SYS_EVENT_H 1
+#cmakedefine HAVE_SYS_EPOLL_H 1
+#cmakedefine HAVE_SYS_SENDFILE_H 1
+#cmakedefine HAVE_LINUX_ERRQUEUE_H 1
+#cmakedefine HAVE_LINUX_FUTEX_H 1
 #cmakedefine HAVE_SYSLOG_H 1
 #cmakedefine HAVE_LIBINTL_H 1
 #cmakedefine HAVE_NETINET_IN_H 1
@@ -65,8 +69,12 @@
 #cmakedefine HAVE_PTHREAD_DELAY_NP 1
 #cmakedefine HAVE_PTHREAD_SETCONCURRENCY 1
 #cmakedefine HAVE_PTHREAD_SETSCHEDPRIO 1
+#cmakedefine HAVE_PTHREAD_SETAFFINITY_NP 1
 #cmakedefine HAVE_PTHREAD_YIELD 1
 #cmakedefine HAVE_PTHREAD_YIELD_NP 1
+#cmakedefine HAVE_SCHED_GETCPU 1
+#cmakedefine HAVE_RECVMMSG 1
+#cmakedefine HAVE_SENDMMSG 1
 #cmakedefine HAVE_SHL_LOAD 1
 #cmakedefine HAVE_SHM_OPEN 1
 #cmakedefine HAVE_SOCKETPAIR 1
@@ -78,6 +86,9 @@
 #cmakedefine HAVE_SYSCONF 1
 #cmakedefine HAVE_FTRUNCATE 1
 #cmakedefine HAVE_PWRITE 1
+#cmakedefine HAVE_SENDFILE 1
+#cmakedefine HAVE_SPLICE 1
+#cmakedefine HAVE_COPY_FILE_RANGE 1
 #cmakedefine HAVE_SETPGRP 1
 #cmakedefine HAVE_SETLOCALE 1
 #cmakedefine HAVE_GETTEXT 1
@@ -96,6 +107,7 @@
 
 #cmakedefine POSIX_TIMERS 1
 #cmakedefine GCC_ATOMICS 1
+#cmakedefine LINUX_FUTEX 1
 
 #cmakedefine UCOMMON_LOCALE "${UCOMMON_LOCALE}"
 #cmakedefine UCOMMON_CFGPATH "${UCOMMON_CFGPATH}"
@@ -106,5 +118,9 @@
 #define HAVE_GCC_ATOMICS
 #endif
 
+#if defined(LINUX_FUTEX) && defined(HAVE_LINUX_FUTEX_H)
+#define HAVE_FUTEX
+#endif
+
 #include <ucommon/platform.h>
 